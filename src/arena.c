@@ -0,0 +1,87 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block
+{
+    arena_block_t *next;
+    size_t size;
+    alignas(max_align_t) unsigned char data[];
+};
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+void arena_init(arena_t *arena)
+{
+    memset(arena, 0, sizeof(*arena));
+}
+
+static arena_block_t *arena_new_block(arena_t *arena, size_t size)
+{
+    if(size > SIZE_MAX - sizeof(arena_block_t)) return NULL;
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if(!block) return NULL;
+    block->next = arena->blocks;
+    block->size = size;
+    arena->blocks = block;
+    arena->used = 0;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    if(size > SIZE_MAX - ARENA_ALIGN) return NULL;
+    size_t rounded = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena_block_t *block = arena->blocks;
+    if(!block || block->size - arena->used < rounded)
+    {
+        // at least double what there is, so a ROM that keeps asking chains
+        // on few blocks
+        size_t block_size = block ? block->size * 2 : ARENA_MIN_BLOCK_SIZE;
+        if(block_size < rounded) block_size = rounded;
+        if(!(block = arena_new_block(arena, block_size))) return NULL;
+    }
+    void *ptr = block->data + arena->used;
+    arena->used += rounded;
+    arena->total += rounded;
+    return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len, size_t extra)
+{
+    if(len > SIZE_MAX - 1 - extra) return NULL;
+    char *copy = arena_alloc(arena, len + 1 + extra);
+    if(!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena_block_t *block = arena->blocks;
+    if(block && block->next)
+    {
+        // the last ROM outgrew the first block: replace the chain with one
+        // block that would have held all of it
+        size_t total = arena->total;
+        arena_clear(arena);
+        arena_new_block(arena, total);
+    }
+    arena->used = 0;
+    arena->total = 0;
+}
+
+void arena_clear(arena_t *arena)
+{
+    arena_block_t *block = arena->blocks;
+    while(block)
+    {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// A bump allocator for everything that lives exactly as long as one ROM is
+// being processed: names, decoded headers, region lists, digests. Allocating
+// is a pointer bump and there is no per-object free; arena_reset drops it all
+// at once and keeps the memory for the next ROM.
+//
+// When a ROM needs more than the arena holds, another block is chained on.
+// The next reset folds the blocks into one block big enough for all of them,
+// so after the largest ROM of a batch has been seen nothing is allocated from
+// the heap any more.
+
+typedef struct arena_block arena_block_t;
+
+typedef struct arena
+{
+    arena_block_t *blocks;   // the newest block first
+    size_t used;             // bytes handed out of the newest block
+    size_t total;            // bytes handed out since the last reset, over all blocks
+} arena_t;
+
+// the first block, allocated on the first arena_alloc
+#define ARENA_MIN_BLOCK_SIZE 0x4000
+
+void arena_init(arena_t *arena);
+
+// size bytes aligned for any type, or NULL if the heap is exhausted
+void *arena_alloc(arena_t *arena, size_t size);
+
+// a copy of the first len bytes of str, terminated, with room for extra more
+// bytes after it
+char *arena_strndup(arena_t *arena, const char *str, size_t len, size_t extra);
+
+// gives back everything allocated since the last reset
+void arena_reset(arena_t *arena);
+
+// releases all resources that this object allocated
+void arena_clear(arena_t *arena);
+
+#endif
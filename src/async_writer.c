@@ -0,0 +1,562 @@
+#define _GNU_SOURCE
+
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// what a completion belongs to, in the low bits of its user_data
+enum ring_op
+{
+    RING_OP_OPEN = 0,
+    RING_OP_WRITE,
+    RING_OP_CLOSE,
+    RING_OP_CLEANUP_CLOSE  // closes a slot whose chain broke after the open
+};
+
+typedef struct ring_slot
+{
+    uint32_t len;
+    uint8_t pending;   // completions still to come
+    bool opened;
+    bool closed;
+    bool failed;
+} ring_slot_t;
+
+struct async_writer_ring
+{
+    int fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail;   // SQEs filled in so far; published to *sq_tail on enter
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    ring_slot_t *slots;  // slot i is registered file i
+    uint32_t *free_slots;
+    size_t num_free;
+    char *paths;         // PATH_MAX bytes per slot, alive until the open completes
+};
+
+typedef struct thread_job
+{
+    char path[PATH_MAX];
+    const void *buf;
+    size_t len;
+} thread_job_t;
+
+struct async_writer_threads
+{
+    pthread_mutex_t lock;
+    pthread_cond_t job_queued;
+    pthread_cond_t job_done;
+    thread_job_t *jobs;   // a ring of depth jobs
+    size_t head;
+    size_t num_queued;
+    size_t num_running;
+    size_t num_failed;
+    bool stopping;
+    pthread_t *tids;
+    size_t num_threads;
+};
+
+// more writer threads than this mostly add contention
+#define MAX_WRITER_THREADS 16
+
+// io_uring backend. There is no liburing here, so the three system calls are
+// used directly; see https://kernel.dk/io_uring.pdf and io_uring_setup(2).
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// a zeroed SQE to fill in, or NULL if the submission queue is full
+static struct io_uring_sqe *ring_get_sqe(async_writer_ring_t *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(ring->sqe_tail - head >= ring->sq_entries) return NULL;
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// submits what has been queued and, if wait is set, blocks until at least one
+// completion is available. Returns false if the ring can not be used any more.
+static bool ring_enter(async_writer_ring_t *ring, bool wait)
+{
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    for(;;)
+    {
+        unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if(!to_submit && !wait) return true;
+        int ret = sys_io_uring_enter(ring->fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if(ret >= 0) return true;
+        // EAGAIN/EBUSY: the completion queue is full, so reap before submitting more
+        if(errno == EAGAIN || errno == EBUSY) return true;
+        if(errno != EINTR) return false;
+    }
+}
+
+static void ring_release_slot(async_writer_t *writer, size_t slot_index)
+{
+    async_writer_ring_t *ring = writer->ring;
+    if(ring->slots[slot_index].failed) writer->num_failed++;
+    ring->free_slots[ring->num_free++] = slot_index;
+}
+
+static void ring_complete(async_writer_t *writer, const struct io_uring_cqe *cqe)
+{
+    async_writer_ring_t *ring = writer->ring;
+    size_t slot_index = cqe->user_data >> 2;
+    ring_slot_t *slot = &ring->slots[slot_index];
+    switch(cqe->user_data & 3)
+    {
+        case RING_OP_OPEN:
+            if(cqe->res >= 0) slot->opened = true;
+            else slot->failed = true;
+            break;
+        case RING_OP_WRITE:
+            // a short write breaks the link just like an error does
+            if(cqe->res != (int32_t)slot->len) slot->failed = true;
+            break;
+        default:
+            // a close that was cancelled never ran; one that ran and failed
+            // still gave up the slot
+            if(cqe->res == -ECANCELED) break;
+            slot->closed = true;
+            if(cqe->res < 0) slot->failed = true;
+            break;
+    }
+    if(--slot->pending) return;
+
+    if(slot->opened && !slot->closed)
+    {
+        // the write failed, which cancelled the linked close
+        struct io_uring_sqe *sqe = ring_get_sqe(ring);
+        if(sqe)
+        {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = slot_index + 1;
+            sqe->user_data = (uint64_t)slot_index << 2 | RING_OP_CLEANUP_CLOSE;
+            slot->pending = 1;
+            return;
+        }
+        // no room to close it: the next open into this slot replaces it
+    }
+    ring_release_slot(writer, slot_index);
+}
+
+// handles every completion that has arrived
+static void ring_reap(async_writer_t *writer)
+{
+    async_writer_ring_t *ring = writer->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) ring_complete(writer, &ring->cqes[head & *ring->cq_mask]);
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// waits for at least one completion and handles all that have arrived
+static bool ring_wait(async_writer_t *writer)
+{
+    if(!ring_enter(writer->ring, true)) return false;
+    ring_reap(writer);
+    return true;
+}
+
+static void ring_destroy(async_writer_ring_t *ring)
+{
+    if(ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if(ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    if(ring->fd >= 0) close(ring->fd);
+    free(ring->slots);
+    free(ring->free_slots);
+    free(ring->paths);
+    free(ring);
+}
+
+// opens and closes "/" through slot 0, checking that the kernel can open into
+// registered slots (5.15 and later); older ones take other fields for
+// file_index or reject it
+static bool ring_probe(async_writer_t *writer)
+{
+    async_writer_ring_t *ring = writer->ring;
+    ring->num_free--;
+    ring_slot_t *slot = &ring->slots[0];
+    slot->pending = 3;
+    slot->len = 0;
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)"/";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = RING_OP_OPEN;
+    // a no-op stands in for the write, so the probe posts as many
+    // completions as a real file does
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = RING_OP_WRITE;
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    sqe->user_data = RING_OP_CLOSE;
+    while(ring->num_free < writer->depth)
+        if(!ring_wait(writer)) return false;
+    bool ok = !writer->num_failed && slot->opened && slot->closed;
+    writer->num_failed = 0;
+    return ok;
+}
+
+static async_writer_result_t ring_init(async_writer_t *writer)
+{
+    async_writer_ring_t *ring = calloc(1, sizeof(async_writer_ring_t));
+    if(!ring) return ASYNC_WRITER_RESULT_ALLOC_ERR;
+    ring->fd = -1;
+    writer->ring = ring;
+    async_writer_result_t result = ASYNC_WRITER_RESULT_ALLOC_ERR;
+    ring->slots = calloc(writer->depth, sizeof(ring_slot_t));
+    ring->free_slots = malloc(writer->depth * sizeof(uint32_t));
+    ring->paths = malloc(writer->depth * PATH_MAX);
+    int *files = malloc(writer->depth * sizeof(int));
+    if(!ring->slots || !ring->free_slots || !ring->paths || !files) goto fail;
+    size_t i;
+    for(i = 0; i < writer->depth; i++)
+    {
+        ring->free_slots[i] = writer->depth - 1 - i;
+        files[i] = -1;
+    }
+    ring->num_free = writer->depth;
+
+    // from here on any failure just means io_uring is not available
+    result = ASYNC_WRITER_RESULT_SUBMIT_ERR;
+    // a file takes three SQEs and at most one more for a cleanup close
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = sys_io_uring_setup(writer->depth * 4, &params);
+    if(ring->fd < 0) goto fail;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        goto fail;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) ring->cq_map = ring->sq_map;
+    else
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_map == MAP_FAILED)
+        {
+            ring->cq_map = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // one empty registered slot per file in flight; openat fills them
+    if(sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, files, writer->depth)) goto fail;
+    if(!ring_probe(writer)) goto fail;
+
+    free(files);
+    writer->backend = ASYNC_WRITER_BACKEND_IO_URING;
+    return ASYNC_WRITER_RESULT_SUCCESS;
+
+fail:
+    free(files);
+    ring_destroy(ring);
+    writer->ring = NULL;
+    return result;
+}
+
+static async_writer_result_t ring_write_file(async_writer_t *writer, const char *path, const void *buf, size_t len)
+{
+    async_writer_ring_t *ring = writer->ring;
+    while(!ring->num_free)
+        if(!ring_wait(writer)) return ASYNC_WRITER_RESULT_SUBMIT_ERR;
+    if(ring->sq_entries - (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) < 3)
+        if(!ring_enter(ring, false)) return ASYNC_WRITER_RESULT_SUBMIT_ERR;
+
+    size_t slot_index = ring->free_slots[--ring->num_free];
+    ring_slot_t *slot = &ring->slots[slot_index];
+    slot->len = len;
+    slot->pending = 3;
+    slot->opened = false;
+    slot->closed = false;
+    slot->failed = false;
+    char *slot_path = ring->paths + slot_index * PATH_MAX;
+    strcpy(slot_path, path);
+
+    // open into registered slot slot_index (file_index counts from 1), write
+    // through it, close it. If a step fails the ones linked after it
+    // complete with -ECANCELED.
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)slot_path;
+    sqe->len = 0644;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = slot_index + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)slot_index << 2 | RING_OP_OPEN;
+
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = slot_index;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)slot_index << 2 | RING_OP_WRITE;
+
+    sqe = ring_get_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot_index + 1;
+    sqe->user_data = (uint64_t)slot_index << 2 | RING_OP_CLOSE;
+
+    if(!ring_enter(ring, false)) return ASYNC_WRITER_RESULT_SUBMIT_ERR;
+    // handle whatever is done already, freeing slots without waiting
+    ring_reap(writer);
+    return ASYNC_WRITER_RESULT_SUCCESS;
+}
+
+static void ring_flush(async_writer_t *writer)
+{
+    async_writer_ring_t *ring = writer->ring;
+    while(ring->num_free < writer->depth)
+    {
+        if(!ring_wait(writer))
+        {
+            // nothing in flight will ever be reported now
+            writer->num_failed += writer->depth - ring->num_free;
+            ring->num_free = writer->depth;
+        }
+    }
+}
+
+// thread backend
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void *writer_thread(void *ctx)
+{
+    async_writer_t *writer = ctx;
+    async_writer_threads_t *threads = writer->threads;
+    // copied out of the queue, so its entry frees up while this one is written
+    thread_job_t job;
+    pthread_mutex_lock(&threads->lock);
+    for(;;)
+    {
+        while(!threads->num_queued && !threads->stopping) pthread_cond_wait(&threads->job_queued, &threads->lock);
+        if(!threads->num_queued) break;
+        thread_job_t *queued = &threads->jobs[threads->head];
+        strcpy(job.path, queued->path);
+        job.buf = queued->buf;
+        job.len = queued->len;
+        threads->head = (threads->head + 1) % writer->depth;
+        threads->num_queued--;
+        threads->num_running++;
+        pthread_mutex_unlock(&threads->lock);
+
+        bool ok = false;
+        int fd = open(job.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd >= 0)
+        {
+            ok = write_all(fd, job.buf, job.len);
+            if(close(fd)) ok = false;
+        }
+
+        pthread_mutex_lock(&threads->lock);
+        threads->num_running--;
+        if(!ok) threads->num_failed++;
+        pthread_cond_broadcast(&threads->job_done);
+    }
+    pthread_mutex_unlock(&threads->lock);
+    return NULL;
+}
+
+static void threads_destroy(async_writer_t *writer)
+{
+    async_writer_threads_t *threads = writer->threads;
+    pthread_mutex_lock(&threads->lock);
+    threads->stopping = true;
+    pthread_cond_broadcast(&threads->job_queued);
+    pthread_mutex_unlock(&threads->lock);
+    size_t i;
+    for(i = 0; i < threads->num_threads; i++) pthread_join(threads->tids[i], NULL);
+    pthread_mutex_destroy(&threads->lock);
+    pthread_cond_destroy(&threads->job_queued);
+    pthread_cond_destroy(&threads->job_done);
+    free(threads->tids);
+    free(threads->jobs);
+    free(threads);
+    writer->threads = NULL;
+}
+
+static async_writer_result_t threads_init(async_writer_t *writer)
+{
+    async_writer_threads_t *threads = calloc(1, sizeof(async_writer_threads_t));
+    if(!threads) return ASYNC_WRITER_RESULT_ALLOC_ERR;
+    size_t num_threads = writer->depth < MAX_WRITER_THREADS ? writer->depth : MAX_WRITER_THREADS;
+    threads->jobs = malloc(writer->depth * sizeof(thread_job_t));
+    threads->tids = malloc(num_threads * sizeof(pthread_t));
+    if(!threads->jobs || !threads->tids)
+    {
+        free(threads->jobs);
+        free(threads->tids);
+        free(threads);
+        return ASYNC_WRITER_RESULT_ALLOC_ERR;
+    }
+    pthread_mutex_init(&threads->lock, NULL);
+    pthread_cond_init(&threads->job_queued, NULL);
+    pthread_cond_init(&threads->job_done, NULL);
+    writer->threads = threads;
+    writer->backend = ASYNC_WRITER_BACKEND_THREADS;
+    for(; threads->num_threads < num_threads; threads->num_threads++)
+    {
+        if(pthread_create(&threads->tids[threads->num_threads], NULL, writer_thread, writer))
+        {
+            threads_destroy(writer);
+            return ASYNC_WRITER_RESULT_THREAD_ERR;
+        }
+    }
+    return ASYNC_WRITER_RESULT_SUCCESS;
+}
+
+static void threads_write_file(async_writer_t *writer, const char *path, const void *buf, size_t len)
+{
+    async_writer_threads_t *threads = writer->threads;
+    pthread_mutex_lock(&threads->lock);
+    while(threads->num_queued + threads->num_running >= writer->depth) pthread_cond_wait(&threads->job_done, &threads->lock);
+    thread_job_t *job = &threads->jobs[(threads->head + threads->num_queued) % writer->depth];
+    strcpy(job->path, path);
+    job->buf = buf;
+    job->len = len;
+    threads->num_queued++;
+    pthread_cond_signal(&threads->job_queued);
+    pthread_mutex_unlock(&threads->lock);
+}
+
+static void threads_flush(async_writer_t *writer)
+{
+    async_writer_threads_t *threads = writer->threads;
+    pthread_mutex_lock(&threads->lock);
+    while(threads->num_queued || threads->num_running) pthread_cond_wait(&threads->job_done, &threads->lock);
+    writer->num_failed += threads->num_failed;
+    threads->num_failed = 0;
+    pthread_mutex_unlock(&threads->lock);
+}
+
+async_writer_result_t async_writer_init(async_writer_t *writer, size_t depth, bool allow_io_uring)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->depth = depth ? depth : 1;
+    if(allow_io_uring)
+    {
+        async_writer_result_t result = ring_init(writer);
+        // anything but running out of memory falls back to threads
+        if(result != ASYNC_WRITER_RESULT_SUBMIT_ERR) return result;
+    }
+    return threads_init(writer);
+}
+
+async_writer_result_t async_writer_write_file(async_writer_t *writer, const char *path, const void *buf, size_t len)
+{
+    if(strlen(path) >= PATH_MAX || len > ASYNC_WRITER_MAX_LEN) return ASYNC_WRITER_RESULT_INVALID_REQUEST;
+    if(writer->backend == ASYNC_WRITER_BACKEND_IO_URING) return ring_write_file(writer, path, buf, len);
+    threads_write_file(writer, path, buf, len);
+    return ASYNC_WRITER_RESULT_SUCCESS;
+}
+
+size_t async_writer_flush(async_writer_t *writer)
+{
+    if(writer->backend == ASYNC_WRITER_BACKEND_IO_URING) ring_flush(writer);
+    else threads_flush(writer);
+    size_t num_failed = writer->num_failed;
+    writer->num_failed = 0;
+    return num_failed;
+}
+
+void async_writer_close(async_writer_t *writer)
+{
+    if(writer->ring)
+    {
+        ring_flush(writer);
+        ring_destroy(writer->ring);
+    }
+    if(writer->threads) threads_destroy(writer);
+    memset(writer, 0, sizeof(*writer));
+}
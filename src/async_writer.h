@@ -0,0 +1,75 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Writes whole files (create, write, close) without waiting for each one, so
+// that many bank files can be in flight at once. On network filesystems most
+// of the time per file is round trips for the open and close, not the bytes,
+// and those overlap here instead of adding up.
+//
+// The preferred backend is io_uring: every file is submitted as a linked
+// openat -> write -> close chain that opens straight into a registered file
+// slot, so the three steps need one submission and no round trip back to
+// user space in between. The number of slots bounds how many files are in
+// flight. Where io_uring is missing or disabled (old kernels, seccomp,
+// kernel.io_uring_disabled) a small pool of threads doing plain
+// open/write/close takes its place, bounded the same way.
+//
+// The data is not copied: buf must stay valid and unchanged until
+// async_writer_flush returns. A writer is meant to be used by one thread.
+
+typedef enum async_writer_backend
+{
+    ASYNC_WRITER_BACKEND_IO_URING = 0,
+    ASYNC_WRITER_BACKEND_THREADS
+} async_writer_backend_t;
+static const char *const ASYNC_WRITER_BACKEND_STR[] = {"io_uring", "threads"};
+
+typedef struct async_writer_ring async_writer_ring_t;
+typedef struct async_writer_threads async_writer_threads_t;
+
+typedef struct async_writer
+{
+    async_writer_backend_t backend;
+    size_t depth;                    // files in flight at most
+    size_t num_failed;               // files that failed since the last flush
+    async_writer_ring_t *ring;       // ASYNC_WRITER_BACKEND_IO_URING
+    async_writer_threads_t *threads; // ASYNC_WRITER_BACKEND_THREADS
+} async_writer_t;
+
+typedef enum async_writer_result
+{
+    ASYNC_WRITER_RESULT_SUCCESS = 0,
+    ASYNC_WRITER_RESULT_ALLOC_ERR,
+    ASYNC_WRITER_RESULT_THREAD_ERR,
+    ASYNC_WRITER_RESULT_INVALID_REQUEST,
+    ASYNC_WRITER_RESULT_SUBMIT_ERR
+} async_writer_result_t;
+static const char *const ASYNC_WRITER_RESULT_STR[] = {"success", "memory allocation failed", "could not start writer thread", "path or length not supported", "could not submit write"};
+
+static const size_t ASYNC_WRITER_DEFAULT_DEPTH = 64;
+
+// a single write can not be longer than this (the limit of write(2) on Linux)
+static const size_t ASYNC_WRITER_MAX_LEN = 0x7ffff000;
+
+// sets up a writer with up to depth files in flight. Uses io_uring when
+// allow_io_uring is set and the kernel supports it, threads otherwise.
+async_writer_result_t async_writer_init(async_writer_t *writer, size_t depth, bool allow_io_uring);
+
+// queues the creation of path (truncated if it exists, mode 0644) holding the
+// len bytes at buf, waiting for an earlier file to finish first if depth are
+// in flight. The path is copied; buf is not. A file that fails later is
+// counted by the next flush.
+async_writer_result_t async_writer_write_file(async_writer_t *writer, const char *path, const void *buf, size_t len);
+
+// waits until every queued file has been written and closed. Returns the
+// number of files that could not be written since the last flush.
+size_t async_writer_flush(async_writer_t *writer);
+
+// flushes, then releases all resources that this object allocated
+void async_writer_close(async_writer_t *writer);
+
+#endif
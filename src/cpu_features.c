@@ -0,0 +1,42 @@
+#include "cpu_features.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+static cpu_features_t features;
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+
+static void detect(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        features.ssse3 = ecx & bit_SSSE3;
+        features.sse41 = ecx & bit_SSE4_1;
+        features.pclmul = ecx & bit_PCLMUL;
+        // AVX also needs the OS to save the upper register halves
+        bool os_avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX);
+        if(os_avx)
+        {
+            unsigned int xcr0_lo, xcr0_hi;
+            __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            os_avx = (xcr0_lo & 0x6) == 0x6;
+        }
+        if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        {
+            features.sha = ebx & bit_SHA;
+            features.avx2 = os_avx && (ebx & bit_AVX2);
+        }
+    }
+#endif
+}
+
+const cpu_features_t *cpu_features_get(void)
+{
+    pthread_once(&features_once, detect);
+    return &features;
+}
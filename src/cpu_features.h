@@ -0,0 +1,21 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stdbool.h>
+
+// instruction set extensions that optional fast paths are compiled for (with
+// per-function target attributes) and picked at run time. On anything that is
+// not x86 every flag is false and the portable code is used.
+typedef struct cpu_features
+{
+    bool ssse3;
+    bool sse41;
+    bool pclmul;
+    bool sha;
+    bool avx2;
+} cpu_features_t;
+
+// detected once, then cached
+const cpu_features_t *cpu_features_get(void);
+
+#endif
@@ -0,0 +1,127 @@
+#include "crc32.h"
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL
+#endif
+
+static uint32_t table[8][256];
+static bool use_pclmul;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void)
+{
+    uint32_t i;
+    for(i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        int bit;
+        for(bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        table[0][i] = crc;
+    }
+    for(i = 0; i < 256; i++)
+    {
+        int slice;
+        for(slice = 1; slice < 8; slice++) table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+    }
+    const cpu_features_t *features = cpu_features_get();
+    use_pclmul = features->pclmul && features->sse41;
+}
+
+// crc here is the raw register, i.e. without the pre/post inversion.
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while(len && ((uintptr_t)p & 7))
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while(len >= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+            ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while(len--) crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+// Folds 64 bytes per iteration with carry-less multiplies, then reduces to 32
+// bits with a Barrett reduction, as described in Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction". The
+// constants are x^n mod P(x) for the bit-reflected polynomial. len must be a
+// multiple of 16 and at least 64.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly_mu = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_cvtsi32_si128(crc));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(p + 48));
+    p += 64;
+    len -= 64;
+
+#define CRC32_FOLD(x, k, next) _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), next)
+    while(len >= 64)
+    {
+        x1 = CRC32_FOLD(x1, k1k2, _mm_loadu_si128((const __m128i *)p));
+        x2 = CRC32_FOLD(x2, k1k2, _mm_loadu_si128((const __m128i *)(p + 16)));
+        x3 = CRC32_FOLD(x3, k1k2, _mm_loadu_si128((const __m128i *)(p + 32)));
+        x4 = CRC32_FOLD(x4, k1k2, _mm_loadu_si128((const __m128i *)(p + 48)));
+        p += 64;
+        len -= 64;
+    }
+    x1 = CRC32_FOLD(x1, k3k4, x2);
+    x1 = CRC32_FOLD(x1, k3k4, x3);
+    x1 = CRC32_FOLD(x1, k3k4, x4);
+    while(len >= 16)
+    {
+        x1 = CRC32_FOLD(x1, k3k4, _mm_loadu_si128((const __m128i *)p));
+        p += 16;
+        len -= 16;
+    }
+#undef CRC32_FOLD
+
+    // 128 -> 64 bits
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(k3k4, x1, 0x01), _mm_srli_si128(x1, 8));
+    // 64 -> 32 bits
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), _mm_srli_si128(x1, 4));
+    // Barrett reduction
+    __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly_mu, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly_mu, 0x00);
+    return (uint32_t)_mm_extract_epi32(_mm_xor_si128(x1, t), 1);
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    pthread_once(&init_once, init);
+    crc = ~crc;
+#ifdef CRC32_HAVE_PCLMUL
+    if(use_pclmul && len >= 64)
+    {
+        size_t folded = len & ~(size_t)15;
+        crc = crc32_pclmul(crc, p, folded);
+        p += folded;
+        len -= folded;
+    }
+#endif
+    return ~crc32_slice8(crc, p, len);
+}
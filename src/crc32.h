@@ -0,0 +1,15 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// CRC-32 as used by zip, PNG and the No-Intro/GoodNES DAT files (reflected
+// polynomial 0xedb88320). Uses carry-less multiplication folding on CPUs
+// with PCLMULQDQ and slice-by-8 tables otherwise.
+
+// continues a CRC over more data, start with crc = 0. Compatible with zlib's
+// crc32().
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
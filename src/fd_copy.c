@@ -0,0 +1,96 @@
+#define _GNU_SOURCE // copy_file_range
+
+#include "fd_copy.h"
+
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+// set once a method fails in a way that will not change for this process.
+static bool copy_file_range_unsupported = false;
+static bool sendfile_unsupported = false;
+
+static bool errno_means_unsupported(int err)
+{
+    return err == ENOSYS || err == EOPNOTSUPP;
+}
+
+// each of these returns the number of bytes copied before the method gave up,
+// which the caller finishes with the next method.
+static size_t try_copy_file_range(int in_fd, off_t in_off, int out_fd, size_t len)
+{
+    size_t done = 0;
+    if(__atomic_load_n(&copy_file_range_unsupported, __ATOMIC_RELAXED)) return 0;
+    while(done < len)
+    {
+        loff_t off = in_off + done;
+        ssize_t n = copy_file_range(in_fd, &off, out_fd, NULL, len - done, 0);
+        if(n <= 0)
+        {
+            if(n < 0 && errno_means_unsupported(errno)) __atomic_store_n(&copy_file_range_unsupported, true, __ATOMIC_RELAXED);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static size_t try_sendfile(int in_fd, off_t in_off, int out_fd, size_t len)
+{
+    size_t done = 0;
+    if(__atomic_load_n(&sendfile_unsupported, __ATOMIC_RELAXED)) return 0;
+    while(done < len)
+    {
+        off_t off = in_off + done;
+        ssize_t n = sendfile(out_fd, in_fd, &off, len - done);
+        if(n <= 0)
+        {
+            if(n < 0 && errno_means_unsupported(errno)) __atomic_store_n(&sendfile_unsupported, true, __ATOMIC_RELAXED);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static fd_copy_result_t write_all(int out_fd, const char *buf, size_t len)
+{
+    while(len)
+    {
+        ssize_t n = write(out_fd, buf, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return FD_COPY_RESULT_WRITE_ERR;
+        buf += n;
+        len -= n;
+    }
+    return FD_COPY_RESULT_SUCCESS;
+}
+
+// the write() fallback for callers without the bytes in memory
+static fd_copy_result_t read_write_all(int in_fd, off_t in_off, int out_fd, size_t len)
+{
+    char buf[0x10000];
+    while(len)
+    {
+        ssize_t n = pread(in_fd, buf, len < sizeof(buf) ? len : sizeof(buf), in_off);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return FD_COPY_RESULT_WRITE_ERR;
+        if(write_all(out_fd, buf, n)) return FD_COPY_RESULT_WRITE_ERR;
+        in_off += n;
+        len -= n;
+    }
+    return FD_COPY_RESULT_SUCCESS;
+}
+
+fd_copy_result_t fd_copy(int in_fd, off_t in_off, int out_fd, size_t len, const char *in_buf, bool allow_zero_copy)
+{
+    size_t done = 0;
+    if(allow_zero_copy)
+    {
+        done += try_copy_file_range(in_fd, in_off, out_fd, len);
+        if(done < len) done += try_sendfile(in_fd, in_off + done, out_fd, len - done);
+    }
+    if(!in_buf) return read_write_all(in_fd, in_off + done, out_fd, len - done);
+    return write_all(out_fd, in_buf + done, len - done);
+}
@@ -0,0 +1,33 @@
+#ifndef FD_COPY_H
+#define FD_COPY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+// Copies a byte range of one file into another, preferring kernel-side copies
+// so that the data never passes through user space:
+// 1. copy_file_range, which also shares extents (reflinks) on filesystems
+//    such as XFS and btrfs when the offsets line up with their blocks
+// 2. sendfile
+// 3. plain write() from a user space buffer holding the same bytes, or
+//    read into a bounce buffer first
+// A method that the running kernel or filesystem does not support at all is
+// remembered and not tried again for the rest of the process.
+
+typedef enum fd_copy_result
+{
+    FD_COPY_RESULT_SUCCESS = 0,
+    FD_COPY_RESULT_WRITE_ERR
+} fd_copy_result_t;
+static const char *const FD_COPY_RESULT_STR[] = {"success", "error writing output file"};
+
+// copies len bytes starting at in_off of in_fd to the current position of
+// out_fd. in_buf must point to those same len bytes (e.g. inside an mmap of
+// in_fd) and is used for the write() fallback; callers that do not have them
+// in memory pass NULL, and the fallback then reads in_fd with pread(). If
+// allow_zero_copy is false, write() is used directly.
+fd_copy_result_t fd_copy(int in_fd, off_t in_off, int out_fd, size_t len, const char *in_buf, bool allow_zero_copy);
+
+#endif
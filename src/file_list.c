@@ -0,0 +1,123 @@
+#include "file_list.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+void file_list_init(file_list_t *list)
+{
+    list->paths = NULL;
+    list->len = 0;
+    list->cap = 0;
+    arena_init(&list->names);
+}
+
+// adds a path that is already in list->names
+static file_list_result_t push_owned(file_list_t *list, char *path)
+{
+    if(list->len == list->cap)
+    {
+        size_t new_cap = list->cap ? list->cap * 2 : 64;
+        char **new_paths = realloc(list->paths, new_cap * sizeof(char *));
+        if(!new_paths) return FILE_LIST_RESULT_ALLOC_ERR;
+        list->paths = new_paths;
+        list->cap = new_cap;
+    }
+    list->paths[list->len++] = path;
+    return FILE_LIST_RESULT_SUCCESS;
+}
+
+static file_list_result_t push(file_list_t *list, const char *path)
+{
+    char *copy = arena_strndup(&list->names, path, strlen(path), 0);
+    if(!copy) return FILE_LIST_RESULT_ALLOC_ERR;
+    return push_owned(list, copy);
+}
+
+static bool has_suffix(const char *name, const char *const *suffixes)
+{
+    size_t name_len = strlen(name);
+    for(; *suffixes; suffixes++)
+    {
+        size_t suffix_len = strlen(*suffixes);
+        if(name_len >= suffix_len && !strcmp(name + name_len - suffix_len, *suffixes)) return true;
+    }
+    return false;
+}
+
+// symlinks are not followed when walking, so link cycles cannot trap us.
+static file_list_result_t walk_dir(file_list_t *list, const char *dir_path, const char *const *suffixes)
+{
+    DIR *dir = opendir(dir_path);
+    if(!dir) return FILE_LIST_RESULT_OPEN_ERR;
+
+    file_list_result_t result = FILE_LIST_RESULT_SUCCESS;
+    size_t dir_path_len = strlen(dir_path);
+    struct dirent *entry;
+    while(!result && (entry = readdir(dir)))
+    {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+
+        // built where it will be kept if it is a ROM; otherwise the few
+        // bytes stay unused in the arena
+        char *child = arena_alloc(&list->names, dir_path_len + strlen(entry->d_name) + 2);
+        if(!child)
+        {
+            result = FILE_LIST_RESULT_ALLOC_ERR;
+            break;
+        }
+        sprintf(child, "%s/%s", dir_path, entry->d_name);
+
+        struct stat st;
+        if(!lstat(child, &st))
+        {
+            if(S_ISDIR(st.st_mode)) result = walk_dir(list, child, suffixes);
+            else if(S_ISREG(st.st_mode) && has_suffix(entry->d_name, suffixes)) result = push_owned(list, child);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+static file_list_result_t read_list_file(file_list_t *list, const char *list_path, const char *const *suffixes)
+{
+    FILE *infile = fopen(list_path, "r");
+    if(!infile) return FILE_LIST_RESULT_OPEN_ERR;
+
+    file_list_result_t result = FILE_LIST_RESULT_SUCCESS;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while(!result && (line_len = getline(&line, &line_cap, infile)) >= 0)
+    {
+        while(line_len && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) line[--line_len] = '\0';
+        if(!line_len) continue;
+        // nested list files are not expanded; a line is always a real path.
+        struct stat st;
+        if(!stat(line, &st) && S_ISDIR(st.st_mode)) result = walk_dir(list, line, suffixes);
+        else result = push(list, line);
+    }
+    free(line);
+    fclose(infile);
+    return result;
+}
+
+file_list_result_t file_list_add(file_list_t *list, const char *path, const char *const *suffixes)
+{
+    if(path[0] == '@') return read_list_file(list, path + 1, suffixes);
+
+    struct stat st;
+    if(!stat(path, &st) && S_ISDIR(st.st_mode)) return walk_dir(list, path, suffixes);
+    return push(list, path);
+}
+
+void file_list_clear(file_list_t *list)
+{
+    free(list->paths);
+    arena_clear(&list->names);
+    file_list_init(list);
+}
@@ -0,0 +1,40 @@
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+// a growable list of file paths gathered from the command line for batch mode.
+// The paths themselves are packed into an arena rather than allocated one by
+// one, so a directory of 100k ROMs is a handful of allocations.
+typedef struct file_list
+{
+    char **paths;
+    size_t len;
+    size_t cap;
+    arena_t names;
+} file_list_t;
+
+typedef enum file_list_result
+{
+    FILE_LIST_RESULT_SUCCESS = 0,
+    FILE_LIST_RESULT_ALLOC_ERR,
+    FILE_LIST_RESULT_OPEN_ERR
+} file_list_result_t;
+static const char *const FILE_LIST_RESULT_STR[] = {"success", "memory allocation failed", "could not open path"};
+
+void file_list_init(file_list_t *list);
+
+// adds the given path to the list:
+// - a directory is walked recursively and every file ending in one of the
+//   suffixes (a NULL terminated list) is added
+// - "@listfile" reads one path per line from listfile, each handled as above
+// - anything else is added as-is, so that bad explicit inputs still get a
+//   per-file status rather than being silently dropped
+file_list_result_t file_list_add(file_list_t *list, const char *path, const char *const *suffixes);
+
+// releases all resources that this object allocated
+void file_list_clear(file_list_t *list);
+
+#endif
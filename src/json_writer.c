@@ -0,0 +1,220 @@
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void json_writer_init(json_writer_t *writer)
+{
+    memset(writer, 0, sizeof(*writer));
+}
+
+void json_writer_reset(json_writer_t *writer)
+{
+    writer->len = 0;
+    writer->depth = 0;
+    writer->has_values = 0;
+    writer->after_key = false;
+    writer->failed = false;
+}
+
+// makes room for len more bytes, returning where they go or NULL on failure
+static char *reserve(json_writer_t *writer, size_t len)
+{
+    if(writer->failed) return NULL;
+    if(writer->len + len > writer->cap)
+    {
+        size_t new_cap = writer->cap ? writer->cap : 256;
+        while(new_cap < writer->len + len) new_cap *= 2;
+        char *grown = realloc(writer->buf, new_cap);
+        if(!grown)
+        {
+            writer->failed = true;
+            return NULL;
+        }
+        writer->buf = grown;
+        writer->cap = new_cap;
+    }
+    return writer->buf + writer->len;
+}
+
+static void append(json_writer_t *writer, const char *str, size_t len)
+{
+    char *out = reserve(writer, len);
+    if(!out) return;
+    memcpy(out, str, len);
+    writer->len += len;
+}
+
+static void append_char(json_writer_t *writer, char c)
+{
+    append(writer, &c, 1);
+}
+
+// the comma between values of the same container
+static void begin_value(json_writer_t *writer)
+{
+    if(writer->after_key)
+    {
+        writer->after_key = false;
+        return;
+    }
+    uint64_t bit = UINT64_C(1) << writer->depth;
+    if(writer->has_values & bit) append_char(writer, ',');
+    writer->has_values |= bit;
+}
+
+static void begin_container(json_writer_t *writer, char open)
+{
+    begin_value(writer);
+    if(writer->depth + 1 >= JSON_WRITER_MAX_DEPTH)
+    {
+        writer->failed = true;
+        return;
+    }
+    writer->depth++;
+    writer->has_values &= ~(UINT64_C(1) << writer->depth);
+    append_char(writer, open);
+}
+
+static void end_container(json_writer_t *writer, char close)
+{
+    if(!writer->depth)
+    {
+        writer->failed = true;
+        return;
+    }
+    writer->depth--;
+    append_char(writer, close);
+}
+
+void json_writer_begin_object(json_writer_t *writer)
+{
+    begin_container(writer, '{');
+}
+
+void json_writer_end_object(json_writer_t *writer)
+{
+    end_container(writer, '}');
+}
+
+void json_writer_begin_array(json_writer_t *writer)
+{
+    begin_container(writer, '[');
+}
+
+void json_writer_end_array(json_writer_t *writer)
+{
+    end_container(writer, ']');
+}
+
+void json_writer_key(json_writer_t *writer, const char *key)
+{
+    begin_value(writer);
+    append_char(writer, '"');
+    append(writer, key, strlen(key));
+    append(writer, "\":", 2);
+    writer->after_key = true;
+}
+
+void json_writer_string(json_writer_t *writer, const char *str)
+{
+    json_writer_string_n(writer, str, strlen(str));
+}
+
+// https://www.rfc-editor.org/rfc/rfc8259#section-7
+// Bytes from 0x80 up are passed through as they are, so strings that are not
+// UTF-8 (file names can be anything) come out as they went in.
+void json_writer_string_n(json_writer_t *writer, const char *str, size_t len)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    begin_value(writer);
+    append_char(writer, '"');
+    size_t run_start = 0;
+    size_t i;
+    for(i = 0; i < len; i++)
+    {
+        unsigned char c = str[i];
+        if(c >= 0x20 && c != '"' && c != '\\') continue;
+        // copy the run of plain characters before the one that needs escaping
+        append(writer, str + run_start, i - run_start);
+        run_start = i + 1;
+        char escape[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0x0f]};
+        if(c == '"' || c == '\\')
+        {
+            escape[1] = c;
+            append(writer, escape, 2);
+        }
+        else if(c == '\n') append(writer, "\\n", 2);
+        else if(c == '\t') append(writer, "\\t", 2);
+        else append(writer, escape, sizeof(escape));
+    }
+    append(writer, str + run_start, len - run_start);
+    append_char(writer, '"');
+}
+
+void json_writer_hex(json_writer_t *writer, const uint8_t *bytes, size_t len)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    begin_value(writer);
+    char *out = reserve(writer, len * 2 + 2);
+    if(!out) return;
+    *out++ = '"';
+    size_t i;
+    for(i = 0; i < len; i++)
+    {
+        *out++ = HEX_DIGITS[bytes[i] >> 4];
+        *out++ = HEX_DIGITS[bytes[i] & 0x0f];
+    }
+    *out = '"';
+    writer->len += len * 2 + 2;
+}
+
+void json_writer_uint(json_writer_t *writer, uint64_t value)
+{
+    char digits[21];
+    begin_value(writer);
+    append(writer, digits, sprintf(digits, "%" PRIu64, value));
+}
+
+void json_writer_int(json_writer_t *writer, int64_t value)
+{
+    char digits[21];
+    begin_value(writer);
+    append(writer, digits, sprintf(digits, "%" PRId64, value));
+}
+
+void json_writer_double(json_writer_t *writer, double value)
+{
+    char digits[32];
+    if(!isfinite(value))
+    {
+        json_writer_null(writer);
+        return;
+    }
+    begin_value(writer);
+    // the shortest of the usual two precisions that reads back exactly
+    int len = snprintf(digits, sizeof(digits), "%.15g", value);
+    if(strtod(digits, NULL) != value) len = snprintf(digits, sizeof(digits), "%.17g", value);
+    append(writer, digits, len);
+}
+
+void json_writer_bool(json_writer_t *writer, bool value)
+{
+    begin_value(writer);
+    if(value) append(writer, "true", 4);
+    else append(writer, "false", 5);
+}
+
+void json_writer_null(json_writer_t *writer)
+{
+    begin_value(writer);
+    append(writer, "null", 4);
+}
+
+void json_writer_clear(json_writer_t *writer)
+{
+    free(writer->buf);
+    json_writer_init(writer);
+}
@@ -0,0 +1,57 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Writes JSON text straight into a growable buffer as values are added, so a
+// document never exists as a tree of objects. Commas and nesting are tracked
+// by the writer; the caller only has to open and close containers in order
+// and put a key before every value inside an object.
+//
+// The buffer is kept across json_writer_reset, so one writer reused for many
+// documents (one NDJSON line per ROM, say) stops allocating once it has grown
+// to the largest of them.
+
+static const size_t JSON_WRITER_MAX_DEPTH = 64;
+
+typedef struct json_writer
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t depth;
+    uint64_t has_values;  // bit d set once the container at depth d holds a value
+    bool after_key;       // the next value belongs to the key just written
+    bool failed;          // an allocation failed or the nesting got too deep; buf is incomplete
+} json_writer_t;
+
+void json_writer_init(json_writer_t *writer);
+
+// empties the buffer, keeping its memory, to start a new document
+void json_writer_reset(json_writer_t *writer);
+
+void json_writer_begin_object(json_writer_t *writer);
+void json_writer_end_object(json_writer_t *writer);
+void json_writer_begin_array(json_writer_t *writer);
+void json_writer_end_array(json_writer_t *writer);
+
+// key must be plain ASCII without characters that need escaping
+void json_writer_key(json_writer_t *writer, const char *key);
+
+void json_writer_string(json_writer_t *writer, const char *str);
+void json_writer_string_n(json_writer_t *writer, const char *str, size_t len);
+// len bytes as a string of lowercase hex digits
+void json_writer_hex(json_writer_t *writer, const uint8_t *bytes, size_t len);
+void json_writer_uint(json_writer_t *writer, uint64_t value);
+void json_writer_int(json_writer_t *writer, int64_t value);
+// NaN and infinities have no JSON form and are written as null
+void json_writer_double(json_writer_t *writer, double value);
+void json_writer_bool(json_writer_t *writer, bool value);
+void json_writer_null(json_writer_t *writer);
+
+// releases all resources that this object allocated
+void json_writer_clear(json_writer_t *writer);
+
+#endif
@@ -0,0 +1,101 @@
+#include "mapped_file.h"
+
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the size of a PMD-mapped huge page on x86-64 and arm64 with 4K pages
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static size_t page_size(void)
+{
+    static size_t size = 0;
+    if(!size) size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t align_down(size_t value, size_t alignment)
+{
+    return value - value % alignment;
+}
+
+mapped_file_result_t mapped_file_open(int fd, size_t size, size_t large_threshold, size_t window, mapped_file_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    bool windowed = large_threshold && size >= large_threshold;
+    const char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE | (windowed ? 0 : MAP_POPULATE), fd, 0);
+    if(buf == MAP_FAILED) return MAPPED_FILE_RESULT_MAP_ERR;
+    out->buf = buf;
+    out->size = size;
+    if(!windowed) return MAPPED_FILE_RESULT_SUCCESS;
+
+    out->window = align_down(window, page_size());
+    if(!out->window) out->window = page_size();
+    madvise((void *)buf, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    // only takes effect where the kernel can back read-only file mappings
+    // with huge pages (CONFIG_READ_ONLY_THP_FOR_FS); fewer TLB misses on a
+    // multi-gigabyte image otherwise. Failure is harmless.
+    if(size >= HUGE_PAGE_SIZE) madvise((void *)buf, size, MADV_HUGEPAGE);
+#endif
+    return MAPPED_FILE_RESULT_SUCCESS;
+}
+
+mapped_file_result_t mapped_file_open_on_demand(int fd, size_t size, mapped_file_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    const char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(buf == MAP_FAILED) return MAPPED_FILE_RESULT_MAP_ERR;
+    out->buf = buf;
+    out->size = size;
+    out->on_demand = true;
+    // no readahead on faults either, which would pull in the regions around
+    // the one being read
+    madvise((void *)buf, size, MADV_RANDOM);
+    return MAPPED_FILE_RESULT_SUCCESS;
+}
+
+void mapped_file_advance(mapped_file_t *file, size_t offset, size_t len)
+{
+    if((!file->window && !file->on_demand) || offset >= file->size) return;
+    if(len > file->size - offset) len = file->size - offset;
+    if(file->on_demand)
+    {
+        size_t start = align_down(offset, page_size());
+        if(len) madvise((void *)(file->buf + start), offset + len - start, MADV_WILLNEED);
+        return;
+    }
+    if(offset < file->released)
+    {
+        // going back over dropped pages: a new pass starts here
+        file->released = align_down(offset, page_size());
+        file->prefetched = offset;
+    }
+
+    // drop what lies more than a window behind the reader
+    size_t drop_end = offset > file->window ? align_down(offset - file->window, page_size()) : 0;
+    if(drop_end > file->released)
+    {
+        madvise((void *)(file->buf + file->released), drop_end - file->released, MADV_DONTNEED);
+        file->released = drop_end;
+    }
+
+    // and ask for the window ahead before the reader gets there. Readahead is
+    // requested a half window at a time, so it is not asked for again on
+    // every small read.
+    size_t want = offset + len;
+    want = file->size - want > file->window ? want + file->window : file->size;
+    if(want > file->prefetched + file->window / 2 || (want == file->size && want > file->prefetched))
+    {
+        size_t start = align_down(file->prefetched > offset ? file->prefetched : offset, page_size());
+        madvise((void *)(file->buf + start), want - start, MADV_WILLNEED);
+        file->prefetched = want;
+    }
+}
+
+void mapped_file_close(mapped_file_t *file)
+{
+    if(file->buf) munmap((void *)file->buf, file->size);
+    memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,63 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// A read-only mapping of an input file. Small files are mapped with
+// MAP_POPULATE so they are read in one go. Files of at least the large file
+// threshold are mapped without it and read through a sliding window instead:
+// readers announce the range they are about to touch with
+// mapped_file_advance, which asks for the window ahead of it to be read in
+// (MADV_WILLNEED on top of MADV_SEQUENTIAL readahead) and drops the pages
+// more than a window behind it from the mapping (MADV_DONTNEED). Resident
+// memory then stays around two windows however large the file is, while the
+// disk is kept busy ahead of the reader. The whole file stays addressable, so
+// readers index it exactly as they would a fully mapped file.
+//
+// Dropped pages are simply read back in if a reader goes back to them, as the
+// second pass of an output format over the same file does.
+//
+// Readers that only want parts of a file map it on demand instead: nothing is
+// read ahead or dropped, and only the ranges announced with
+// mapped_file_advance are read in, so the pages of skipped regions are never
+// touched.
+
+typedef struct mapped_file
+{
+    const char *buf;
+    size_t size;
+    size_t window;      // bytes kept ahead of and behind the reader, 0 if the file is fully populated
+    size_t released;    // pages below this offset have been dropped
+    size_t prefetched;  // readahead has been asked for up to this offset
+    bool on_demand;     // read in only what readers announce
+} mapped_file_t;
+
+typedef enum mapped_file_result
+{
+    MAPPED_FILE_RESULT_SUCCESS = 0,
+    MAPPED_FILE_RESULT_MAP_ERR
+} mapped_file_result_t;
+static const char *const MAPPED_FILE_RESULT_STR[] = {"success", "could not map file"};
+
+// files at least this large are read through a window
+#define MAPPED_FILE_LARGE_THRESHOLD ((size_t)64 << 20)
+#define MAPPED_FILE_WINDOW_SIZE ((size_t)8 << 20)
+
+// maps size bytes of fd. Files of at least large_threshold bytes get a window
+// of window bytes (rounded to whole pages); a large_threshold of 0 never
+// windows.
+mapped_file_result_t mapped_file_open(int fd, size_t size, size_t large_threshold, size_t window, mapped_file_t *out);
+
+// maps size bytes of fd on demand, whatever its size
+mapped_file_result_t mapped_file_open_on_demand(int fd, size_t size, mapped_file_t *out);
+
+// the caller is about to read [offset, offset + len). Does nothing for a file
+// that is fully populated; for one mapped on demand, reads in just that range.
+void mapped_file_advance(mapped_file_t *file, size_t offset, size_t len);
+
+// releases all resources that this object allocated
+void mapped_file_close(mapped_file_t *file);
+
+#endif
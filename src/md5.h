@@ -0,0 +1,23 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// MD5 as specified in RFC 1321. Only used to match ROMs against DAT files.
+
+static const size_t MD5_DIGEST_SIZE = 16;
+
+typedef struct md5_ctx
+{
+    uint32_t state[4];
+    uint64_t total_len;
+    uint8_t block[64];
+    size_t block_len;
+} md5_ctx_t;
+
+void md5_init(md5_ctx_t *ctx);
+void md5_update(md5_ctx_t *ctx, const void *data, size_t len);
+void md5_final(md5_ctx_t *ctx, uint8_t digest_out[16]);
+
+#endif
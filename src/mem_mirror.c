@@ -1,8 +1,8 @@
 #include "mem_mirror.h"
 
-uint16_t mem_mirror_collapse(mem_mirror_info_t *mirror_info, uint16_t addr)
+uint16_t mem_mirror_collapse(const mem_mirror_info_t *mirror_info, uint16_t addr)
 {
-    if(addr >= mirror_info->start && addr < mirror_info->start + mirror_info->len * num_mirrors)
+    if(addr >= mirror_info->start && addr < mirror_info->start + (uint32_t)mirror_info->len * mirror_info->num_mirrors)
     {
         return ((addr - mirror_info->start) % mirror_info->len) + mirror_info->start;
     }
@@ -15,6 +15,6 @@ typedef struct mem_mirror_info
 
 // if the given address lies within the address space that the mirror occupies, 
 // this function will collapse it into its *unique* address.
-uint16_t mem_mirror_collapse(mem_mirror_info_t *mirror_info, uint16_t addr);
+uint16_t mem_mirror_collapse(const mem_mirror_info_t *mirror_info, uint16_t addr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+#define SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+
+// the Prometheus histogram buckets: powers of four from 1.024 us to about
+// 69 s, each exactly a boundary between two of our buckets
+#define PROMETHEUS_FIRST_LE_SHIFT 10
+#define PROMETHEUS_LAST_LE_SHIFT 36
+
+static size_t bucket_index(uint64_t ns)
+{
+    if(ns < SUB_BUCKETS) return ns;
+    unsigned e = 63 - __builtin_clzll(ns);
+    unsigned m = (ns >> (e - METRICS_SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return ((size_t)(e - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS) + m;
+}
+
+// the smallest value that does not fit in the bucket
+static uint64_t bucket_upper(size_t index)
+{
+    if(index < SUB_BUCKETS) return index + 1;
+    unsigned e = (index >> METRICS_SUB_BUCKET_BITS) + METRICS_SUB_BUCKET_BITS - 1;
+    uint64_t m = index & (SUB_BUCKETS - 1);
+    if(e == 63 && m == SUB_BUCKETS - 1) return UINT64_MAX;
+    return (SUB_BUCKETS + m + 1) << (e - METRICS_SUB_BUCKET_BITS);
+}
+
+void metrics_init(metrics_t *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+void metrics_record(metrics_t *metrics, metrics_stage_t stage, uint64_t ns)
+{
+    metrics_histogram_t *histogram = &metrics->stages[stage];
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if(ns > histogram->max_ns) histogram->max_ns = ns;
+    histogram->buckets[bucket_index(ns)]++;
+}
+
+void metrics_count_result(metrics_t *metrics, unsigned result)
+{
+    metrics->results[result < METRICS_MAX_RESULTS ? result : METRICS_MAX_RESULTS - 1]++;
+}
+
+void metrics_merge(metrics_t *into, const metrics_t *from)
+{
+    size_t s, i;
+    for(s = 0; s < METRICS_NUM_STAGES; s++)
+    {
+        metrics_histogram_t *to_histogram = &into->stages[s];
+        const metrics_histogram_t *from_histogram = &from->stages[s];
+        to_histogram->count += from_histogram->count;
+        to_histogram->sum_ns += from_histogram->sum_ns;
+        if(from_histogram->max_ns > to_histogram->max_ns) to_histogram->max_ns = from_histogram->max_ns;
+        for(i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) to_histogram->buckets[i] += from_histogram->buckets[i];
+    }
+    for(i = 0; i < METRICS_MAX_RESULTS; i++) into->results[i] += from->results[i];
+    into->bytes_in += from->bytes_in;
+    into->bytes_out += from->bytes_out;
+}
+
+uint64_t metrics_quantile_ns(const metrics_histogram_t *histogram, double q)
+{
+    if(!histogram->count) return 0;
+    // the rank of the value we are after, counting from 1
+    uint64_t rank = (uint64_t)(q * histogram->count + 0.5);
+    if(rank < 1) rank = 1;
+    if(rank > histogram->count) rank = histogram->count;
+    uint64_t seen = 0;
+    size_t i;
+    for(i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if(seen >= rank) break;
+    }
+    uint64_t upper = bucket_upper(i) - 1;
+    return upper < histogram->max_ns ? upper : histogram->max_ns;
+}
+
+// creates path.tmp for writing; commit_file renames it over path
+static FILE *open_temp_file(const char *path, char **temp_path_out)
+{
+    char *temp_path = malloc(strlen(path) + 5);
+    if(!temp_path) return NULL;
+    strcpy(temp_path, path);
+    strcat(temp_path, ".tmp");
+    FILE *out = fopen(temp_path, "w");
+    if(!out)
+    {
+        free(temp_path);
+        return NULL;
+    }
+    *temp_path_out = temp_path;
+    return out;
+}
+
+static metrics_result_t commit_file(FILE *out, char *temp_path, const char *path, bool ok)
+{
+    if(fclose(out)) ok = false;
+    if(ok && rename(temp_path, path)) ok = false;
+    if(!ok) remove(temp_path);
+    free(temp_path);
+    return ok ? METRICS_RESULT_SUCCESS : METRICS_RESULT_WRITE_ERR;
+}
+
+static uint64_t count_files(const metrics_t *metrics)
+{
+    uint64_t files = 0;
+    size_t i;
+    for(i = 0; i < METRICS_MAX_RESULTS; i++) files += metrics->results[i];
+    return files;
+}
+
+metrics_result_t metrics_write_json(const metrics_t *metrics, const char *path, const char *const *result_names, size_t num_result_names)
+{
+    static const double QUANTILES[] = {0.5, 0.9, 0.99};
+    static const char *QUANTILE_KEYS[] = {"p50_ns", "p90_ns", "p99_ns"};
+    json_writer_t json;
+    json_writer_init(&json);
+    json_writer_begin_object(&json);
+    json_writer_key(&json, "files");
+    json_writer_uint(&json, count_files(metrics));
+    json_writer_key(&json, "failed");
+    json_writer_uint(&json, count_files(metrics) - metrics->results[0]);
+    json_writer_key(&json, "bytes_in");
+    json_writer_uint(&json, metrics->bytes_in);
+    json_writer_key(&json, "bytes_out");
+    json_writer_uint(&json, metrics->bytes_out);
+
+    json_writer_key(&json, "errors");
+    json_writer_begin_array(&json);
+    size_t i, q;
+    for(i = 1; i < METRICS_MAX_RESULTS; i++)
+    {
+        if(!metrics->results[i]) continue;
+        json_writer_begin_object(&json);
+        json_writer_key(&json, "result");
+        json_writer_uint(&json, i);
+        if(i < num_result_names)
+        {
+            json_writer_key(&json, "status");
+            json_writer_string(&json, result_names[i]);
+        }
+        json_writer_key(&json, "count");
+        json_writer_uint(&json, metrics->results[i]);
+        json_writer_end_object(&json);
+    }
+    json_writer_end_array(&json);
+
+    json_writer_key(&json, "stages");
+    json_writer_begin_object(&json);
+    for(i = 0; i < METRICS_NUM_STAGES; i++)
+    {
+        const metrics_histogram_t *histogram = &metrics->stages[i];
+        json_writer_key(&json, METRICS_STAGE_STR[i]);
+        json_writer_begin_object(&json);
+        json_writer_key(&json, "count");
+        json_writer_uint(&json, histogram->count);
+        json_writer_key(&json, "sum_ns");
+        json_writer_uint(&json, histogram->sum_ns);
+        json_writer_key(&json, "mean_ns");
+        json_writer_uint(&json, histogram->count ? histogram->sum_ns / histogram->count : 0);
+        for(q = 0; q < sizeof(QUANTILES) / sizeof(QUANTILES[0]); q++)
+        {
+            json_writer_key(&json, QUANTILE_KEYS[q]);
+            json_writer_uint(&json, metrics_quantile_ns(histogram, QUANTILES[q]));
+        }
+        json_writer_key(&json, "max_ns");
+        json_writer_uint(&json, histogram->max_ns);
+        json_writer_end_object(&json);
+    }
+    json_writer_end_object(&json);
+    json_writer_end_object(&json);
+
+    metrics_result_t result = METRICS_RESULT_WRITE_ERR;
+    char *temp_path;
+    FILE *out = json.failed ? NULL : open_temp_file(path, &temp_path);
+    if(out)
+    {
+        bool ok = fwrite(json.buf, 1, json.len, out) == json.len && putc('\n', out) != EOF;
+        result = commit_file(out, temp_path, path, ok);
+    }
+    else if(!json.failed) result = METRICS_RESULT_OPEN_ERR;
+    json_writer_clear(&json);
+    return result;
+}
+
+// https://prometheus.io/docs/instrumenting/exposition_formats/
+metrics_result_t metrics_write_prometheus(const metrics_t *metrics, const char *path)
+{
+    char *temp_path;
+    FILE *out = open_temp_file(path, &temp_path);
+    if(!out) return METRICS_RESULT_OPEN_ERR;
+
+    fprintf(out, "# HELP nes_parser_files_total Inputs processed, by result code (0 is success).\n");
+    fprintf(out, "# TYPE nes_parser_files_total counter\n");
+    size_t i, shift;
+    for(i = 0; i < METRICS_MAX_RESULTS; i++)
+        if(!i || metrics->results[i]) fprintf(out, "nes_parser_files_total{result=\"%zu\"} %" PRIu64 "\n", i, metrics->results[i]);
+    fprintf(out, "# HELP nes_parser_bytes_in_total ROM bytes read.\n");
+    fprintf(out, "# TYPE nes_parser_bytes_in_total counter\n");
+    fprintf(out, "nes_parser_bytes_in_total %" PRIu64 "\n", metrics->bytes_in);
+    fprintf(out, "# HELP nes_parser_bytes_out_total Region bytes written to outputs.\n");
+    fprintf(out, "# TYPE nes_parser_bytes_out_total counter\n");
+    fprintf(out, "nes_parser_bytes_out_total %" PRIu64 "\n", metrics->bytes_out);
+
+    fprintf(out, "# HELP nes_parser_stage_duration_seconds Time spent in each stage of processing an input.\n");
+    fprintf(out, "# TYPE nes_parser_stage_duration_seconds histogram\n");
+    for(i = 0; i < METRICS_NUM_STAGES; i++)
+    {
+        const metrics_histogram_t *histogram = &metrics->stages[i];
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for(shift = PROMETHEUS_FIRST_LE_SHIFT; shift <= PROMETHEUS_LAST_LE_SHIFT; shift += 2)
+        {
+            uint64_t le_ns = (uint64_t)1 << shift;
+            for(; bucket < METRICS_HISTOGRAM_BUCKETS && bucket_upper(bucket) <= le_ns; bucket++) cumulative += histogram->buckets[bucket];
+            fprintf(out, "nes_parser_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %" PRIu64 "\n", METRICS_STAGE_STR[i], le_ns / 1e9, cumulative);
+        }
+        fprintf(out, "nes_parser_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", METRICS_STAGE_STR[i], histogram->count);
+        fprintf(out, "nes_parser_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", METRICS_STAGE_STR[i], histogram->sum_ns / 1e9);
+        fprintf(out, "nes_parser_stage_duration_seconds_count{stage=\"%s\"} %" PRIu64 "\n", METRICS_STAGE_STR[i], histogram->count);
+    }
+    return commit_file(out, temp_path, path, !ferror(out));
+}
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+// Timings and counters for the stages a ROM goes through, kept per worker so
+// recording is a few plain adds with no locking, and merged once at the end
+// of a batch.
+//
+// Every stage has a log-linear histogram of its durations: 8 buckets per
+// power of two of nanoseconds, so any quantile read back from it is within
+// 12.5% of the true value while recording stays a count-leading-zeros and an
+// increment. That is enough to tell a p99 of 3 ms from one of 30 ms, which is
+// what the per-file latency numbers are for.
+
+typedef enum metrics_stage
+{
+    METRICS_STAGE_OPEN = 0,  // opening the input
+    METRICS_STAGE_MAP,       // mapping (and populating) it
+    METRICS_STAGE_PARSE,     // decoding the header
+    METRICS_STAGE_DIGESTS,   // hashing the ROM and its regions
+    METRICS_STAGE_WRITE,     // each bank file, or the whole .nespack
+    METRICS_STAGE_FLUSH,     // waiting for --async-io writes to finish
+    METRICS_STAGE_FILE,      // one input, end to end
+    METRICS_NUM_STAGES
+} metrics_stage_t;
+static const char *const METRICS_STAGE_STR[] = {"open", "map", "parse", "digests", "write", "flush", "file"};
+
+#define METRICS_SUB_BUCKET_BITS 3
+// values below 8 get a bucket each, then 8 per power of two up to 2^64
+#define METRICS_HISTOGRAM_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS)
+// result codes that get their own counter; higher ones share the last
+#define METRICS_MAX_RESULTS 32
+
+typedef struct metrics_histogram
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} metrics_histogram_t;
+
+typedef struct metrics
+{
+    metrics_histogram_t stages[METRICS_NUM_STAGES];
+    uint64_t results[METRICS_MAX_RESULTS];  // inputs finished with each result code, 0 being success
+    uint64_t bytes_in;                      // ROM bytes read
+    uint64_t bytes_out;                     // region bytes written to outputs
+} metrics_t;
+
+typedef enum metrics_result
+{
+    METRICS_RESULT_SUCCESS = 0,
+    METRICS_RESULT_OPEN_ERR,
+    METRICS_RESULT_WRITE_ERR
+} metrics_result_t;
+static const char *const METRICS_RESULT_STR[] = {"success", "could not open file", "error writing file"};
+
+static inline uint64_t metrics_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void metrics_init(metrics_t *metrics);
+
+void metrics_record(metrics_t *metrics, metrics_stage_t stage, uint64_t ns);
+
+static inline void metrics_record_since(metrics_t *metrics, metrics_stage_t stage, uint64_t start_ns)
+{
+    metrics_record(metrics, stage, metrics_now_ns() - start_ns);
+}
+
+void metrics_count_result(metrics_t *metrics, unsigned result);
+
+// adds everything recorded in from to into
+void metrics_merge(metrics_t *into, const metrics_t *from);
+
+// the duration below which a fraction q of the recorded ones fall, to within
+// a bucket (reported as the bucket's upper end, capped at the maximum seen)
+uint64_t metrics_quantile_ns(const metrics_histogram_t *histogram, double q);
+
+// writes a JSON summary: counters, errors by result code (named by
+// result_names[code]) and per stage count, sum, mean, p50/p90/p99 and max
+metrics_result_t metrics_write_json(const metrics_t *metrics, const char *path, const char *const *result_names, size_t num_result_names);
+
+// writes the Prometheus text exposition format, e.g. for node_exporter's
+// textfile collector. The file is written under a temporary name and renamed
+// into place, so a scrape never sees half of it.
+metrics_result_t metrics_write_prometheus(const metrics_t *metrics, const char *path);
+
+#endif
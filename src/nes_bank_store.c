@@ -0,0 +1,108 @@
+#include "nes_bank_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fd_copy.h"
+#include "sha1.h"
+
+static bool make_dir(const char *path)
+{
+    return !mkdir(path, 0755) || errno == EEXIST;
+}
+
+nes_bank_store_result_t nes_bank_store_open(const char *root, nes_bank_store_t *out)
+{
+    size_t root_len = strlen(root);
+    // leave room for "/objects/xx/<38 digits>" and temp file names
+    if(root_len + 64 > PATH_MAX) return NES_BANK_STORE_RESULT_DIR_ERR;
+    out->objects_dir = malloc(root_len + sizeof("/objects"));
+    if(!out->objects_dir) return NES_BANK_STORE_RESULT_ALLOC_ERR;
+    sprintf(out->objects_dir, "%s/objects", root);
+    out->objects_dir_len = strlen(out->objects_dir);
+
+    if(!make_dir(root) || !make_dir(out->objects_dir))
+    {
+        nes_bank_store_close(out);
+        return NES_BANK_STORE_RESULT_DIR_ERR;
+    }
+    // creating all 256 fan-out directories up front keeps mkdir out of put.
+    char path[PATH_MAX];
+    int i;
+    for(i = 0; i < 256; i++)
+    {
+        sprintf(path, "%s/%02x", out->objects_dir, i);
+        if(!make_dir(path))
+        {
+            nes_bank_store_close(out);
+            return NES_BANK_STORE_RESULT_DIR_ERR;
+        }
+    }
+    return NES_BANK_STORE_RESULT_SUCCESS;
+}
+
+static void object_path(nes_bank_store_t *store, const char *hash_hex, char path_out[PATH_MAX])
+{
+    sprintf(path_out, "%s/%.2s/%s", store->objects_dir, hash_hex, hash_hex + 2);
+}
+
+nes_bank_store_result_t nes_bank_store_put(
+    nes_bank_store_t *store,
+    int in_fd,
+    off_t in_off,
+    const char *in_buf,
+    size_t len,
+    bool allow_zero_copy,
+    char hash_hex_out[41],
+    bool *was_new_out)
+{
+    uint8_t digest[20];
+    sha1(in_buf, len, digest);
+    sha1_to_hex(digest, hash_hex_out);
+    if(was_new_out) *was_new_out = false;
+
+    char path[PATH_MAX];
+    object_path(store, hash_hex_out, path);
+    struct stat st;
+    if(!stat(path, &st)) return NES_BANK_STORE_RESULT_SUCCESS;
+
+    char tmp_path[PATH_MAX];
+    sprintf(tmp_path, "%s/tmp.XXXXXX", store->objects_dir);
+    int tmp_fd = mkstemp(tmp_path);
+    if(tmp_fd < 0) return NES_BANK_STORE_RESULT_WRITE_ERR;
+    // objects are immutable once named
+    fchmod(tmp_fd, 0444);
+    fd_copy_result_t copy_result = fd_copy(in_fd, in_off, tmp_fd, len, in_buf, allow_zero_copy);
+    if(close(tmp_fd) || copy_result || rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        return NES_BANK_STORE_RESULT_WRITE_ERR;
+    }
+    // if another writer got there first, rename just replaced identical
+    // contents, which is harmless.
+    if(was_new_out) *was_new_out = true;
+    return NES_BANK_STORE_RESULT_SUCCESS;
+}
+
+nes_bank_store_result_t nes_bank_store_link(nes_bank_store_t *store, const char *hash_hex, const char *link_path)
+{
+    char path[PATH_MAX];
+    object_path(store, hash_hex, path);
+    if(unlink(link_path) && errno != ENOENT) return NES_BANK_STORE_RESULT_LINK_ERR;
+    if(link(path, link_path)) return NES_BANK_STORE_RESULT_LINK_ERR;
+    return NES_BANK_STORE_RESULT_SUCCESS;
+}
+
+void nes_bank_store_close(nes_bank_store_t *store)
+{
+    free(store->objects_dir);
+    store->objects_dir = NULL;
+    store->objects_dir_len = 0;
+}
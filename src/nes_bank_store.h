@@ -0,0 +1,62 @@
+#ifndef NES_BANK_STORE_H
+#define NES_BANK_STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+// A content-addressed store of ROM banks. Every bank is saved once, under the
+// SHA-1 of its contents, as
+//
+//   <root>/objects/<first 2 hex digits>/<remaining 38 hex digits>
+//
+// so the banks that hacks, revisions and regional variants have in common
+// take up space (and write bandwidth) only once across a whole library. Each
+// ROM then only needs a small manifest listing the hashes of its regions.
+//
+// A store can be shared by any number of threads and processes: objects are
+// written to a temporary file and renamed into place, and an object that
+// already exists is never rewritten.
+
+typedef enum nes_bank_store_result
+{
+    NES_BANK_STORE_RESULT_SUCCESS = 0,
+    NES_BANK_STORE_RESULT_ALLOC_ERR,
+    NES_BANK_STORE_RESULT_DIR_ERR,
+    NES_BANK_STORE_RESULT_WRITE_ERR,
+    NES_BANK_STORE_RESULT_LINK_ERR
+} nes_bank_store_result_t;
+static const char *const NES_BANK_STORE_RESULT_STR[] = {"success", "memory allocation failed", "could not create store directory", "error writing object", "could not link object"};
+
+typedef struct nes_bank_store
+{
+    char *objects_dir;
+    size_t objects_dir_len;
+} nes_bank_store_t;
+
+// creates <root>/objects and its fan-out directories if they are missing
+nes_bank_store_result_t nes_bank_store_open(const char *root, nes_bank_store_t *out);
+
+// stores len bytes at in_off of in_fd (also mapped at in_buf) unless an
+// object with the same contents already exists. hash_hex_out receives the
+// object's 40 hex digit name and was_new_out (optional) whether it had to be
+// written.
+nes_bank_store_result_t nes_bank_store_put(
+    nes_bank_store_t *store,
+    int in_fd,
+    off_t in_off,
+    const char *in_buf,
+    size_t len,
+    bool allow_zero_copy,
+    char hash_hex_out[41],
+    bool *was_new_out);
+
+// hardlinks the object with the given hash to link_path, replacing whatever
+// is there.
+nes_bank_store_result_t nes_bank_store_link(nes_bank_store_t *store, const char *hash_hex, const char *link_path);
+
+// releases all resources that this object allocated
+void nes_bank_store_close(nes_bank_store_t *store);
+
+#endif
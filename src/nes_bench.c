@@ -0,0 +1,576 @@
+// Throughput benchmarks for the header decoders and the extractor, on a
+// synthetic corpus from rom_gen. Results are NDJSON, one record per
+// measurement plus a leading "meta" record describing the run, so they can be
+// collected per release and compared by script.
+//
+// Header decoding and CPU bus accesses are measured in process. Extraction is
+// measured by running the nes_file_parser binary in --batch mode over the
+// corpus, once per thread count and I/O mode. That is the whole pipeline a
+// user runs, process start included. The corpus has just been written, so it
+// is in the page cache: these are warm-cache numbers.
+
+#define _GNU_SOURCE // mkdtemp
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json_writer.h"
+#include "nes_header.h"
+#include "nes_mapper/nes_mapper.h"
+#include "rom_gen.h"
+
+extern char **environ;
+
+#define MAX_THREAD_COUNTS 16
+#define MAX_MODES 8
+#define MAX_REPEATS 64
+
+// how the extractor is run: a name for the results and its extra arguments
+typedef struct bench_mode
+{
+    const char *name;
+    const char *args[3];
+} bench_mode_t;
+
+static const bench_mode_t BENCH_MODES[] = {
+    { "files", { NULL } },
+    { "no-zero-copy", { "--no-zero-copy", NULL } },
+    { "async-io", { "--async-io", NULL } },
+    { "packed", { "--format=packed", NULL } },
+    { "digests", { "--digests", NULL } },
+};
+#define NUM_BENCH_MODES (sizeof(BENCH_MODES) / sizeof(BENCH_MODES[0]))
+
+typedef struct bench_options
+{
+    const char *parser;        // the nes_file_parser binary, looked up in PATH
+    const char *work_dir;      // where the corpus directory is created
+    const char *generate_dir;  // --generate: only write the corpus here
+    size_t num_roms;
+    uint64_t seed;
+    size_t thread_counts[MAX_THREAD_COUNTS];
+    size_t num_thread_counts;
+    const bench_mode_t *modes[MAX_MODES];
+    size_t num_modes;
+    size_t repeat;
+    uint64_t header_iterations;
+    uint64_t bus_iterations;
+    bool keep;
+    FILE *out;
+} bench_options_t;
+
+typedef enum bench_result
+{
+    BENCH_RESULT_SUCCESS = 0,
+    BENCH_RESULT_USAGE,
+    BENCH_RESULT_ALLOC_ERR,
+    BENCH_RESULT_CORPUS_ERR,
+    BENCH_RESULT_RUN_ERR
+} bench_result_t;
+static const char *BENCH_RESULT_STR[] = {"success", "usage", "memory allocation failed", "could not write corpus", "extractor run failed"};
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void emit(const bench_options_t *opts, json_writer_t *json)
+{
+    if(json->failed) return;
+    fwrite(json->buf, 1, json->len, opts->out);
+    putc('\n', opts->out);
+    fflush(opts->out);
+}
+
+static void emit_meta(const bench_options_t *opts, json_writer_t *json, uint64_t corpus_bytes)
+{
+    json_writer_reset(json);
+    json_writer_begin_object(json);
+    json_writer_key(json, "bench");
+    json_writer_string(json, "meta");
+    json_writer_key(json, "parser_version");
+    char version[64];
+    sprintf(version, "%" PRIu64 ".%" PRIu64 ".%" PRIu64, NES_HEADER_PARSER_VERSION[0], NES_HEADER_PARSER_VERSION[1], NES_HEADER_PARSER_VERSION[2]);
+    json_writer_string(json, version);
+    json_writer_key(json, "seed");
+    json_writer_uint(json, opts->seed);
+    json_writer_key(json, "roms");
+    json_writer_uint(json, opts->num_roms);
+    json_writer_key(json, "corpus_bytes");
+    json_writer_uint(json, corpus_bytes);
+    json_writer_key(json, "cpus");
+    json_writer_int(json, sysconf(_SC_NPROCESSORS_ONLN));
+    json_writer_key(json, "repeat");
+    json_writer_uint(json, opts->repeat);
+    json_writer_end_object(json);
+    emit(opts, json);
+}
+
+// headers/s of nes_header_parse, nes_header_parse_batch and of a header view
+// read for the fields a filter looks at (mapper and ROM sizes), over the
+// headers of the corpus, cycled until header_iterations have been decoded
+static bench_result_t bench_headers(const bench_options_t *opts, json_writer_t *json)
+{
+    const size_t BATCH = 4096;
+    size_t num_headers = opts->num_roms < BATCH ? opts->num_roms : BATCH;
+    uint8_t *headers = malloc(num_headers * 16);
+    nes_header_packed_t *packed = malloc(num_headers * sizeof(nes_header_packed_t));
+    if(!headers || !packed)
+    {
+        free(headers);
+        free(packed);
+        return BENCH_RESULT_ALLOC_ERR;
+    }
+    size_t i;
+    for(i = 0; i < num_headers; i++)
+    {
+        rom_gen_rom_t rom;
+        rom_gen_describe(opts->seed, i, &rom);
+        memcpy(headers + i * 16, rom.header, 16);
+    }
+    uint64_t rounds = (opts->header_iterations + num_headers - 1) / num_headers;
+    static const char *IMPLS[] = {"nes_header_parse", "nes_header_parse_batch", "nes_header_view"};
+    size_t impl;
+    for(impl = 0; impl < sizeof(IMPLS) / sizeof(IMPLS[0]); impl++)
+    {
+        double samples[MAX_REPEATS];
+        size_t r;
+        // keeps the decoded fields live, so none of the work is optimized out
+        volatile uint64_t sink = 0;
+        for(r = 0; r < opts->repeat; r++)
+        {
+            double start = now_seconds();
+            uint64_t round;
+            for(round = 0; round < rounds; round++)
+            {
+                if(impl == 0)
+                {
+                    for(i = 0; i < num_headers; i++)
+                    {
+                        nes_header_t header;
+                        nes_header_parse((char *)headers + i * 16, 16, &header);
+                        sink += header.mapper_id + header.prg_rom_size;
+                    }
+                }
+                else if(impl == 1)
+                {
+                    nes_header_parse_batch(headers, num_headers, packed);
+                    sink += packed[round % num_headers].mapper_id;
+                }
+                else
+                {
+                    for(i = 0; i < num_headers; i++)
+                    {
+                        nes_header_view_t view;
+                        nes_header_view_init(headers + i * 16, 16, &view);
+                        sink += nes_header_view_mapper_id(view) + nes_header_view_prg_rom_size(view) + nes_header_view_char_rom_size(view);
+                    }
+                }
+            }
+            samples[r] = now_seconds() - start;
+        }
+        qsort(samples, opts->repeat, sizeof(double), compare_doubles);
+        uint64_t decoded = rounds * num_headers;
+        json_writer_reset(json);
+        json_writer_begin_object(json);
+        json_writer_key(json, "bench");
+        json_writer_string(json, "header_parse");
+        json_writer_key(json, "impl");
+        json_writer_string(json, IMPLS[impl]);
+        json_writer_key(json, "headers");
+        json_writer_uint(json, decoded);
+        json_writer_key(json, "seconds_best");
+        json_writer_double(json, samples[0]);
+        json_writer_key(json, "seconds_median");
+        json_writer_double(json, samples[opts->repeat / 2]);
+        json_writer_key(json, "headers_per_sec");
+        json_writer_double(json, decoded / samples[0]);
+        json_writer_end_object(json);
+        emit(opts, json);
+    }
+    free(headers);
+    free(packed);
+    return BENCH_RESULT_SUCCESS;
+}
+
+// one access of the synthetic bus trace
+typedef struct bus_op
+{
+    uint16_t addr;
+    bool write;
+} bus_op_t;
+
+// what the emulator paid before the accessors were inline: a call through a
+// function pointer per byte
+static nes_mapper_result_t bus_read_called(nes_mapper_t *mapper, uint16_t addr, uint8_t *out)
+{
+    return nes_mapper_cpu_read_8(mapper, addr, out);
+}
+
+static nes_mapper_result_t bus_write_called(nes_mapper_t *mapper, uint16_t addr, uint8_t in)
+{
+    return nes_mapper_cpu_write_8(mapper, addr, in);
+}
+
+// bus accesses/s of an NROM mapper, through the inline accessors and through
+// a call per access. The trace is roughly what a 6502 program issues: mostly
+// opcode and operand fetches from PRG-ROM, then zero page, stack and other
+// RAM, and now and then a PPU register on the slow path.
+static bench_result_t bench_bus(const bench_options_t *opts, json_writer_t *json)
+{
+    const size_t NUM_OPS = 0x10000;
+    // an iNES image with two PRG-ROM banks and one CHR-ROM bank
+    const size_t IMAGE_SIZE = NES_HEADER_SIZE + 2 * NES_HEADER_PROG_ROM_BLOCK_SIZE + NES_HEADER_CHAR_ROM_BLOCK_SIZE;
+    bus_op_t *ops = malloc(NUM_OPS * sizeof(bus_op_t));
+    uint8_t *image = calloc(1, IMAGE_SIZE);
+    nes_rom_t *rom = NULL;
+    nes_mapper_t *mapper = NULL;
+    bench_result_t result = BENCH_RESULT_ALLOC_ERR;
+    if(!ops || !image) goto end;
+    memcpy(image, "NES\x1a\x02\x01", 6);
+    size_t i;
+    for(i = 0; i < 2 * NES_HEADER_PROG_ROM_BLOCK_SIZE; i++) image[NES_HEADER_SIZE + i] = i * 31;
+    if(nes_rom_open_buffer(image, IMAGE_SIZE, &rom) || nes_mapper_create(rom, &mapper)) goto end;
+
+    uint64_t state = opts->seed * 0x9e3779b97f4a7c15ull + 1;
+    uint16_t pc = 0x8000;
+    for(i = 0; i < NUM_OPS; i++)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t r = state >> 33;
+        uint32_t kind = r % 100;
+        ops[i].write = false;
+        if(kind < 55)
+        {
+            ops[i].addr = pc;
+            pc = pc == 0xffff ? 0x8000 : pc + 1;
+        }
+        else if(kind < 80) ops[i].addr = (r >> 8) & 0xff;
+        else if(kind < 90) ops[i].addr = 0x100 | ((r >> 8) & 0xff);
+        else if(kind < 98) ops[i].addr = 0x200 + (r >> 8) % 0x600;
+        else ops[i].addr = (r >> 8) & 1 ? 0x2002 : 0x2006;
+        if(kind >= 55 && kind < 98) ops[i].write = (r >> 20) & 1;
+        else if(ops[i].addr == 0x2006) ops[i].write = true;
+    }
+
+    uint64_t rounds = (opts->bus_iterations + NUM_OPS - 1) / NUM_OPS;
+    static const char *IMPLS[] = {"called", "inline"};
+    // volatile, so the calls stay calls
+    nes_mapper_result_t (*volatile read_fn)(nes_mapper_t *, uint16_t, uint8_t *) = bus_read_called;
+    nes_mapper_result_t (*volatile write_fn)(nes_mapper_t *, uint16_t, uint8_t) = bus_write_called;
+    size_t impl;
+    for(impl = 0; impl < sizeof(IMPLS) / sizeof(IMPLS[0]); impl++)
+    {
+        double samples[MAX_REPEATS];
+        size_t r;
+        volatile uint64_t sink = 0;
+        for(r = 0; r < opts->repeat; r++)
+        {
+            uint64_t acc = 0;
+            uint8_t value = 0;
+            double start = now_seconds();
+            uint64_t round;
+            for(round = 0; round < rounds; round++)
+            {
+                if(impl == 0)
+                {
+                    for(i = 0; i < NUM_OPS; i++)
+                    {
+                        if(ops[i].write) write_fn(mapper, ops[i].addr, value);
+                        else read_fn(mapper, ops[i].addr, &value);
+                        acc += value;
+                    }
+                }
+                else
+                {
+                    for(i = 0; i < NUM_OPS; i++)
+                    {
+                        if(ops[i].write) nes_mapper_cpu_write_8(mapper, ops[i].addr, value);
+                        else nes_mapper_cpu_read_8(mapper, ops[i].addr, &value);
+                        acc += value;
+                    }
+                }
+            }
+            samples[r] = now_seconds() - start;
+            sink += acc;
+        }
+        qsort(samples, opts->repeat, sizeof(double), compare_doubles);
+        uint64_t accesses = rounds * NUM_OPS;
+        json_writer_reset(json);
+        json_writer_begin_object(json);
+        json_writer_key(json, "bench");
+        json_writer_string(json, "cpu_bus");
+        json_writer_key(json, "impl");
+        json_writer_string(json, IMPLS[impl]);
+        json_writer_key(json, "accesses");
+        json_writer_uint(json, accesses);
+        json_writer_key(json, "seconds_best");
+        json_writer_double(json, samples[0]);
+        json_writer_key(json, "seconds_median");
+        json_writer_double(json, samples[opts->repeat / 2]);
+        json_writer_key(json, "accesses_per_sec");
+        json_writer_double(json, accesses / samples[0]);
+        json_writer_end_object(json);
+        emit(opts, json);
+    }
+    result = BENCH_RESULT_SUCCESS;
+
+end:
+    if(mapper) nes_mapper_clear(mapper);
+    if(rom) nes_rom_release(rom);
+    free(ops);
+    free(image);
+    return result;
+}
+
+// removes every file in dir that the corpus did not start with, i.e. the
+// extractor's outputs from the previous run
+static void remove_outputs(const char *dir, bool keep_corpus)
+{
+    DIR *d = opendir(dir);
+    if(!d) return;
+    struct dirent *entry;
+    while((entry = readdir(d)))
+    {
+        size_t len = strlen(entry->d_name);
+        if(entry->d_name[0] == '.') continue;
+        if(keep_corpus && len > 4 && !strcmp(entry->d_name + len - 4, ".nes")) continue;
+        unlinkat(dirfd(d), entry->d_name, 0);
+    }
+    closedir(d);
+}
+
+// runs the extractor over the corpus and returns its wall time, or a
+// negative value if it could not be run or failed
+static double run_extractor(const bench_options_t *opts, const char *corpus_dir, const bench_mode_t *mode, size_t num_threads)
+{
+    char threads_arg[32];
+    sprintf(threads_arg, "--threads=%zu", num_threads);
+    const char *argv[8];
+    size_t argc = 0;
+    argv[argc++] = opts->parser;
+    argv[argc++] = "--batch";
+    argv[argc++] = threads_arg;
+    size_t i;
+    for(i = 0; mode->args[i]; i++) argv[argc++] = mode->args[i];
+    argv[argc++] = corpus_dir;
+    argv[argc] = NULL;
+
+    // the per-file status lines are not part of what is measured
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    double start = now_seconds();
+    pid_t pid;
+    int spawn_result = posix_spawnp(&pid, opts->parser, &actions, NULL, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(spawn_result) return -1;
+    int status;
+    while(waitpid(pid, &status, 0) < 0)
+        if(errno != EINTR) return -1;
+    double elapsed = now_seconds() - start;
+    return WIFEXITED(status) && !WEXITSTATUS(status) ? elapsed : -1;
+}
+
+static bench_result_t bench_extract(const bench_options_t *opts, json_writer_t *json, const char *corpus_dir, uint64_t corpus_bytes)
+{
+    size_t m, t, r;
+    for(m = 0; m < opts->num_modes; m++)
+    {
+        for(t = 0; t < opts->num_thread_counts; t++)
+        {
+            double samples[MAX_REPEATS];
+            for(r = 0; r < opts->repeat; r++)
+            {
+                remove_outputs(corpus_dir, true);
+                samples[r] = run_extractor(opts, corpus_dir, opts->modes[m], opts->thread_counts[t]);
+                if(samples[r] < 0)
+                {
+                    fprintf(stderr, "%s: %s (mode %s, %zu threads)\n", opts->parser, BENCH_RESULT_STR[BENCH_RESULT_RUN_ERR], opts->modes[m]->name, opts->thread_counts[t]);
+                    return BENCH_RESULT_RUN_ERR;
+                }
+            }
+            qsort(samples, opts->repeat, sizeof(double), compare_doubles);
+            json_writer_reset(json);
+            json_writer_begin_object(json);
+            json_writer_key(json, "bench");
+            json_writer_string(json, "extract");
+            json_writer_key(json, "mode");
+            json_writer_string(json, opts->modes[m]->name);
+            json_writer_key(json, "threads");
+            json_writer_uint(json, opts->thread_counts[t]);
+            json_writer_key(json, "roms");
+            json_writer_uint(json, opts->num_roms);
+            json_writer_key(json, "bytes");
+            json_writer_uint(json, corpus_bytes);
+            json_writer_key(json, "seconds_best");
+            json_writer_double(json, samples[0]);
+            json_writer_key(json, "seconds_median");
+            json_writer_double(json, samples[opts->repeat / 2]);
+            json_writer_key(json, "files_per_sec");
+            json_writer_double(json, opts->num_roms / samples[0]);
+            json_writer_key(json, "mb_per_sec");
+            json_writer_double(json, corpus_bytes / 1e6 / samples[0]);
+            json_writer_end_object(json);
+            emit(opts, json);
+        }
+    }
+    remove_outputs(corpus_dir, true);
+    return BENCH_RESULT_SUCCESS;
+}
+
+// "1,2,4" into counts; false if it is not a list of positive numbers
+static bool parse_thread_counts(const char *list, bench_options_t *opts)
+{
+    opts->num_thread_counts = 0;
+    while(*list)
+    {
+        char *end;
+        unsigned long count = strtoul(list, &end, 10);
+        if(end == list || !count || opts->num_thread_counts == MAX_THREAD_COUNTS) return false;
+        opts->thread_counts[opts->num_thread_counts++] = count;
+        list = *end == ',' ? end + 1 : end;
+        if(*end && *end != ',') return false;
+    }
+    return opts->num_thread_counts > 0;
+}
+
+static bool parse_modes(const char *list, bench_options_t *opts)
+{
+    opts->num_modes = 0;
+    while(*list)
+    {
+        size_t len = strcspn(list, ",");
+        size_t i;
+        for(i = 0; i < NUM_BENCH_MODES; i++)
+            if(strlen(BENCH_MODES[i].name) == len && !strncmp(BENCH_MODES[i].name, list, len)) break;
+        if(i == NUM_BENCH_MODES || opts->num_modes == MAX_MODES) return false;
+        opts->modes[opts->num_modes++] = &BENCH_MODES[i];
+        list += len + (list[len] == ',');
+    }
+    return opts->num_modes > 0;
+}
+
+static void print_usage(const char *prog)
+{
+    printf("usage: %s [options]\n", prog);
+    printf("       %s --generate=DIR [--roms=N] [--seed=S]\n", prog);
+    printf("options:\n");
+    printf("    --parser=PATH            the nes_file_parser binary (default: from PATH)\n");
+    printf("    --work-dir=DIR           where the corpus is generated (default /tmp)\n");
+    printf("    --roms=N                 ROMs in the corpus (default 2000)\n");
+    printf("    --seed=S                 corpus seed (default 1)\n");
+    printf("    --threads=N[,N...]       extractor thread counts (default 1,2,4,8)\n");
+    printf("    --modes=MODE[,MODE...]   files, no-zero-copy, async-io, packed, digests\n");
+    printf("                             (default all)\n");
+    printf("    --repeat=R               runs per measurement; best and median are kept (default 3)\n");
+    printf("    --header-iterations=N    headers decoded per header benchmark run (default 4000000)\n");
+    printf("    --bus-iterations=N       CPU bus accesses per bus benchmark run (default 50000000)\n");
+    printf("    --out=FILE               write the NDJSON results to FILE instead of stdout\n");
+    printf("    --keep                   leave the corpus in the work directory\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options_t opts = { .parser = "nes_file_parser", .work_dir = "/tmp", .generate_dir = NULL, .num_roms = 2000, .seed = 1, .thread_counts = {1, 2, 4, 8}, .num_thread_counts = 4, .num_modes = 0, .repeat = 3, .header_iterations = 4000000, .bus_iterations = 50000000, .keep = false, .out = stdout };
+    const char *out_path = NULL;
+    bool modes_ok = true;
+    bool threads_ok = true;
+    size_t i;
+    for(i = 0; i < NUM_BENCH_MODES; i++) opts.modes[opts.num_modes++] = &BENCH_MODES[i];
+    int argi;
+    for(argi = 1; argi < argc; argi++)
+    {
+        if(!strncmp(argv[argi], "--parser=", 9)) opts.parser = argv[argi] + 9;
+        else if(!strncmp(argv[argi], "--work-dir=", 11)) opts.work_dir = argv[argi] + 11;
+        else if(!strncmp(argv[argi], "--generate=", 11)) opts.generate_dir = argv[argi] + 11;
+        else if(!strncmp(argv[argi], "--roms=", 7)) opts.num_roms = strtoul(argv[argi] + 7, NULL, 10);
+        else if(!strncmp(argv[argi], "--seed=", 7)) opts.seed = strtoull(argv[argi] + 7, NULL, 10);
+        else if(!strncmp(argv[argi], "--threads=", 10)) threads_ok = parse_thread_counts(argv[argi] + 10, &opts);
+        else if(!strncmp(argv[argi], "--modes=", 8)) modes_ok = parse_modes(argv[argi] + 8, &opts);
+        else if(!strncmp(argv[argi], "--repeat=", 9)) opts.repeat = strtoul(argv[argi] + 9, NULL, 10);
+        else if(!strncmp(argv[argi], "--header-iterations=", 20)) opts.header_iterations = strtoull(argv[argi] + 20, NULL, 10);
+        else if(!strncmp(argv[argi], "--bus-iterations=", 17)) opts.bus_iterations = strtoull(argv[argi] + 17, NULL, 10);
+        else if(!strncmp(argv[argi], "--out=", 6)) out_path = argv[argi] + 6;
+        else if(!strcmp(argv[argi], "--keep")) opts.keep = true;
+        else break;
+    }
+    if(argi < argc || !modes_ok || !threads_ok || !opts.num_roms || !opts.repeat || opts.repeat > MAX_REPEATS)
+    {
+        print_usage(argv[0]);
+        return BENCH_RESULT_USAGE;
+    }
+
+    rom_gen_result_t gen_result;
+    if(opts.generate_dir)
+    {
+        uint64_t corpus_bytes;
+        if((gen_result = rom_gen_write_corpus(opts.generate_dir, opts.seed, opts.num_roms, &corpus_bytes)))
+        {
+            fprintf(stderr, "%s: %s\n", opts.generate_dir, ROM_GEN_RESULT_STR[gen_result]);
+            return BENCH_RESULT_CORPUS_ERR;
+        }
+        fprintf(stderr, "%zu ROMs, %" PRIu64 " bytes\n", opts.num_roms, corpus_bytes);
+        return BENCH_RESULT_SUCCESS;
+    }
+
+    if(out_path && !(opts.out = fopen(out_path, "w")))
+    {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        return BENCH_RESULT_USAGE;
+    }
+    bench_result_t result = BENCH_RESULT_ALLOC_ERR;
+    json_writer_t json;
+    json_writer_init(&json);
+    char *corpus_dir = malloc(strlen(opts.work_dir) + 32);
+    if(!corpus_dir) goto close_out;
+    sprintf(corpus_dir, "%s/nes_bench.XXXXXX", opts.work_dir);
+    result = BENCH_RESULT_CORPUS_ERR;
+    if(!mkdtemp(corpus_dir))
+    {
+        fprintf(stderr, "%s: %s\n", corpus_dir, strerror(errno));
+        goto free_dir;
+    }
+    uint64_t corpus_bytes;
+    if((gen_result = rom_gen_write_corpus(corpus_dir, opts.seed, opts.num_roms, &corpus_bytes)))
+    {
+        fprintf(stderr, "%s: %s\n", corpus_dir, ROM_GEN_RESULT_STR[gen_result]);
+        goto remove_dir;
+    }
+
+    emit_meta(&opts, &json, corpus_bytes);
+    if(!(result = bench_headers(&opts, &json)) && !(result = bench_bus(&opts, &json))) result = bench_extract(&opts, &json, corpus_dir, corpus_bytes);
+
+remove_dir:
+    if(opts.keep) fprintf(stderr, "corpus kept in %s\n", corpus_dir);
+    else
+    {
+        remove_outputs(corpus_dir, false);
+        rmdir(corpus_dir);
+    }
+free_dir:
+    free(corpus_dir);
+close_out:
+    json_writer_clear(&json);
+    if(opts.out != stdout) fclose(opts.out);
+    if(result) fprintf(stderr, "%s\n", BENCH_RESULT_STR[result]);
+    return result;
+}
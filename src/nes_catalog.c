@@ -0,0 +1,458 @@
+#include "nes_catalog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rom_digest.h"
+#include "work_pool.h"
+
+nes_catalog_result_t nes_catalog_open(const char *path, nes_catalog_t *out)
+{
+    nes_catalog_result_t result = NES_CATALOG_RESULT_SUCCESS;
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return errno == ENOENT ? NES_CATALOG_RESULT_SUCCESS : NES_CATALOG_RESULT_OPEN_ERR;
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(nes_catalog_file_header_t))
+    {
+        result = NES_CATALOG_RESULT_INVALID_CATALOG;
+        goto close_fd;
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        result = NES_CATALOG_RESULT_OPEN_ERR;
+        goto close_fd;
+    }
+
+    const nes_catalog_file_header_t *header = (const nes_catalog_file_header_t *)map;
+    uint64_t size = st.st_size;
+    bool valid = !memcmp(header->magic, NES_CATALOG_MAGIC, sizeof(NES_CATALOG_MAGIC))
+        && header->version == NES_CATALOG_VERSION
+        && header->record_size == sizeof(nes_catalog_record_t)
+        && header->records_offset == sizeof(nes_catalog_file_header_t)
+        && header->num_records <= (size - header->records_offset) / sizeof(nes_catalog_record_t)
+        && header->strings_offset == header->records_offset + header->num_records * sizeof(nes_catalog_record_t)
+        && header->strings_size <= size - header->strings_offset;
+    const nes_catalog_record_t *records = (const nes_catalog_record_t *)(map + header->records_offset);
+    uint64_t i;
+    for(i = 0; valid && i < header->num_records; i++)
+        valid = records[i].path_offset <= header->strings_size && records[i].path_len <= header->strings_size - records[i].path_offset;
+    if(!valid)
+    {
+        munmap((void *)map, st.st_size);
+        result = NES_CATALOG_RESULT_INVALID_CATALOG;
+        goto close_fd;
+    }
+
+    out->map = map;
+    out->map_size = st.st_size;
+    out->header = header;
+    out->records = records;
+    out->num_records = header->num_records;
+    out->strings = map + header->strings_offset;
+
+close_fd:
+    close(fd);
+    return result;
+}
+
+const char *nes_catalog_record_path(const nes_catalog_t *catalog, const nes_catalog_record_t *record)
+{
+    return catalog->strings + record->path_offset;
+}
+
+// orders like strcmp on the null terminated path
+static int compare_record_path(const nes_catalog_t *catalog, const nes_catalog_record_t *record, const char *path)
+{
+    const char *record_path = nes_catalog_record_path(catalog, record);
+    size_t path_len = strlen(path);
+    size_t common = record->path_len < path_len ? record->path_len : path_len;
+    int cmp = memcmp(record_path, path, common);
+    if(cmp) return cmp;
+    return record->path_len < path_len ? -1 : record->path_len > path_len;
+}
+
+const nes_catalog_record_t *nes_catalog_find(const nes_catalog_t *catalog, const char *path)
+{
+    size_t lo = 0;
+    size_t hi = catalog->num_records;
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_record_path(catalog, &catalog->records[mid], path);
+        if(!cmp) return &catalog->records[mid];
+        if(cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+void nes_catalog_record_to_header(const nes_catalog_record_t *record, nes_header_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    memcpy(&(out->parser_version), NES_HEADER_PARSER_VERSION, sizeof(NES_HEADER_PARSER_VERSION));
+    out->type = (nes_header_type_t)record->type;
+    nes_header_view_t view = { .raw = record->raw_header };
+    out->prg_rom_bytes = nes_header_view_prg_rom_bytes(view);
+    out->char_rom_bytes = nes_header_view_char_rom_bytes(view);
+    out->prg_rom_size = record->prg_rom_size;
+    out->char_rom_size = record->char_rom_size;
+    out->mapper_id = record->mapper_id;
+    out->ntmt = (nes_header_nametable_mirroring_type_t)record->ntmt;
+    out->persistent_memory = record->persistent_memory;
+    out->trainer = record->trainer;
+    out->ct = (nes_header_console_type_t)record->ct;
+    out->nes_2.submapper_id = record->submapper_id;
+    out->nes_2.prg_ram_size = record->prg_ram_size;
+    out->nes_2.prg_eeprom_size = record->prg_eeprom_size;
+    out->nes_2.char_ram_size = record->char_ram_size;
+    out->nes_2.char_eeprom_size = record->char_eeprom_size;
+    out->nes_2.tt = (nes_header_timing_type_t)record->tt;
+    out->nes_2.console_type_info.vs_system.ppu_type = record->console_type_info[0];
+    out->nes_2.console_type_info.vs_system.hardware_type = record->console_type_info[1];
+    out->nes_2.misc_roms_size = record->misc_roms_size;
+    out->nes_2.default_expansion_device = record->default_expansion_device;
+}
+
+// reads the fields straight out of the raw header the record already holds
+static void view_to_record(nes_header_view_t view, nes_catalog_record_t *record)
+{
+    record->prg_rom_size = nes_header_view_prg_rom_size(view);
+    record->char_rom_size = nes_header_view_char_rom_size(view);
+    record->mapper_id = nes_header_view_mapper_id(view);
+    record->type = nes_header_view_type(view);
+    record->ntmt = nes_header_view_ntmt(view);
+    record->persistent_memory = nes_header_view_persistent_memory(view);
+    record->trainer = nes_header_view_trainer(view);
+    record->ct = nes_header_view_ct(view);
+    if(record->type == NES_HEADER_TYPE_NES_2)
+    {
+        record->submapper_id = nes_header_view_submapper_id(view);
+        record->prg_ram_size = nes_header_view_prg_ram_size(view);
+        record->prg_eeprom_size = nes_header_view_prg_eeprom_size(view);
+        record->char_ram_size = nes_header_view_char_ram_size(view);
+        record->char_eeprom_size = nes_header_view_char_eeprom_size(view);
+        record->tt = nes_header_view_tt(view);
+        if(record->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+        {
+            record->console_type_info[0] = nes_header_view_vs_ppu_type(view);
+            record->console_type_info[1] = nes_header_view_vs_hardware_type(view);
+        }
+        else if(record->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+        {
+            record->console_type_info[0] = nes_header_view_extended_console_type(view);
+        }
+        record->misc_roms_size = nes_header_view_misc_roms_size(view);
+        record->default_expansion_device = nes_header_view_default_expansion_device(view);
+    }
+}
+
+// digests everything after the 16-byte header
+static void digest_payload(int fd, uint64_t file_size, nes_catalog_record_t *record)
+{
+    if(file_size <= NES_HEADER_SIZE) return;
+    const char *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) return;
+    madvise((void *)map, file_size, MADV_SEQUENTIAL);
+    rom_digest_ctx_t ctx;
+    rom_digest_t digest;
+    rom_digest_init(&ctx);
+    rom_digest_update(&ctx, map + NES_HEADER_SIZE, file_size - NES_HEADER_SIZE);
+    rom_digest_final(&ctx, &digest);
+    munmap((void *)map, file_size);
+    record->crc32 = digest.crc32;
+    memcpy(record->md5, digest.md5, sizeof(record->md5));
+    memcpy(record->sha1, digest.sha1, sizeof(record->sha1));
+    record->flags |= NES_CATALOG_FLAG_HAS_DIGESTS;
+}
+
+// fills in everything but the path fields
+static void parse_file(const char *path, const struct stat *st, bool digests, nes_catalog_record_t *record)
+{
+    memset(record, 0, sizeof(*record));
+    record->file_size = st->st_size;
+    record->mtime_sec = st->st_mtim.tv_sec;
+    record->mtime_nsec = st->st_mtim.tv_nsec;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        record->parse_result = NES_CATALOG_PARSE_RESULT_OPEN_ERR;
+        return;
+    }
+    ssize_t header_read = pread(fd, record->raw_header, sizeof(record->raw_header), 0);
+    if(header_read < (ssize_t)sizeof(record->raw_header))
+    {
+        record->parse_result = header_read < 0 ? NES_CATALOG_PARSE_RESULT_OPEN_ERR : NES_CATALOG_PARSE_RESULT_TOO_SHORT;
+        goto close_fd;
+    }
+    nes_header_view_t view;
+    record->parse_result = nes_header_view_init(record->raw_header, sizeof(record->raw_header), &view);
+    if(record->parse_result) goto close_fd;
+    view_to_record(view, record);
+    record->flags |= NES_CATALOG_FLAG_HEADER_VALID;
+    if(digests) digest_payload(fd, st->st_size, record);
+
+close_fd:
+    close(fd);
+}
+
+typedef struct update_ctx
+{
+    const nes_catalog_t *old;
+    char **paths;
+    nes_catalog_record_t *records;
+    bool digests;
+    size_t num_reparsed;
+} update_ctx_t;
+
+static void update_one(void *ctx, size_t worker_id, size_t item)
+{
+    update_ctx_t *update = ctx;
+    const char *path = update->paths[item];
+    nes_catalog_record_t *record = &update->records[item];
+
+    struct stat st;
+    if(stat(path, &st))
+    {
+        memset(record, 0, sizeof(*record));
+        record->parse_result = NES_CATALOG_PARSE_RESULT_OPEN_ERR;
+        return;
+    }
+    const nes_catalog_record_t *old_record = update->old ? nes_catalog_find(update->old, path) : NULL;
+    if(old_record
+        && old_record->file_size == (uint64_t)st.st_size
+        && old_record->mtime_sec == st.st_mtim.tv_sec
+        && old_record->mtime_nsec == (uint32_t)st.st_mtim.tv_nsec
+        && (!update->digests || (old_record->flags & NES_CATALOG_FLAG_HAS_DIGESTS) || !(old_record->flags & NES_CATALOG_FLAG_HEADER_VALID)))
+    {
+        *record = *old_record;
+        return;
+    }
+    parse_file(path, &st, update->digests, record);
+    __atomic_add_fetch(&update->num_reparsed, 1, __ATOMIC_RELAXED);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while(len)
+    {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+nes_catalog_result_t nes_catalog_update(
+    const char *catalog_path,
+    const nes_catalog_t *old,
+    char **paths,
+    size_t num_paths,
+    size_t num_threads,
+    bool digests,
+    nes_catalog_update_stats_t *stats_out)
+{
+    nes_catalog_result_t result = NES_CATALOG_RESULT_SUCCESS;
+    char **sorted = malloc((num_paths ? num_paths : 1) * sizeof(char *));
+    nes_catalog_record_t *records = calloc(num_paths ? num_paths : 1, sizeof(nes_catalog_record_t));
+    char *tmp_path = malloc(strlen(catalog_path) + sizeof(".tmp.XXXXXX"));
+    if(!sorted || !records || !tmp_path)
+    {
+        result = NES_CATALOG_RESULT_ALLOC_ERR;
+        goto end;
+    }
+
+    // records are kept sorted by path so lookups can binary search
+    memcpy(sorted, paths, num_paths * sizeof(char *));
+    qsort(sorted, num_paths, sizeof(char *), compare_paths);
+    size_t num_unique = 0;
+    size_t i;
+    for(i = 0; i < num_paths; i++)
+        if(!num_unique || strcmp(sorted[num_unique - 1], sorted[i])) sorted[num_unique++] = sorted[i];
+
+    update_ctx_t update = { .old = old, .paths = sorted, .records = records, .digests = digests, .num_reparsed = 0 };
+    if(work_pool_run(num_threads, num_unique, update_one, NULL, &update) == WORK_POOL_RESULT_ALLOC_ERR)
+    {
+        result = NES_CATALOG_RESULT_ALLOC_ERR;
+        goto end;
+    }
+
+    uint64_t strings_size = 0;
+    size_t num_invalid = 0;
+    for(i = 0; i < num_unique; i++)
+    {
+        records[i].path_offset = strings_size;
+        records[i].path_len = strlen(sorted[i]);
+        strings_size += records[i].path_len;
+        if(!(records[i].flags & NES_CATALOG_FLAG_HEADER_VALID)) num_invalid++;
+    }
+
+    nes_catalog_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NES_CATALOG_MAGIC, sizeof(NES_CATALOG_MAGIC));
+    header.version = NES_CATALOG_VERSION;
+    header.record_size = sizeof(nes_catalog_record_t);
+    header.num_records = num_unique;
+    header.records_offset = sizeof(nes_catalog_file_header_t);
+    header.strings_offset = header.records_offset + num_unique * sizeof(nes_catalog_record_t);
+    header.strings_size = strings_size;
+
+    // write next to the catalog and rename over it, so readers (including
+    // old, if it maps catalog_path) always see a complete catalog.
+    sprintf(tmp_path, "%s.tmp.XXXXXX", catalog_path);
+    int fd = mkstemp(tmp_path);
+    if(fd < 0)
+    {
+        result = NES_CATALOG_RESULT_WRITE_ERR;
+        goto end;
+    }
+    bool written = write_all(fd, &header, sizeof(header)) && write_all(fd, records, num_unique * sizeof(nes_catalog_record_t));
+    for(i = 0; written && i < num_unique; i++) written = write_all(fd, sorted[i], records[i].path_len);
+    if(fchmod(fd, 0644) || close(fd) || !written || rename(tmp_path, catalog_path))
+    {
+        unlink(tmp_path);
+        result = NES_CATALOG_RESULT_WRITE_ERR;
+        goto end;
+    }
+
+    if(stats_out)
+    {
+        stats_out->num_files = num_unique;
+        stats_out->num_reparsed = update.num_reparsed;
+        stats_out->num_invalid = num_invalid;
+    }
+
+end:
+    free(tmp_path);
+    free(records);
+    free(sorted);
+    return result;
+}
+
+static bool parse_name(const char *value, const char * const *names, size_t num_names, uint64_t *out)
+{
+    size_t i;
+    for(i = 0; i < num_names; i++)
+    {
+        if(!strcasecmp(value, names[i]))
+        {
+            *out = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_value(nes_catalog_field_t field, const char *value, uint64_t *out)
+{
+    char *end;
+    *out = strtoull(value, &end, 0);
+    if(*value && !*end) return true;
+
+    switch(field)
+    {
+    case NES_CATALOG_FIELD_TYPE:
+        if(!strcasecmp(value, "ines")) { *out = NES_HEADER_TYPE_INES; return true; }
+        if(!strcasecmp(value, "nes2")) { *out = NES_HEADER_TYPE_NES_2; return true; }
+        return parse_name(value, NES_HEADER_TYPE_STR, sizeof(NES_HEADER_TYPE_STR) / sizeof(NES_HEADER_TYPE_STR[0]), out);
+    case NES_CATALOG_FIELD_MIRRORING:
+        return parse_name(value, NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR, sizeof(NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR) / sizeof(NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR[0]), out);
+    case NES_CATALOG_FIELD_CONSOLE:
+        return parse_name(value, NES_HEADER_CONSOLE_TYPE_STR, sizeof(NES_HEADER_CONSOLE_TYPE_STR) / sizeof(NES_HEADER_CONSOLE_TYPE_STR[0]), out);
+    case NES_CATALOG_FIELD_TIMING:
+        return parse_name(value, NES_HEADER_TIMING_TYPE_STR, sizeof(NES_HEADER_TIMING_TYPE_STR) / sizeof(NES_HEADER_TIMING_TYPE_STR[0]), out);
+    case NES_CATALOG_FIELD_BATTERY:
+    case NES_CATALOG_FIELD_TRAINER:
+        if(!strcasecmp(value, "true") || !strcasecmp(value, "yes")) { *out = 1; return true; }
+        if(!strcasecmp(value, "false") || !strcasecmp(value, "no")) { *out = 0; return true; }
+        return false;
+    default:
+        return false;
+    }
+}
+
+nes_catalog_result_t nes_catalog_filter_parse(const char *expr, nes_catalog_filter_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    char *copy = strdup(expr);
+    if(!copy) return NES_CATALOG_RESULT_ALLOC_ERR;
+
+    nes_catalog_result_t result = NES_CATALOG_RESULT_SUCCESS;
+    char *save;
+    char *term;
+    for(term = strtok_r(copy, ",", &save); term; term = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(term, '=');
+        if(!eq)
+        {
+            result = NES_CATALOG_RESULT_INVALID_FILTER;
+            break;
+        }
+        *eq = '\0';
+        uint64_t field;
+        if(!parse_name(term, NES_CATALOG_FIELD_STR, NES_CATALOG_FIELD_COUNT, &field)
+            || !parse_value((nes_catalog_field_t)field, eq + 1, &out->values[field]))
+        {
+            result = NES_CATALOG_RESULT_INVALID_FILTER;
+            break;
+        }
+        out->fields_set |= 1u << field;
+    }
+    free(copy);
+    return result;
+}
+
+uint64_t nes_catalog_record_field(const nes_catalog_record_t *record, nes_catalog_field_t field)
+{
+    switch(field)
+    {
+    case NES_CATALOG_FIELD_TYPE:      return record->type;
+    case NES_CATALOG_FIELD_MAPPER:    return record->mapper_id;
+    case NES_CATALOG_FIELD_SUBMAPPER: return record->submapper_id;
+    case NES_CATALOG_FIELD_PRG:       return record->prg_rom_size;
+    case NES_CATALOG_FIELD_CHR:       return record->char_rom_size;
+    case NES_CATALOG_FIELD_MIRRORING: return record->ntmt;
+    case NES_CATALOG_FIELD_BATTERY:   return record->persistent_memory;
+    case NES_CATALOG_FIELD_TRAINER:   return record->trainer;
+    case NES_CATALOG_FIELD_CONSOLE:   return record->ct;
+    case NES_CATALOG_FIELD_TIMING:    return record->tt;
+    default:                          return 0;
+    }
+}
+
+bool nes_catalog_filter_match(const nes_catalog_filter_t *filter, const nes_catalog_record_t *record)
+{
+    if(!(record->flags & NES_CATALOG_FLAG_HEADER_VALID)) return false;
+    uint32_t field;
+    for(field = 0; field < NES_CATALOG_FIELD_COUNT; field++)
+    {
+        if((filter->fields_set & (1u << field)) && nes_catalog_record_field(record, (nes_catalog_field_t)field) != filter->values[field])
+            return false;
+    }
+    return true;
+}
+
+void nes_catalog_close(nes_catalog_t *catalog)
+{
+    if(catalog->map) munmap((void *)catalog->map, catalog->map_size);
+    memset(catalog, 0, sizeof(*catalog));
+}
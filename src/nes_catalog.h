@@ -0,0 +1,180 @@
+#ifndef NES_CATALOG_H
+#define NES_CATALOG_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "nes_header.h"
+
+// A persistent catalog of the decoded headers of a ROM library, so inventory
+// queries never have to open the ROMs themselves. The file is meant to be
+// mmapped and used in place:
+//
+//   nes_catalog_file_header_t
+//   nes_catalog_record_t[num_records]   sorted by path
+//   path string table                   not null terminated
+//
+// Each record also keeps the file's size and mtime, so an update only has to
+// re-parse files that changed since the last one. Integers are stored in host
+// byte order, so a catalog is not meant to move between hosts of different
+// endianness.
+
+static const char NES_CATALOG_MAGIC[8] = {'N', 'E', 'S', 'C', 'A', 'T', 'L', '\x1a'};
+static const uint32_t NES_CATALOG_VERSION = 1;
+
+typedef struct nes_catalog_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t num_records;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint8_t reserved[16];
+} nes_catalog_file_header_t;
+
+// record flags
+static const uint32_t NES_CATALOG_FLAG_HEADER_VALID = 0x01;  // the fields below the raw header are decoded
+static const uint32_t NES_CATALOG_FLAG_HAS_DIGESTS = 0x02;   // crc32/md5/sha1 are set
+
+typedef struct nes_catalog_record
+{
+    uint64_t path_offset;       // into the string table
+    uint32_t path_len;
+    uint32_t flags;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t parse_result;      // nes_header_result_t, or NES_CATALOG_PARSE_RESULT_* below
+
+    // decoded nes_header_t fields, flattened to fixed widths
+    uint64_t prg_rom_size;
+    uint64_t char_rom_size;
+    uint16_t mapper_id;
+    uint8_t type;               // nes_header_type_t
+    uint8_t submapper_id;
+    uint8_t ntmt;               // nes_header_nametable_mirroring_type_t
+    uint8_t ct;                 // nes_header_console_type_t
+    uint8_t tt;                 // nes_header_timing_type_t
+    uint8_t persistent_memory;
+    uint8_t trainer;
+    uint8_t console_type_info[2];
+    uint8_t misc_roms_size;
+    uint8_t default_expansion_device;
+    uint8_t reserved0[7];
+    uint16_t prg_ram_size;
+    uint16_t prg_eeprom_size;
+    uint16_t char_ram_size;
+    uint16_t char_eeprom_size;
+    uint8_t raw_header[16];
+
+    // digests of the payload after the 16-byte header, as DAT files list them
+    uint32_t crc32;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+    uint8_t reserved1[20];
+} nes_catalog_record_t;
+
+_Static_assert(sizeof(nes_catalog_file_header_t) == 64, "nes_catalog_file_header_t is part of the file format");
+_Static_assert(sizeof(nes_catalog_record_t) == 160, "nes_catalog_record_t is part of the file format");
+
+// parse results beyond the nes_header_result_t range
+static const uint32_t NES_CATALOG_PARSE_RESULT_OPEN_ERR = 0x100;
+static const uint32_t NES_CATALOG_PARSE_RESULT_TOO_SHORT = 0x101;
+
+typedef enum nes_catalog_result
+{
+    NES_CATALOG_RESULT_SUCCESS = 0,
+    NES_CATALOG_RESULT_ALLOC_ERR,
+    NES_CATALOG_RESULT_OPEN_ERR,
+    NES_CATALOG_RESULT_WRITE_ERR,
+    NES_CATALOG_RESULT_INVALID_CATALOG,
+    NES_CATALOG_RESULT_INVALID_FILTER
+} nes_catalog_result_t;
+static const char *const NES_CATALOG_RESULT_STR[] = {"success", "memory allocation failed", "could not open catalog", "error writing catalog", "not a valid catalog file", "invalid query"};
+
+typedef struct nes_catalog
+{
+    const char *map;
+    size_t map_size;
+    const nes_catalog_file_header_t *header;
+    const nes_catalog_record_t *records;
+    size_t num_records;
+    const char *strings;
+} nes_catalog_t;
+
+// maps and validates a catalog. A catalog file that does not exist yet opens
+// as an empty catalog.
+nes_catalog_result_t nes_catalog_open(const char *path, nes_catalog_t *out);
+
+// binary search by path, NULL if the path is not cataloged
+const nes_catalog_record_t *nes_catalog_find(const nes_catalog_t *catalog, const char *path);
+
+// the record's path is not null terminated, its length is record->path_len
+const char *nes_catalog_record_path(const nes_catalog_t *catalog, const nes_catalog_record_t *record);
+
+// rebuilds the nes_header_t a record was made from
+void nes_catalog_record_to_header(const nes_catalog_record_t *record, nes_header_t *out);
+
+typedef struct nes_catalog_update_stats
+{
+    size_t num_files;
+    size_t num_reparsed;
+    size_t num_invalid;
+} nes_catalog_update_stats_t;
+
+// writes a new catalog covering exactly the given paths to catalog_path,
+// replacing it atomically. Records from old (which may be the catalog at
+// catalog_path itself) are reused for files whose size and mtime did not
+// change; the rest are re-parsed on num_threads workers. If digests is set,
+// re-parsed files (and reused records without digests) are read in full to
+// compute payload digests, otherwise only their first 16 bytes are read.
+nes_catalog_result_t nes_catalog_update(
+    const char *catalog_path,
+    const nes_catalog_t *old,
+    char **paths,
+    size_t num_paths,
+    size_t num_threads,
+    bool digests,
+    nes_catalog_update_stats_t *stats_out);
+
+// a conjunction of field == value tests, e.g. parsed from
+// "mapper=4,battery=1,timing=pal"
+typedef enum nes_catalog_field
+{
+    NES_CATALOG_FIELD_TYPE = 0,
+    NES_CATALOG_FIELD_MAPPER,
+    NES_CATALOG_FIELD_SUBMAPPER,
+    NES_CATALOG_FIELD_PRG,
+    NES_CATALOG_FIELD_CHR,
+    NES_CATALOG_FIELD_MIRRORING,
+    NES_CATALOG_FIELD_BATTERY,
+    NES_CATALOG_FIELD_TRAINER,
+    NES_CATALOG_FIELD_CONSOLE,
+    NES_CATALOG_FIELD_TIMING,
+    NES_CATALOG_FIELD_COUNT
+} nes_catalog_field_t;
+static const char *const NES_CATALOG_FIELD_STR[] = {"type", "mapper", "submapper", "prg", "chr", "mirroring", "battery", "trainer", "console", "timing"};
+
+typedef struct nes_catalog_filter
+{
+    uint32_t fields_set; // bit i set means field i must equal values[i]
+    uint64_t values[NES_CATALOG_FIELD_COUNT];
+} nes_catalog_filter_t;
+
+// values are numbers, or for type/mirroring/console/timing also the names in
+// the nes_header.h string tables (case insensitive, e.g. "nes 2.0", "pal").
+// An empty expression matches every valid record.
+nes_catalog_result_t nes_catalog_filter_parse(const char *expr, nes_catalog_filter_t *out);
+
+// the value of one field of a record, as compared by filters
+uint64_t nes_catalog_record_field(const nes_catalog_record_t *record, nes_catalog_field_t field);
+
+bool nes_catalog_filter_match(const nes_catalog_filter_t *filter, const nes_catalog_record_t *record);
+
+// releases all resources that this object allocated
+void nes_catalog_close(nes_catalog_t *catalog);
+
+#endif
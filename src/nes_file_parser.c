@@ -2,9 +2,11 @@
  * nes_file_parser.c
  *
  * parses a .nes file and provides several outputs:
- * - A .json file representing the header contents
+ * - NDJSON records of the header contents, bank offsets and digests (--json)
  * - A number of .bin files representing the contents of the ROM banks
  * - A number of .chr files representing the contents of the CHAR banks
+ * - The trainer and the NES 2.0 miscellaneous ROM area, if there are any
+ * and, with --build, goes the other way: a .nes assembled from those files.
  *
  * Makes extensive use of the documentation available at https://wiki.nesdev.com
  *
@@ -12,27 +14,45 @@
  */
 
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <inttypes.h>
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <json-c/json.h>
 
-const uint64_t PARSER_VERSION[] = {0, 1, 0}; // v0.1.0
+#include "fd_copy.h"
+#include "async_writer.h"
+#include "file_list.h"
+#include "json_writer.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "nes_bank_store.h"
+#include "nes_catalog.h"
+#include "nes_header.h"
+#include "nes_header_table.h"
+#include "nes_pack.h"
+#include "nes_parser.h"
+#include "nes_rom_builder.h"
+#include "ring_buffer.h"
+#include "rom_digest.h"
+#include "work_pool.h"
+#include "zip_reader.h"
 
 const char *NES_SUFFIX = ".nes";
+const char *ZIP_SUFFIX = ".zip";
+// what batch mode picks up when it walks a directory
+const char *BATCH_INPUT_SUFFIXES[] = {".nes", ".zip", NULL};
+const char *CATALOG_INPUT_SUFFIXES[] = {".nes", NULL};
 const char *HEADER_SUFFIX = ".json";
 const char *ROM_SUFFIX = ".bin";
 const char *CHAR_SUFFIX = ".chr";
 
-const uint16_t PRG_ROM_BLOCK_SIZE = 0x4000;
-const uint16_t CHAR_ROM_BLOCK_SIZE = 0x2000;
-
-// "NES" + DOS EOF
-const char NES_MAGIC[] = {'\x4e', '\x45', '\x53', '\x1a'};
-
 typedef enum return_code
 {
     RC_SUCCESS = 0,
@@ -41,353 +61,1599 @@ typedef enum return_code
     RC_ERR_OUTFILE_OPEN_ERR = 3,
     RC_ERR_INFILE_CORRUPTED = 4,
     RC_ERR_PARSE_ERR = 5,
-    RC_ERR_BANK_SAVE_ERR = 6
+    RC_ERR_BANK_SAVE_ERR = 6,
+    RC_ERR_BATCH_FAILURES = 7,
+    RC_ERR_USAGE = 8,
+    RC_ERR_ALLOC_ERR = 9,
+    RC_ERR_BUILD_ERR = 10
 } return_code_t;
+const char *RETURN_CODE_STR[] =
+{
+    "success",
+    "Please enter a valid nes file with the .nes file extension (or a .zip holding one) that is long enough to contain an iNES header.",
+    "Error opening input file",
+    "Error opening output file",
+    "NES magic number was not found. This is not a valid .nes file or has been corrupted.",
+    "Error parsing header",
+    "Error saving ROM banks",
+    "One or more files in the batch failed",
+    "Invalid command line",
+    "Memory allocation failed",
+    "Error building ROM"
+};
 
-typedef enum ines_header_type
-{
-    IHT_INES = 1,
-    IHT_NES_2 = 2
-} ines_header_type_t;
-const char *INES_HEADER_TYPE_STR[] = {"", "iNES", "NES 2.0"};
-
-typedef enum nametable_mirroring_type
-{
-    NMT_HORIZONTAL = 0,
-    NMT_VERTICAL = 1,
-    NMT_NO_MIRRORING = 2
-} nametable_mirroring_type_t;
-const char *NAMETABLE_MIRRORING_TYPE_STR[] = {"horizontal", "vertical", "no mirroring"};
-
-typedef enum console_type
-{
-    CT_NES = 0,
-    CT_VS_SYSTEM = 1,
-    CT_PLAYCHOICE_10 = 2,
-    CT_EXTENDED = 3
-} console_type_t;
-const char *CONSOLE_TYPE_STR[] = {"NES", "Vs. System", "Playchoice-10", "extended"};
-
-typedef enum timing_type
-{
-    CT_NTSC = 0,
-    CT_PAL = 1,
-    CT_MULTI = 2,
-    CT_DENDY = 3
-} timing_type_t;
-const char *TIMING_TYPE_STR[] = {"NTSC", "PAL", "multi-region", "Dendy"};
-
-typedef struct ines_header
-{
-    uint64_t parser_version[3];
-    ines_header_type_t type;
-    uint64_t prg_rom_size;  // number of 16K PRG-ROM banks
-    uint64_t char_rom_size; // number of 8K CHR-ROM banks
-    uint16_t mapper_id;
-    nametable_mirroring_type_t ntmt;
-    bool persistent_memory;
-    bool trainer;
-    console_type_t ct;
-    struct
-    {
-        uint8_t submapper_id;
-        uint16_t prg_ram_size;     // the total PRG-RAM    size is 64 * prg_ram_size
-        uint16_t prg_eeprom_size;  // the total PRG-EEPROM size is 64 * prg_eeprom_size
-        uint16_t char_ram_size;    // the total CHR-RAM    size is 64 * char_ram_size
-        uint16_t char_eeprom_size; // the total CHR-EEPROM size is 64 * char_eeprom_size
-        timing_type_t tt;
-        union
-        {
-            struct
-            {
-                uint8_t ppu_type;
-                uint8_t hardware_type;
-            } vs_system;
-            struct
-            {
-                uint8_t type;
-            } extended_console;
-        } console_type_info;
-        uint8_t misc_roms_size;
-        uint8_t default_expansion_device;
-    } nes_2;
-} ines_header_t;
+typedef enum output_format
+{
+    OF_FILES = 0,  // one .ineshdr plus one file per bank
+    OF_PACKED = 1, // a single .nespack container, see nes_pack.h
+    OF_STORE = 2   // banks go into a shared nes_bank_store, plus a .manifest per ROM
+} output_format_t;
+
+// the manifest label and hardlink suffix of each nes_pack_region_type_t
+const char *MANIFEST_REGION_STR[] = {"header", "trainer", "prg", "chr", "misc"};
+const char *MANIFEST_LINK_SUFFIX[] = {".ineshdr", ".trainer", ".bin", ".chr", ".misc"};
 
-bool header_is_ines(char *header_buf);
-bool header_is_nes_2(char *header_buf);
+// a set of nes_pack_region_type_t, one bit (1 << type) each
+#define ALL_REGIONS ((1u << NES_PARSER_NUM_REGION_TYPES) - 1)
 
-typedef enum parse_result
+// puts the one-file-per-bank name of region after the base name, which is
+// outfile_base_name_len bytes of outfile_name
+static void region_file_name(char *outfile_name, size_t outfile_base_name_len, const nes_pack_region_t *region)
 {
-    PR_SUCCESS = 0
-} parse_result_t;
+    char *suffix = outfile_name + outfile_base_name_len;
+    if(region->type == NES_PACK_REGION_TYPE_PRG_ROM || region->type == NES_PACK_REGION_TYPE_CHR_ROM)
+        suffix += sprintf(suffix, "%" PRIu32, region->index);
+    strcpy(suffix, MANIFEST_LINK_SUFFIX[region->type]);
+}
 
-parse_result_t parse_ines_header(char *header_buf, ines_header_t *out);
-parse_result_t parse_nes_2_header(char *header_buf, ines_header_t *out);
+typedef struct parser_options
+{
+    bool batch;          // treat every remaining argument as a dir, file, or @listfile
+    size_t num_threads;  // batch worker count, 0 = one per online CPU
+    bool zero_copy;      // copy banks in the kernel (copy_file_range/sendfile) when possible
+    bool header_only;    // print the decoded header and write nothing; only the first 16 bytes are read
+    output_format_t format;
+    nes_bank_store_t *bank_store; // opened from --store=DIR for OF_STORE
+    bool store_links;             // also hardlink the usual per-bank file names to the stored objects
+    bool digests;                 // write CRC32/MD5/SHA-1 of the ROM, the headerless payload and each region
+    FILE *json_out;               // NDJSON stream from --json, one line per ROM, or NULL
+    FILE *status_out;             // status lines and errors: stdout, or stderr when the NDJSON stream is on stdout
+    size_t async_depth;           // --async-io: bank files in flight per worker in files mode, 0 to write them one by one
+    bool allow_io_uring;          // cleared by --no-io-uring, which leaves the thread writer
+    metrics_t *metrics;           // --metrics-json/--metrics-prom: totals merged from every worker, or NULL
+    uint32_t regions;             // --regions: the region types files mode writes, ALL_REGIONS by default
+} parser_options_t;
 
-int save_output(ines_header_t *header, char *infile_buf, char *outfile_base_name);
+// where save_output reads ROM bytes from: the mmap for buffered writes and the
+// descriptor behind it for kernel-side copies. Large files are mapped through
+// a window, which readers move along with src_advance.
+typedef struct infile_src
+{
+    const char *buf;
+    int fd;
+    size_t size;
+    bool zero_copy;
+    mapped_file_t *mapping; // NULL unless buf is a mapped file
+    async_writer_t *writer; // files mode with --async-io: bank files are queued here, else NULL
+    metrics_t *metrics;     // the worker's stage timings, or NULL
+    nes_parser_t *parser;   // the worker's parser context: region lists, digests and names for this ROM come out of its arena
+} infile_src_t;
 
-int main(int argc, char *argv[])
+// the digests save_digests computed, kept for the NDJSON record
+typedef struct rom_digests
+{
+    size_t num_regions;
+    rom_digest_t *regions; // one per region of the layout, in the worker's arena
+    rom_digest_t rom;
+    rom_digest_t payload;
+} rom_digests_t;
+
+int save_output(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_base_name, const parser_options_t *opts, rom_digests_t *digests_out);
+
+static void emit_json(json_writer_t *json, const parser_options_t *opts, const char *nes_rom_file, return_code_t result, const nes_header_t *header, const nes_parser_layout_t *layout, const rom_digests_t *digests);
+
+// an input that queued bank files may still be reading from: the mapping of a
+// .nes file, or an image inflated out of a .zip (then image is set)
+typedef struct held_input
+{
+    mapped_file_t map;
+    uint8_t *image;
+} held_input_t;
+
+// how many ROMs a worker's queued bank files may span. Enough typical ROMs to
+// keep the default --async-io depth busy across ROM boundaries, few enough
+// that holding on to their inputs costs little.
+#define HELD_INPUTS_MAX 16
+
+// buffers a worker reuses from one ROM to the next
+typedef struct worker_scratch
+{
+    json_writer_t json;   // the NDJSON record being formatted, if opts->json_out is set
+    uint8_t *image;       // the ROM inflated out of a .zip
+    size_t image_cap;
+    async_writer_t writer;
+    bool has_writer;      // files mode with --async-io
+    // in a batch the writer is not flushed after every ROM: the inputs its
+    // queued files read from are held here until it is, and files that fail
+    // then are counted rather than blamed on the ROM being processed
+    bool defer_flush;
+    held_input_t held[HELD_INPUTS_MAX];
+    size_t num_held;
+    size_t num_write_failures;
+    metrics_t *metrics;   // this worker's share of opts->metrics
+    nes_parser_t parser;  // reset at the start of every ROM
+} worker_scratch_t;
+
+static void worker_scratch_init(worker_scratch_t *scratch)
+{
+    json_writer_init(&scratch->json);
+    scratch->image = NULL;
+    scratch->image_cap = 0;
+    scratch->has_writer = false;
+    scratch->defer_flush = false;
+    scratch->num_held = 0;
+    scratch->num_write_failures = 0;
+    scratch->metrics = NULL;
+    nes_parser_init(&scratch->parser);
+}
+
+// waits for every queued bank file, then lets go of the inputs they were read
+// from. Returns how many files could not be written.
+static size_t worker_scratch_flush(worker_scratch_t *scratch)
+{
+    uint64_t start = scratch->metrics ? metrics_now_ns() : 0;
+    size_t num_failed = async_writer_flush(&scratch->writer);
+    if(scratch->metrics) metrics_record_since(scratch->metrics, METRICS_STAGE_FLUSH, start);
+    size_t i;
+    for(i = 0; i < scratch->num_held; i++)
+    {
+        if(scratch->held[i].image) free(scratch->held[i].image);
+        else mapped_file_close(&scratch->held[i].map);
+    }
+    scratch->num_held = 0;
+    return num_failed;
+}
+
+// everything of a ROM has been queued on the writer, reading from map or, for
+// NULL, from scratch->image. Outside a batch the files are waited for and map
+// is closed here. In a batch the input is held instead, so the queue runs on
+// into the next ROM, and the writer is only flushed once HELD_INPUTS_MAX are
+// held. Returns nonzero if files of this ROM could not be written.
+static int worker_scratch_finish_rom(worker_scratch_t *scratch, mapped_file_t *map)
+{
+    if(!scratch->defer_flush)
+    {
+        size_t num_failed = worker_scratch_flush(scratch);
+        if(map) mapped_file_close(map);
+        return num_failed ? 1 : 0;
+    }
+    // a .zip that failed before anything was inflated
+    if(!map && !scratch->image) return 0;
+    if(scratch->num_held == HELD_INPUTS_MAX) scratch->num_write_failures += worker_scratch_flush(scratch);
+    held_input_t *held = &scratch->held[scratch->num_held++];
+    if(map)
+    {
+        held->map = *map;
+        held->image = NULL;
+        return 0;
+    }
+    // the next .zip inflates into a new image
+    held->image = scratch->image;
+    scratch->image = NULL;
+    scratch->image_cap = 0;
+    return 0;
+}
+
+// sets up what the options call for beyond the plain buffers: the worker's
+// metrics and its asynchronous writer
+static return_code_t worker_scratch_start(worker_scratch_t *scratch, const parser_options_t *opts)
+{
+    if(opts->metrics)
+    {
+        scratch->metrics = malloc(sizeof(metrics_t));
+        if(!scratch->metrics) return RC_ERR_ALLOC_ERR;
+        metrics_init(scratch->metrics);
+    }
+    if(!opts->async_depth || opts->format != OF_FILES || opts->header_only) return RC_SUCCESS;
+    async_writer_result_t writer_result = async_writer_init(&scratch->writer, opts->async_depth, opts->allow_io_uring);
+    if(writer_result)
+    {
+        fprintf(stderr, "%s\n", ASYNC_WRITER_RESULT_STR[writer_result]);
+        return RC_ERR_ALLOC_ERR;
+    }
+    scratch->has_writer = true;
+    return RC_SUCCESS;
+}
+
+static void worker_scratch_clear(worker_scratch_t *scratch)
+{
+    json_writer_clear(&scratch->json);
+    if(scratch->has_writer)
+    {
+        worker_scratch_flush(scratch);
+        async_writer_close(&scratch->writer);
+    }
+    free(scratch->image);
+    free(scratch->metrics);
+    nes_parser_clear(&scratch->parser);
+    worker_scratch_init(scratch);
+}
+
+// the start of a timed stage, if the worker is collecting metrics
+static uint64_t stage_start(const infile_src_t *src)
+{
+    return src->metrics ? metrics_now_ns() : 0;
+}
+
+static void stage_end(const infile_src_t *src, metrics_stage_t stage, uint64_t start)
+{
+    if(src->metrics) metrics_record_since(src->metrics, stage, start);
+}
+
+// times one input end to end and counts its result
+static void record_input(worker_scratch_t *scratch, uint64_t start, return_code_t result)
+{
+    if(!scratch->metrics) return;
+    metrics_record_since(scratch->metrics, METRICS_STAGE_FILE, start);
+    metrics_count_result(scratch->metrics, result);
+}
+
+static return_code_t process_zip_file(const char *zip_file, const parser_options_t *opts, worker_scratch_t *scratch);
+static return_code_t process_rom_stream(int in_fd, const char *name, char *outfile_base_name, const parser_options_t *opts, worker_scratch_t *scratch);
+
+return_code_t process_rom_file(const char *nes_rom_file, const parser_options_t *opts, worker_scratch_t *scratch);
+
+// decodes a header with nes_header_parse, mapping its result onto ours: a
+// missing magic number means the file is not a ROM at all
+static return_code_t parse_header(char *header_buf, nes_header_t *out)
+{
+    nes_header_result_t result = nes_header_parse(header_buf, NES_HEADER_SIZE, out);
+    if(result == NES_HEADER_RESULT_INVALID_HEADER) return RC_ERR_INFILE_CORRUPTED;
+    return result ? RC_ERR_PARSE_ERR : RC_SUCCESS;
+}
+
+static void print_header(FILE *out, const char *nes_rom_file, const nes_header_t *header)
 {
+    // keep one file's lines together when batch workers print concurrently.
+    flockfile(out);
+    fprintf(out, "%s\n", nes_rom_file);
+    fprintf(out, "    type: %s\n", NES_HEADER_TYPE_STR[header->type]);
+    fprintf(out, "    mapper: %" PRIu16 "\n", header->mapper_id);
+    fprintf(out, "    prg_rom_size: %" PRIu64 "\n", header->prg_rom_size);
+    fprintf(out, "    char_rom_size: %" PRIu64 "\n", header->char_rom_size);
+    fprintf(out, "    nametable_mirroring: %s\n", NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR[header->ntmt]);
+    fprintf(out, "    persistent_memory: %s\n", header->persistent_memory ? "true" : "false");
+    fprintf(out, "    trainer: %s\n", header->trainer ? "true" : "false");
+    fprintf(out, "    console_type: %s\n", NES_HEADER_CONSOLE_TYPE_STR[header->ct]);
+    if(header->type == NES_HEADER_TYPE_NES_2)
+    {
+        fprintf(out, "    submapper: %" PRIu8 "\n", header->nes_2.submapper_id);
+        fprintf(out, "    prg_ram_size: %" PRIu16 "\n", header->nes_2.prg_ram_size);
+        fprintf(out, "    prg_eeprom_size: %" PRIu16 "\n", header->nes_2.prg_eeprom_size);
+        fprintf(out, "    char_ram_size: %" PRIu16 "\n", header->nes_2.char_ram_size);
+        fprintf(out, "    char_eeprom_size: %" PRIu16 "\n", header->nes_2.char_eeprom_size);
+        fprintf(out, "    timing: %s\n", NES_HEADER_TIMING_TYPE_STR[header->nes_2.tt]);
+        if(header->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+        {
+            fprintf(out, "    vs_ppu_type: %" PRIu8 "\n", header->nes_2.console_type_info.vs_system.ppu_type);
+            fprintf(out, "    vs_hardware_type: %" PRIu8 "\n", header->nes_2.console_type_info.vs_system.hardware_type);
+        }
+        else if(header->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+        {
+            fprintf(out, "    extended_console_type: %" PRIu8 "\n", header->nes_2.console_type_info.extended_console.type);
+        }
+        fprintf(out, "    misc_roms: %" PRIu8 "\n", header->nes_2.misc_roms_size);
+        fprintf(out, "    default_expansion_device: %" PRIu8 "\n", header->nes_2.default_expansion_device);
+    }
+    funlockfile(out);
+}
+
+return_code_t process_rom_file(const char *nes_rom_file, const parser_options_t *opts, worker_scratch_t *scratch)
+{
+    size_t path_len = strlen(nes_rom_file);
+    if(path_len >= strlen(ZIP_SUFFIX) && !strcmp(nes_rom_file + path_len - strlen(ZIP_SUFFIX), ZIP_SUFFIX))
+        return process_zip_file(nes_rom_file, opts, scratch);
+
+    // whatever the last ROM left in the arena goes
+    nes_parser_reset(&scratch->parser);
+    json_writer_t *json = opts->json_out ? &scratch->json : NULL;
     return_code_t result = RC_SUCCESS;
-    char *nes_rom_file = argv[argc - 1];
-    size_t basename_len = strlen(nes_rom_file) - strlen(NES_SUFFIX);
-    if(strlen(nes_rom_file) < strlen(NES_SUFFIX) || strcmp(NES_SUFFIX, nes_rom_file + basename_len))
+    char *nes_rom_file_basename = NULL;
+    nes_header_t header;
+    bool header_parsed = false;
+    nes_parser_layout_t layout;
+    bool laid_out = false;
+    infile_src_t src = { .buf = NULL, .fd = -1, .size = 0, .zero_copy = opts->zero_copy, .writer = scratch->has_writer ? &scratch->writer : NULL, .metrics = scratch->metrics, .parser = &scratch->parser };
+    rom_digests_t digests = { .num_regions = 0, .regions = NULL };
+    if(path_len < strlen(NES_SUFFIX) || strcmp(NES_SUFFIX, nes_rom_file + path_len - strlen(NES_SUFFIX)))
     {
-        printf("Please enter a valid nes file with the .nes file extension.\n");
         result = RC_ERR_INVALID_INPUT_FILETYPE;
         goto end;
     }
 
-    // setup basename buffer
-    char *nes_rom_file_basename = malloc(basename_len + 1);
-    strncpy(nes_rom_file_basename, nes_rom_file, basename_len);
-    nes_rom_file_basename[basename_len] = '\0';
-
     // begin file parsing
-    FILE *infile = fopen(nes_rom_file, "r");
-    if(!infile)
+    uint64_t start = stage_start(&src);
+    int infile_fd = open(nes_rom_file, O_RDONLY);
+    if(infile_fd < 0)
     {
-        printf("Error opening input file\n");
         result = RC_ERR_INFILE_OPEN_ERR;
         goto end;
     }
+    stage_end(&src, METRICS_STAGE_OPEN, start);
+
+    if(opts->header_only)
+    {
+        // read just the header so none of the PRG/CHR data is ever read from
+        // disk (or the network).
+        // (parse time here includes reading the 16 bytes)
+        char header_buf[16];
+        start = stage_start(&src);
+        ssize_t header_read = pread(infile_fd, header_buf, sizeof(header_buf), 0);
+        if(header_read < 0) result = RC_ERR_INFILE_OPEN_ERR;
+        else if(header_read < (ssize_t)sizeof(header_buf)) result = RC_ERR_INVALID_INPUT_FILETYPE;
+        else if(!(result = parse_header(header_buf, &header)))
+        {
+            stage_end(&src, METRICS_STAGE_PARSE, start);
+            header_parsed = true;
+            // with --json the NDJSON stream replaces the text dump
+            if(!json) print_header(stdout, nes_rom_file, &header);
+        }
+        goto close_infile;
+    }
+
+    // the base of the output names, with room for their suffixes
+    if(!(nes_rom_file_basename = nes_parser_base_name(&scratch->parser, nes_rom_file, NES_SUFFIX, 128)))
+    {
+        result = RC_ERR_ALLOC_ERR;
+        goto close_infile;
+    }
 
     // establish mmap to make reading more convenient
-    fseek(infile, 0, SEEK_END);
-    size_t infile_size = ftell(infile); // TODO handle a too small file given by user
+    start = stage_start(&src);
+    struct stat infile_stat;
+    if(fstat(infile_fd, &infile_stat))
+    {
+        result = RC_ERR_INFILE_OPEN_ERR;
+        goto close_infile;
+    }
+    size_t infile_size = infile_stat.st_size;
     if(infile_size < 16)
     {
-        printf("Given file is too short to contain an iNES header!\n");
         result = RC_ERR_INVALID_INPUT_FILETYPE;
         goto close_infile;
     }
-    rewind(infile);
-    // do not allow changing infile_mmap pointer, as it is used to close the 
-    // mmap at the end of the program.
-    const char *infile_mmap = mmap(NULL, infile_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fileno(infile), 0);
-    if(infile_mmap == MAP_FAILED)
+    // ordinary ROMs are read in whole up front; NES 2.0 images that declare
+    // huge ROM areas are read through a window so they are never all resident.
+    // When only some regions are wanted, the rest is never read at all.
+    mapped_file_t infile_map;
+    bool partial = opts->format == OF_FILES && opts->regions != ALL_REGIONS && !opts->digests;
+    if(partial ? mapped_file_open_on_demand(infile_fd, infile_size, &infile_map)
+        : mapped_file_open(infile_fd, infile_size, MAPPED_FILE_LARGE_THRESHOLD, MAPPED_FILE_WINDOW_SIZE, &infile_map))
     {
-        printf("Error setting infile mmap\n");
         result = RC_ERR_INFILE_OPEN_ERR;
         goto close_infile;
     }
+    src.buf = infile_map.buf;
+    src.fd = infile_fd;
+    src.size = infile_size;
+    src.mapping = &infile_map;
+    stage_end(&src, METRICS_STAGE_MAP, start);
+    if(src.metrics) src.metrics->bytes_in += infile_size;
+
+    start = stage_start(&src);
+    if((result = parse_header((char *)infile_map.buf, &header))) goto close_infile_mmap;
+    header_parsed = true;
+    // a file too short for what its header declares cannot be saved
+    if(nes_parser_layout(&scratch->parser, &header, infile_size, &layout))
+    {
+        result = RC_ERR_BANK_SAVE_ERR;
+        goto close_infile_mmap;
+    }
+    laid_out = true;
+    stage_end(&src, METRICS_STAGE_PARSE, start);
+
+    if(save_output(&layout, &src, nes_rom_file_basename, opts, json ? &digests : NULL)) result = RC_ERR_BANK_SAVE_ERR;
+    // queued bank files read from the mapping, which this takes over
+    if(src.writer)
+    {
+        if(worker_scratch_finish_rom(scratch, &infile_map) && !result) result = RC_ERR_BANK_SAVE_ERR;
+        goto close_infile;
+    }
+
+close_infile_mmap:
+    mapped_file_close(&infile_map);
+close_infile:
+    close(infile_fd);
+end:
+    if(json) emit_json(json, opts, nes_rom_file, result, header_parsed ? &header : NULL, laid_out ? &layout : NULL, &digests);
+    return result;
+}
+
+typedef struct batch_ctx
+{
+    const parser_options_t *opts;
+    file_list_t *files;
+    worker_scratch_t *scratch;   // one per worker
+    size_t num_failed; // only touched with __atomic builtins
+} batch_ctx_t;
+
+static void batch_process_one(void *ctx, size_t worker_id, size_t item)
+{
+    batch_ctx_t *batch = ctx;
+    const char *path = batch->files->paths[item];
+    worker_scratch_t *scratch = &batch->scratch[worker_id];
+    uint64_t start = scratch->metrics ? metrics_now_ns() : 0;
+    return_code_t result = process_rom_file(path, batch->opts, scratch);
+    record_input(scratch, start, result);
+    if(result) __atomic_add_fetch(&batch->num_failed, 1, __ATOMIC_RELAXED);
+    // one fprintf per file keeps lines whole even with many workers writing.
+    fprintf(batch->opts->status_out, "%d\t%s\t%s\n", result, RETURN_CODE_STR[result], path);
+}
+
+// the bank files a worker still has queued are waited for on its own thread:
+// io_uring requests do not outlive the thread that submitted them
+static void batch_worker_done(void *ctx, size_t worker_id)
+{
+    batch_ctx_t *batch = ctx;
+    worker_scratch_t *scratch = &batch->scratch[worker_id];
+    if(scratch->has_writer) scratch->num_write_failures += worker_scratch_flush(scratch);
+}
+
+static size_t resolve_num_threads(const parser_options_t *opts)
+{
+    if(opts->num_threads) return opts->num_threads;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
 
-    // discover header type
-    // The order of these checks is important because every valid nes_2 header 
-    // is also a valid ines header.
-    ines_header_t header;
-    parse_result_t parse_result;
-    if(header_is_nes_2(infile_mmap))
+// gathers the ROM paths named by the batch inputs, reporting inputs that
+// could not be read. Returns false if any could not.
+static bool collect_inputs(char **inputs, size_t num_inputs, const char *const *suffixes, file_list_t *files)
+{
+    bool ok = true;
+    size_t i;
+    for(i = 0; i < num_inputs; i++)
     {
-        if(parse_result = parse_nes_2_header(infile_mmap, &header))
+        file_list_result_t flr = file_list_add(files, inputs[i], suffixes);
+        if(flr)
         {
-            printf("Error parsing NES 2.0 header: %d\n", parse_result);
-            result = RC_ERR_PARSE_ERR;
-            goto close_infile_mmap;
+            fprintf(stderr, "%s: %s\n", inputs[i], FILE_LIST_RESULT_STR[flr]);
+            ok = false;
         }
     }
-    else if(header_is_ines(infile_mmap))
+    return ok;
+}
+
+// prints one "<code>\t<status>\t<path>" line per file as it completes, then a
+// summary on stderr.
+static return_code_t run_batch(char **inputs, size_t num_inputs, const parser_options_t *opts)
+{
+    return_code_t result = RC_SUCCESS;
+    file_list_t files;
+    file_list_init(&files);
+    if(!collect_inputs(inputs, num_inputs, BATCH_INPUT_SUFFIXES, &files)) result = RC_ERR_BATCH_FAILURES;
+
+    size_t num_threads = resolve_num_threads(opts);
+    batch_ctx_t batch = { .opts = opts, .files = &files, .scratch = malloc(num_threads * sizeof(worker_scratch_t)), .num_failed = 0 };
+    if(!batch.scratch)
+    {
+        fprintf(stderr, "%s\n", RETURN_CODE_STR[RC_ERR_ALLOC_ERR]);
+        file_list_clear(&files);
+        return RC_ERR_ALLOC_ERR;
+    }
+    size_t i;
+    for(i = 0; i < num_threads; i++) worker_scratch_init(&batch.scratch[i]);
+    for(i = 0; i < num_threads; i++)
+    {
+        if(worker_scratch_start(&batch.scratch[i], opts))
+        {
+            result = RC_ERR_ALLOC_ERR;
+            goto clear_scratch;
+        }
+        batch.scratch[i].defer_flush = true;
+    }
+    work_pool_result_t wpr = work_pool_run(num_threads, files.len, batch_process_one, batch_worker_done, &batch);
+    if(wpr) fprintf(stderr, "%s\n", WORK_POOL_RESULT_STR[wpr]);
+    // bank files that failed after their ROM was reported fail the batch
+    size_t num_write_failures = 0;
+    for(i = 0; i < num_threads; i++) num_write_failures += batch.scratch[i].num_write_failures;
+    if(num_write_failures) fprintf(stderr, "%zu bank files could not be written\n", num_write_failures);
+    fprintf(stderr, "%zu files processed, %zu failed\n", files.len, batch.num_failed);
+    if(batch.num_failed || num_write_failures || wpr == WORK_POOL_RESULT_ALLOC_ERR) result = RC_ERR_BATCH_FAILURES;
+
+clear_scratch:
+    for(i = 0; i < num_threads; i++)
+    {
+        if(batch.scratch[i].metrics) metrics_merge(opts->metrics, batch.scratch[i].metrics);
+        worker_scratch_clear(&batch.scratch[i]);
+    }
+    free(batch.scratch);
+    file_list_clear(&files);
+    return result;
+}
+
+// brings the catalog at catalog_path in line with the ROMs named by the
+// inputs, re-parsing only files whose size or mtime changed.
+static return_code_t run_catalog_update(const char *catalog_path, char **inputs, size_t num_inputs, const parser_options_t *opts)
+{
+    return_code_t result = RC_SUCCESS;
+    file_list_t files;
+    file_list_init(&files);
+    if(!collect_inputs(inputs, num_inputs, CATALOG_INPUT_SUFFIXES, &files)) result = RC_ERR_BATCH_FAILURES;
+
+    nes_catalog_t old;
+    nes_catalog_result_t catalog_result = nes_catalog_open(catalog_path, &old);
+    if(catalog_result)
+    {
+        // an unreadable catalog is rebuilt from scratch
+        fprintf(stderr, "%s: %s, rebuilding\n", catalog_path, NES_CATALOG_RESULT_STR[catalog_result]);
+    }
+
+    nes_catalog_update_stats_t stats;
+    catalog_result = nes_catalog_update(catalog_path, &old, files.paths, files.len, resolve_num_threads(opts), opts->digests, &stats);
+    if(catalog_result)
+    {
+        fprintf(stderr, "%s: %s\n", catalog_path, NES_CATALOG_RESULT_STR[catalog_result]);
+        result = RC_ERR_OUTFILE_OPEN_ERR;
+    }
+    else fprintf(stderr, "%zu files cataloged, %zu re-parsed, %zu without a valid header\n", stats.num_files, stats.num_reparsed, stats.num_invalid);
+
+    nes_catalog_close(&old);
+    file_list_clear(&files);
+    return result;
+}
+
+// prints the path of every cataloged ROM that matches the query, or with
+// group_by set, how many matching ROMs have each value of that field
+static return_code_t run_catalog_query(const char *catalog_path, const char *query, const char *group_by)
+{
+    nes_catalog_filter_t filter;
+    nes_catalog_result_t catalog_result = nes_catalog_filter_parse(query, &filter);
+    if(catalog_result)
+    {
+        fprintf(stderr, "%s: %s\n", query, NES_CATALOG_RESULT_STR[catalog_result]);
+        return RC_ERR_USAGE;
+    }
+    nes_catalog_field_t group_field = NES_CATALOG_FIELD_COUNT;
+    if(group_by)
     {
-        if(parse_result = parse_ines_header(infile_mmap, &header))
+        for(group_field = 0; group_field < NES_CATALOG_FIELD_COUNT; group_field++)
+            if(!strcasecmp(group_by, NES_CATALOG_FIELD_STR[group_field])) break;
+        if(group_field == NES_CATALOG_FIELD_COUNT)
         {
-            printf("Error parsing iNES header: %d\n", parse_result);
-            result = RC_ERR_PARSE_ERR;
-            goto close_infile_mmap;
+            fprintf(stderr, "%s: %s\n", group_by, NES_CATALOG_RESULT_STR[NES_CATALOG_RESULT_INVALID_FILTER]);
+            return RC_ERR_USAGE;
         }
     }
+    nes_catalog_t catalog;
+    catalog_result = nes_catalog_open(catalog_path, &catalog);
+    if(catalog_result)
+    {
+        fprintf(stderr, "%s: %s\n", catalog_path, NES_CATALOG_RESULT_STR[catalog_result]);
+        return RC_ERR_INFILE_OPEN_ERR;
+    }
+
+    return_code_t result = RC_SUCCESS;
+    nes_header_table_t table;
+    nes_header_table_init(&table);
+    uint64_t *selection = NULL;
+    nes_header_table_group_t *groups = NULL;
+    size_t num_groups = 0;
+    if(nes_header_table_append_catalog(&table, &catalog)) goto alloc_err;
+    selection = malloc((nes_header_table_selection_words(&table) + 1) * sizeof(uint64_t));
+    if(!selection) goto alloc_err;
+
+    nes_header_table_predicate_t predicates[NES_CATALOG_FIELD_COUNT + 1];
+    size_t num_predicates = nes_header_table_predicates_from_filter(&filter, predicates);
+    nes_header_table_filter(&table, predicates, num_predicates, selection);
+
+    if(group_by)
+    {
+        if(nes_header_table_group_count(&table, selection, group_field, &groups, &num_groups)) goto alloc_err;
+        size_t i;
+        for(i = 0; i < num_groups; i++) printf("%" PRIu64 "\t%zu\n", groups[i].value, groups[i].count);
+    }
     else
     {
-        printf("NES magic number was not found. This is not a valid .nes file or has been corrupted.\n");
-        result = RC_ERR_INFILE_CORRUPTED;
-        goto close_infile_mmap;
+        size_t w;
+        for(w = 0; w < nes_header_table_selection_words(&table); w++)
+        {
+            uint64_t bits = selection[w];
+            while(bits)
+            {
+                const nes_catalog_record_t *record = &catalog.records[w * 64 + __builtin_ctzll(bits)];
+                bits &= bits - 1;
+                printf("%.*s\n", (int)record->path_len, nes_catalog_record_path(&catalog, record));
+            }
+        }
     }
+    goto cleanup;
 
-    if(save_output(&header, infile_mmap, nes_rom_file_basename)) result = RC_ERR_BANK_SAVE_ERR;
+alloc_err:
+    fprintf(stderr, "%s: %s\n", catalog_path, NES_HEADER_TABLE_RESULT_STR[NES_HEADER_TABLE_RESULT_ALLOC_ERR]);
+    result = RC_ERR_ALLOC_ERR;
+cleanup:
+    free(groups);
+    free(selection);
+    nes_header_table_clear(&table);
+    nes_catalog_close(&catalog);
+    return result;
+}
 
-close_infile_mmap:
-    munmap(infile_mmap, infile_size);
-close_infile:
-    fclose(infile);
-end:
-    free(nes_rom_file_basename);
+// --build: the reverse of files mode. Reassembles the ROM that base.ineshdr,
+// base0.bin, ..., base0.chr, ..., base.trainer and base.misc were extracted
+// from, possibly patched since, into out_path.
+static return_code_t run_build(const char *out_path, const char *base, const parser_options_t *opts)
+{
+    return_code_t result = RC_SUCCESS;
+    nes_parser_t parser;
+    nes_parser_init(&parser);
+    char *name = nes_parser_base_name(&parser, base, "", 128);
+    if(!name)
+    {
+        result = RC_ERR_ALLOC_ERR;
+        goto clear_parser;
+    }
+    size_t base_len = strlen(name);
+
+    char header_buf[16];
+    strcpy(name + base_len, MANIFEST_LINK_SUFFIX[NES_PACK_REGION_TYPE_HEADER]);
+    int header_fd = open(name, O_RDONLY);
+    if(header_fd < 0)
+    {
+        result = RC_ERR_INFILE_OPEN_ERR;
+        goto clear_parser;
+    }
+    ssize_t header_read = read(header_fd, header_buf, sizeof(header_buf));
+    close(header_fd);
+    nes_header_t header;
+    if(header_read != (ssize_t)sizeof(header_buf)) result = RC_ERR_INVALID_INPUT_FILETYPE;
+    else result = parse_header(header_buf, &header);
+    if(result) goto clear_parser;
+
+    // the file names files mode gives every region but the header, in
+    // layout order
+    nes_parser_layout_t layout;
+    if(nes_parser_layout(&parser, &header, UINT64_MAX, &layout))
+    {
+        result = RC_ERR_BUILD_ERR;
+        goto clear_parser;
+    }
+    const char **paths = nes_parser_alloc(&parser, layout.num_regions * sizeof(const char *));
+    if(!paths)
+    {
+        result = RC_ERR_ALLOC_ERR;
+        goto clear_parser;
+    }
+    size_t i;
+    for(i = 1; i < layout.num_regions; i++)
+    {
+        region_file_name(name, base_len, &layout.regions[i]);
+        if(!(paths[i] = nes_parser_base_name(&parser, name, "", 0)))
+        {
+            result = RC_ERR_ALLOC_ERR;
+            goto clear_parser;
+        }
+    }
+    const nes_pack_region_t *trainer = nes_parser_layout_region(&layout, NES_PACK_REGION_TYPE_TRAINER, 0);
+    const nes_pack_region_t *misc = nes_parser_layout_region(&layout, NES_PACK_REGION_TYPE_MISC_ROM, 0);
+    nes_rom_builder_input_t input =
+    {
+        .trainer = trainer ? paths[trainer - layout.regions] : NULL,
+        .prg = paths + layout.first[NES_PACK_REGION_TYPE_PRG_ROM],
+        .chr = paths + layout.first[NES_PACK_REGION_TYPE_CHR_ROM],
+        // a ROM whose misc ROM area was empty has no .misc
+        .misc = misc && !access(paths[misc - layout.regions], F_OK) ? paths[misc - layout.regions] : NULL
+    };
+
+    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out_fd < 0)
+    {
+        result = RC_ERR_OUTFILE_OPEN_ERR;
+        goto clear_parser;
+    }
+    // a half-written ROM is removed, unless the output is e.g. a pipe
+    struct stat out_stat;
+    bool regular = !fstat(out_fd, &out_stat) && S_ISREG(out_stat.st_mode);
+    // the header goes back as extracted, so an unpatched ROM round-trips byte
+    // for byte
+    nes_rom_builder_result_t build_result = nes_rom_builder_write_raw(&parser, header_buf, &input, out_fd, opts->zero_copy);
+    if(close(out_fd) && !build_result) build_result = NES_ROM_BUILDER_RESULT_WRITE_ERR;
+    if(build_result)
+    {
+        printf("%s: %s\n", out_path, NES_ROM_BUILDER_RESULT_STR[build_result]);
+        if(regular) unlink(out_path);
+        result = RC_ERR_BUILD_ERR;
+    }
+
+clear_parser:
+    nes_parser_clear(&parser);
     return result;
 }
 
-// the following functions use the tests recommended at:
-// https://wiki.nesdev.com/w/index.php/NES_2.0#Identification
-bool header_is_ines(char *header_buf)
+// --stream: reads the ROM from stdin ("-") or from a path that is opened and
+// read front to back, such as a FIFO. Outputs are named after out_base, or
+// after the input like any other ROM.
+static return_code_t run_stream(const char *input, const char *out_base, const parser_options_t *opts, worker_scratch_t *scratch)
 {
-    return !strncmp(NES_MAGIC, header_buf, sizeof(NES_MAGIC));
+    bool is_stdin = !strcmp(input, "-");
+    nes_parser_reset(&scratch->parser);
+    // out_base is used as given, an input path loses its .nes
+    char *outfile_base_name = nes_parser_base_name(&scratch->parser, out_base ? out_base : input, out_base ? "" : NES_SUFFIX, 128);
+    if(!outfile_base_name) return RC_ERR_ALLOC_ERR;
+
+    return_code_t result = RC_ERR_INFILE_OPEN_ERR;
+    int in_fd = is_stdin ? STDIN_FILENO : open(input, O_RDONLY);
+    if(in_fd >= 0)
+    {
+        result = process_rom_stream(in_fd, input, outfile_base_name, opts, scratch);
+        if(!is_stdin) close(in_fd);
+    }
+    return result;
 }
 
-bool header_is_nes_2(char *header_buf)
+// parses --regions, a comma-separated list of MANIFEST_REGION_STR names
+static bool parse_regions(const char *list, uint32_t *out)
 {
-    char header_type_indicator = header_buf[7] & 0x0c;
-    return header_is_ines(header_buf) && (header_type_indicator == 0x08);
+    *out = 0;
+    while(*list)
+    {
+        size_t len = strcspn(list, ",");
+        uint32_t type;
+        for(type = 0; type < NES_PARSER_NUM_REGION_TYPES; type++)
+            if(strlen(MANIFEST_REGION_STR[type]) == len && !strncmp(list, MANIFEST_REGION_STR[type], len)) break;
+        if(type == NES_PARSER_NUM_REGION_TYPES) return false;
+        *out |= 1u << type;
+        list += len;
+        if(*list) list++;
+    }
+    return *out != 0;
 }
 
-// the following function uses documentation available at:
-// https://wiki.nesdev.com/w/index.php/INES
-parse_result_t parse_ines_header(char *header_buf, ines_header_t *out)
+static void print_usage(const char *prog)
 {
-    memcpy(&(out->parser_version), PARSER_VERSION, sizeof(PARSER_VERSION));
-    out->type = IHT_INES;
-    out->prg_rom_size = *((uint8_t *)(header_buf + 4));
-    out->char_rom_size = *((uint8_t *)(header_buf + 5));
-    uint8_t byte6 = *((uint8_t *)(header_buf + 6));
-    uint8_t byte7 = *((uint8_t *)(header_buf + 7));
-    out->mapper_id = ((byte6 & 0xf0) >> 4) | (byte7 & 0xf0);
-    if(byte6 & 0x08) out->ntmt = NMT_NO_MIRRORING;
-    else if(byte6 & 0x01) out->ntmt = NMT_VERTICAL;
-    else out->ntmt = NMT_HORIZONTAL;
-    out->persistent_memory = byte6 & 0x02;
-    out->trainer = byte6 & 0x04;
-    out->ct = (console_type_t)(byte7 & 0x03);
-    return PR_SUCCESS;
+    printf("usage: %s [options] <file.nes | file.zip>\n", prog);
+    printf("       %s --batch [--threads=N] [options] <dir | file.nes | file.zip | @listfile>...\n", prog);
+    printf("       %s --stream [--out-base=BASE] [options] <- | file>\n", prog);
+    printf("       %s --build=OUT.nes [--no-zero-copy] BASE\n", prog);
+    printf("       %s --catalog-update=CATALOG [--threads=N] [--digests] <dir | file.nes | @listfile>...\n", prog);
+    printf("       %s --catalog-query=CATALOG [--group-by=FIELD] <field=value[,field=value...]>\n", prog);
+    printf("options:\n");
+    printf("    --header-only            print the decoded header, write nothing\n");
+    printf("    --format=files|packed|store\n");
+    printf("                             one file per bank (default), one .nespack per ROM, or\n");
+    printf("                             deduplicated banks in --store plus one .manifest per ROM\n");
+    printf("    --regions=LIST           files format: write only these of header, trainer, prg,\n");
+    printf("                             chr and misc (default all); the rest is not read\n");
+    printf("    --store=DIR              content-addressed bank store for --format=store\n");
+    printf("    --store-links            with --format=store, also hardlink per-bank file names\n");
+    printf("    --digests                also write CRC32/MD5/SHA-1 digests to <basename>.digests\n");
+    printf("    --no-zero-copy           always copy bank data through user space\n");
+    printf("    --async-io[=DEPTH]       files format: keep up to DEPTH (default %zu) bank files\n", ASYNC_WRITER_DEFAULT_DEPTH);
+    printf("                             per worker in flight, through io_uring or writer threads;\n");
+    printf("                             in a batch across ROMs, with files that fail late counted\n");
+    printf("                             in the summary; not with --stream\n");
+    printf("    --no-io-uring            with --async-io, always use writer threads\n");
+    printf("    --metrics-json=FILE      write per-stage timings (p50/p90/p99), byte and error\n");
+    printf("                             counts for the run to FILE as JSON\n");
+    printf("    --metrics-prom=FILE      the same in Prometheus text format, as histograms\n");
+    printf("    --json=FILE              append one NDJSON line per ROM (header, regions, digests)\n");
+    printf("                             to FILE, - for stdout\n");
+    printf("    --stream                 read the ROM front to back through a fixed-size buffer,\n");
+    printf("                             from stdin (-, needs --out-base) or e.g. a FIFO; files\n");
+    printf("                             format only\n");
+    printf("    --out-base=BASE          with --stream, name outputs BASE.ineshdr, BASE0.bin, ...\n");
+    printf("    --group-by=FIELD         with --catalog-query, count matches per value of FIELD\n");
 }
 
-static uint16_t handle_shift(uint8_t shift)
+int main(int argc, char *argv[])
 {
-    if(!shift)
+    parser_options_t opts = { .batch = false, .num_threads = 0, .zero_copy = true, .header_only = false, .format = OF_FILES, .bank_store = NULL, .store_links = false, .digests = false, .json_out = NULL, .status_out = stdout, .async_depth = 0, .allow_io_uring = true, .regions = ALL_REGIONS };
+    const char *store_root = NULL;
+    const char *json_path = NULL;
+    bool stream = false;
+    const char *out_base = NULL;
+    const char *catalog_update_path = NULL;
+    const char *build_path = NULL;
+    const char *catalog_query_path = NULL;
+    const char *group_by = NULL;
+    const char *metrics_json_path = NULL;
+    const char *metrics_prom_path = NULL;
+    metrics_result_t metrics_result;
+    int argi;
+    for(argi = 1; argi < argc && !strncmp(argv[argi], "--", 2); argi++)
     {
-        return 0;
+        if(!strcmp(argv[argi], "--batch")) opts.batch = true;
+        else if(!strncmp(argv[argi], "--threads=", 10)) opts.num_threads = strtoul(argv[argi] + 10, NULL, 10);
+        else if(!strcmp(argv[argi], "--no-zero-copy")) opts.zero_copy = false;
+        else if(!strcmp(argv[argi], "--async-io")) opts.async_depth = ASYNC_WRITER_DEFAULT_DEPTH;
+        else if(!strncmp(argv[argi], "--async-io=", 11)) opts.async_depth = strtoul(argv[argi] + 11, NULL, 10);
+        else if(!strcmp(argv[argi], "--no-io-uring")) opts.allow_io_uring = false;
+        else if(!strncmp(argv[argi], "--metrics-json=", 15)) metrics_json_path = argv[argi] + 15;
+        else if(!strncmp(argv[argi], "--metrics-prom=", 15)) metrics_prom_path = argv[argi] + 15;
+        else if(!strcmp(argv[argi], "--header-only")) opts.header_only = true;
+        else if(!strcmp(argv[argi], "--format=files")) opts.format = OF_FILES;
+        else if(!strcmp(argv[argi], "--format=packed")) opts.format = OF_PACKED;
+        else if(!strcmp(argv[argi], "--format=store")) opts.format = OF_STORE;
+        else if(!strncmp(argv[argi], "--regions=", 10))
+        {
+            if(!parse_regions(argv[argi] + 10, &opts.regions))
+            {
+                print_usage(argv[0]);
+                return RC_ERR_USAGE;
+            }
+        }
+        else if(!strncmp(argv[argi], "--store=", 8)) store_root = argv[argi] + 8;
+        else if(!strcmp(argv[argi], "--store-links")) opts.store_links = true;
+        else if(!strcmp(argv[argi], "--digests")) opts.digests = true;
+        else if(!strncmp(argv[argi], "--json=", 7)) json_path = argv[argi] + 7;
+        else if(!strcmp(argv[argi], "--stream")) stream = true;
+        else if(!strncmp(argv[argi], "--out-base=", 11)) out_base = argv[argi] + 11;
+        else if(!strncmp(argv[argi], "--build=", 8)) build_path = argv[argi] + 8;
+        else if(!strncmp(argv[argi], "--catalog-update=", 17)) catalog_update_path = argv[argi] + 17;
+        else if(!strncmp(argv[argi], "--catalog-query=", 16)) catalog_query_path = argv[argi] + 16;
+        else if(!strncmp(argv[argi], "--group-by=", 11)) group_by = argv[argi] + 11;
+        else
+        {
+            print_usage(argv[0]);
+            return RC_ERR_USAGE;
+        }
+    }
+    // a stream is read once, front to back, so only outputs that can be
+    // written in that order are available
+    bool stream_usage_err = stream && (opts.batch || opts.format != OF_FILES || opts.async_depth || (!strcmp(argv[argc - 1], "-") && !out_base));
+    if(argi == argc || (opts.format == OF_STORE && !store_root) || stream_usage_err)
+    {
+        print_usage(argv[0]);
+        return RC_ERR_USAGE;
+    }
+
+    if(build_path) return run_build(build_path, argv[argc - 1], &opts);
+    if(catalog_update_path) return run_catalog_update(catalog_update_path, argv + argi, argc - argi, &opts);
+    if(catalog_query_path) return run_catalog_query(catalog_query_path, argv[argc - 1], group_by);
+
+    nes_bank_store_t bank_store;
+    if(opts.format == OF_STORE)
+    {
+        nes_bank_store_result_t store_result = nes_bank_store_open(store_root, &bank_store);
+        if(store_result)
+        {
+            printf("%s: %s\n", store_root, NES_BANK_STORE_RESULT_STR[store_result]);
+            return RC_ERR_OUTFILE_OPEN_ERR;
+        }
+        opts.bank_store = &bank_store;
     }
+
+    return_code_t result;
+    if(metrics_json_path || metrics_prom_path)
+    {
+        opts.metrics = malloc(sizeof(metrics_t));
+        if(!opts.metrics)
+        {
+            printf("%s\n", RETURN_CODE_STR[RC_ERR_ALLOC_ERR]);
+            result = RC_ERR_ALLOC_ERR;
+            goto close_store;
+        }
+        metrics_init(opts.metrics);
+    }
+    if(json_path)
+    {
+        opts.json_out = strcmp(json_path, "-") ? fopen(json_path, "a") : stdout;
+        if(!opts.json_out)
+        {
+            printf("%s: %s\n", json_path, RETURN_CODE_STR[RC_ERR_OUTFILE_OPEN_ERR]);
+            result = RC_ERR_OUTFILE_OPEN_ERR;
+            goto close_store;
+        }
+        // records are written whole, a big buffer turns them into few writes
+        setvbuf(opts.json_out, NULL, _IOFBF, 1 << 20);
+        // keep the stream pure NDJSON
+        if(opts.json_out == stdout) opts.status_out = stderr;
+    }
+
+    if(opts.batch) result = run_batch(argv + argi, argc - argi, &opts);
+    else
+    {
+        worker_scratch_t scratch;
+        worker_scratch_init(&scratch);
+        uint64_t start = opts.metrics ? metrics_now_ns() : 0;
+        if(!(result = worker_scratch_start(&scratch, &opts)))
+        {
+            if(stream) result = run_stream(argv[argc - 1], out_base, &opts, &scratch);
+            else result = process_rom_file(argv[argc - 1], &opts, &scratch);
+            record_input(&scratch, start, result);
+        }
+        if(scratch.metrics) metrics_merge(opts.metrics, scratch.metrics);
+        worker_scratch_clear(&scratch);
+        if(result) fprintf(opts.status_out, "%s\n", RETURN_CODE_STR[result]);
+    }
+
+    if(metrics_json_path && (metrics_result = metrics_write_json(opts.metrics, metrics_json_path, RETURN_CODE_STR, sizeof(RETURN_CODE_STR) / sizeof(RETURN_CODE_STR[0]))))
+        fprintf(opts.status_out, "%s: %s\n", metrics_json_path, METRICS_RESULT_STR[metrics_result]);
+    if(metrics_prom_path && (metrics_result = metrics_write_prometheus(opts.metrics, metrics_prom_path)))
+        fprintf(opts.status_out, "%s: %s\n", metrics_prom_path, METRICS_RESULT_STR[metrics_result]);
+
+    if(opts.json_out && fclose(opts.json_out) && !result)
+    {
+        fprintf(opts.status_out, "%s: %s\n", json_path, RETURN_CODE_STR[RC_ERR_OUTFILE_OPEN_ERR]);
+        result = RC_ERR_OUTFILE_OPEN_ERR;
+    }
+close_store:
+    if(opts.bank_store) nes_bank_store_close(opts.bank_store);
+    free(opts.metrics);
+    return result;
+}
+
+// tells a windowed mapping that [offset, offset + len) is about to be read
+static void src_advance(const infile_src_t *src, uint64_t offset, uint64_t len)
+{
+    if(src->mapping) mapped_file_advance(src->mapping, offset, len);
+}
+
+// writes len bytes starting at offset of the input file to a new file
+static int save_region(const infile_src_t *src, size_t offset, size_t len, char *outfile_name)
+{
+    uint64_t start = stage_start(src);
+    src_advance(src, offset, len);
+    int result = 1;
+    // with --async-io this only queues the file, flushing waits for it
+    if(src->writer) result = async_writer_write_file(src->writer, outfile_name, src->buf + offset, len) ? 1 : 0;
     else
     {
-        return 1 << (shift - 1);
+        int outfile_fd = open(outfile_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(outfile_fd >= 0)
+        {
+            fd_copy_result_t copy_result = fd_copy(src->fd, (off_t)offset, outfile_fd, len, src->buf + offset, src->zero_copy);
+            result = close(outfile_fd) || copy_result ? 1 : 0;
+        }
     }
+    stage_end(src, METRICS_STAGE_WRITE, start);
+    if(src->metrics && !result) src->metrics->bytes_out += len;
+    return result;
+}
+
+// whether files mode writes region out
+static bool region_wanted(const parser_options_t *opts, const nes_pack_region_t *region)
+{
+    return opts->regions & (1u << region->type);
 }
 
-// If the highest nibble is $f, exponent-multiplier notation is used. See:
-// https://wiki.nesdev.com/w/index.php/NES_2.0#PRG-ROM_Area
-// note that the highest possible value of the exponent is 63, so there is 
-// a chance that, with a value of 63 and a multiplier > 1, we will overflow.
-// Not sure how to handle that without using a bignum library, but it seems 
-// unlikely to overflow in practice.
-// In fact, the mmap will fail before this overflows because of the large file 
-// size.
-static uint64_t handle_rom_size_encoding(uint64_t input_rom_size)
+// writes every wanted region to a file of its own: <basename>.ineshdr,
+// <basename>N.bin, <basename>N.chr, <basename>.trainer and <basename>.misc.
+// The others are not read.
+static int save_files(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_name, const parser_options_t *opts)
 {
-    uint16_t irs_u16 = (uint16_t)input_rom_size;
-    if(irs_u16 & 0x0f00 == 0x0f00)
+    size_t outfile_base_name_len = strlen(outfile_name);
+    size_t i;
+    for(i = 0; i < layout->num_regions; i++)
     {
-        uint8_t exponent = (irs_u16 & 0x00fc) >> 2;
-        uint8_t multiplier = irs_u16 & 0x0003;
-        return (1 << exponent) * (multiplier * 2 + 1);
+        const nes_pack_region_t *region = &layout->regions[i];
+        if(!region_wanted(opts, region)) continue;
+        region_file_name(outfile_name, outfile_base_name_len, region);
+        int result = save_region(src, region->src_offset, region->length, outfile_name);
+        outfile_name[outfile_base_name_len] = '\0';
+        if(result) return 1;
     }
-    else return input_rom_size;
+    return 0;
+}
+
+// saves every region of the ROM into a single <basename>.nespack file
+static int save_packed(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_name)
+{
+    const nes_pack_region_t *regions = layout->regions;
+    size_t num_regions = layout->num_regions;
+    strcat(outfile_name, ".nespack");
+    int outfile_fd = open(outfile_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outfile_fd < 0) return 1;
+    uint64_t start = stage_start(src);
+    void *table = nes_parser_alloc(src->parser, nes_pack_table_size(num_regions));
+    int result = !table || nes_pack_write(outfile_fd, src->fd, src->buf, regions, num_regions, src->zero_copy, table) ? 1 : 0;
+    if(close(outfile_fd)) result = 1;
+    stage_end(src, METRICS_STAGE_WRITE, start);
+    size_t i;
+    for(i = 0; src->metrics && !result && i < num_regions; i++) src->metrics->bytes_out += regions[i].length;
+    return result;
 }
 
-// the following function uses documentation available at:
-// https://wiki.nesdev.com/w/index.php/INES
-// https://wiki.nesdev.com/w/index.php/NES_2.0
-parse_result_t parse_nes_2_header(char *header_buf, ines_header_t *out)
+// writes the small text outputs (manifests, digests), which are formatted in
+// the worker's arena instead of through stdio so that no FILE and no stdio
+// buffer is allocated per ROM
+static int write_text_file(const char *path, const char *text, size_t len)
 {
-    parse_result_t result = parse_ines_header(header_buf, out);
-    if(result) return result; // if non-zero (iNES parser had an error), propagate error.
-    out->type = IHT_NES_2;
-    uint8_t *header_buf_uint8 = (uint8_t *)header_buf;
-    out->nes_2.submapper_id = (header_buf_uint8[8] & 0xf0) >> 4;
-    out->mapper_id |= ((uint16_t)(header_buf_uint8[8] & 0x0f)) << 8;
-    out->prg_rom_size |= ((uint64_t)(header_buf_uint8[9] & 0x0f)) << 8;
-    out->prg_rom_size = handle_rom_size_encoding(out->prg_rom_size);
-    out->char_rom_size |= ((uint64_t)(header_buf_uint8[9] & 0xf0)) << 4;
-    out->char_rom_size = handle_rom_size_encoding(out->char_rom_size);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return 1;
+    int result = fd_copy(-1, 0, fd, len, text, false) ? 1 : 0;
+    if(close(fd)) result = 1;
+    return result;
+}
 
-    out->nes_2.prg_ram_size = handle_shift((uint8_t)(header_buf_uint8[10] & 0x0f));
-    out->nes_2.prg_eeprom_size = handle_shift((uint8_t)((header_buf_uint8[10] & 0xf0) >> 4));
-    out->nes_2.char_ram_size = handle_shift((uint8_t)(header_buf_uint8[11] & 0x0f));
-    out->nes_2.char_eeprom_size = handle_shift((uint8_t)((header_buf_uint8[11] & 0xf0) >> 4));
+// room for one "<region> <index> <digest>" line of a manifest or .digests file
+#define TEXT_LINE_SIZE (32 + ROM_DIGEST_STR_SIZE)
 
-    out->nes_2.tt = (timing_type_t)(header_buf_uint8[12] & 0x03);
+// puts every region of the ROM into the bank store and writes
+// <basename>.manifest, one "<region> <index> <sha1>" line per region, once
+// they are all stored.
+static int save_stored(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_name, const parser_options_t *opts)
+{
+    const nes_pack_region_t *regions = layout->regions;
+    size_t num_regions = layout->num_regions;
+    char *manifest = nes_parser_alloc(src->parser, (num_regions + 1) * TEXT_LINE_SIZE);
+    if(!manifest) return 1;
 
-    if(out->ct == CT_VS_SYSTEM)
+    size_t outfile_base_name_len = strlen(outfile_name);
+    size_t manifest_len = sprintf(manifest, "# nes bank manifest v1\n");
+    size_t i;
+    for(i = 0; i < num_regions; i++)
     {
-        out->nes_2.console_type_info.vs_system.ppu_type = header_buf_uint8[13] & 0x0f;
-        out->nes_2.console_type_info.vs_system.hardware_type = (header_buf_uint8[13] & 0xf0) >> 4;
+        const nes_pack_region_t *region = &regions[i];
+        char hash_hex[41];
+        uint64_t start = stage_start(src);
+        src_advance(src, region->src_offset, region->length);
+        if(nes_bank_store_put(opts->bank_store, src->fd, (off_t)region->src_offset, src->buf + region->src_offset, region->length, src->zero_copy, hash_hex, NULL))
+            return 1;
+        stage_end(src, METRICS_STAGE_WRITE, start);
+        if(src->metrics) src->metrics->bytes_out += region->length;
+        manifest_len += sprintf(manifest + manifest_len, "%s %" PRIu32 " %s\n", MANIFEST_REGION_STR[region->type], region->index, hash_hex);
+
+        if(opts->store_links)
+        {
+            // same names as the one-file-per-bank output
+            region_file_name(outfile_name, outfile_base_name_len, region);
+            nes_bank_store_result_t link_result = nes_bank_store_link(opts->bank_store, hash_hex, outfile_name);
+            outfile_name[outfile_base_name_len] = '\0';
+            if(link_result) return 1;
+        }
     }
-    else if(out->ct == CT_EXTENDED)
+
+    strcat(outfile_name, ".manifest");
+    int result = write_text_file(outfile_name, manifest, manifest_len);
+    outfile_name[outfile_base_name_len] = '\0';
+    return result;
+}
+
+// writes <basename>.digests: one line per region, then the whole file and the
+// payload after the 16-byte header (what DAT files usually list)
+static int write_digests(nes_parser_t *parser, const nes_pack_region_t *regions, const rom_digests_t *digests, char *outfile_name)
+{
+    char *text = nes_parser_alloc(parser, (digests->num_regions + 2) * TEXT_LINE_SIZE);
+    if(!text) return 1;
+    size_t len = 0;
+    char digest_str[ROM_DIGEST_STR_SIZE];
+    size_t i;
+    for(i = 0; i < digests->num_regions; i++)
     {
-        out->nes_2.console_type_info.extended_console.type = header_buf_uint8[13] & 0x0f;
+        rom_digest_to_str(&digests->regions[i], digest_str);
+        len += sprintf(text + len, "%s %" PRIu32 " %s\n", MANIFEST_REGION_STR[regions[i].type], regions[i].index, digest_str);
     }
-    out->nes_2.misc_roms_size = header_buf_uint8[14] & 0x03;
-    out->nes_2.default_expansion_device = header_buf_uint8[15] & 0x3f;
-    return PR_SUCCESS;
+    rom_digest_to_str(&digests->rom, digest_str);
+    len += sprintf(text + len, "rom - %s\n", digest_str);
+    rom_digest_to_str(&digests->payload, digest_str);
+    len += sprintf(text + len, "payload - %s\n", digest_str);
+
+    size_t outfile_base_name_len = strlen(outfile_name);
+    strcat(outfile_name, ".digests");
+    int result = write_text_file(outfile_name, text, len);
+    outfile_name[outfile_base_name_len] = '\0';
+    return result;
 }
 
-static int save_header(char *infile_buf, char *outfile_name)
+// computes the digests of the whole file, of the payload and of every region
+// and writes them with write_digests. All of them are computed in one pass
+// over the mapped file, a chunk at a time, so each chunk is still in cache for
+// every digest that covers it. If out is set, the digests are also copied
+// there; they stay in the worker's arena until the next ROM.
+static int save_digests(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_name, rom_digests_t *out)
 {
-    FILE *outfile = fopen(outfile_name, "w");
-    if(!outfile) return 1;
-    fwrite(infile_buf, 16, 1, outfile);
-    fclose(outfile);
-    return 0;
+    const size_t CHUNK_SIZE = 0x4000;
+    const nes_pack_region_t *regions = layout->regions;
+    size_t num_regions = layout->num_regions;
+
+    rom_digests_t digests = { .num_regions = num_regions, .regions = nes_parser_alloc(src->parser, num_regions * sizeof(rom_digest_t)) };
+    if(!digests.regions) return 1;
+
+    rom_digest_ctx_t rom_ctx;
+    rom_digest_ctx_t payload_ctx;
+    rom_digest_init(&rom_ctx);
+    rom_digest_init(&payload_ctx);
+    size_t i;
+    for(i = 0; i < num_regions; i++)
+    {
+        const nes_pack_region_t *region = &regions[i];
+        rom_digest_ctx_t region_ctx;
+        rom_digest_init(&region_ctx);
+        uint64_t done;
+        for(done = 0; done < region->length; done += CHUNK_SIZE)
+        {
+            const char *chunk = src->buf + region->src_offset + done;
+            size_t chunk_len = region->length - done < CHUNK_SIZE ? region->length - done : CHUNK_SIZE;
+            src_advance(src, region->src_offset + done, chunk_len);
+            rom_digest_update(&region_ctx, chunk, chunk_len);
+            rom_digest_update(&rom_ctx, chunk, chunk_len);
+            if(region->type != NES_PACK_REGION_TYPE_HEADER) rom_digest_update(&payload_ctx, chunk, chunk_len);
+        }
+        rom_digest_final(&region_ctx, &digests.regions[i]);
+    }
+    // bytes past the last region are not part of the ROM proper but still
+    // belong to the file
+    uint64_t end = regions[num_regions - 1].src_offset + regions[num_regions - 1].length;
+    for(; end < layout->file_size; end += CHUNK_SIZE)
+    {
+        size_t chunk_len = layout->file_size - end < CHUNK_SIZE ? layout->file_size - end : CHUNK_SIZE;
+        src_advance(src, end, chunk_len);
+        rom_digest_update(&rom_ctx, src->buf + end, chunk_len);
+    }
+    rom_digest_final(&rom_ctx, &digests.rom);
+    rom_digest_final(&payload_ctx, &digests.payload);
+
+    int result = write_digests(src->parser, regions, &digests, outfile_name);
+    if(!result && out) *out = digests;
+    return result;
 }
 
-// assumes filename_buf contains the base filename and is null-terminated.
-static int save_prg_roms(char *prg_roms_start, size_t num_blocks, char *filename_buf)
+static void write_digest_json(json_writer_t *json, const rom_digest_t *digest)
 {
-    size_t filename_basename_len = strlen(filename_buf);
-    size_t i = 0;
-    for(i = 0; i < num_blocks; i++)
+    uint8_t crc32_be[4] = {digest->crc32 >> 24, digest->crc32 >> 16, digest->crc32 >> 8, digest->crc32};
+    json_writer_key(json, "crc32");
+    json_writer_hex(json, crc32_be, sizeof(crc32_be));
+    json_writer_key(json, "md5");
+    json_writer_hex(json, digest->md5, sizeof(digest->md5));
+    json_writer_key(json, "sha1");
+    json_writer_hex(json, digest->sha1, sizeof(digest->sha1));
+}
+
+// the same fields print_header prints, as one JSON object
+static void write_header_json(json_writer_t *json, const nes_header_t *header)
+{
+    json_writer_begin_object(json);
+    json_writer_key(json, "type");
+    json_writer_string(json, NES_HEADER_TYPE_STR[header->type]);
+    json_writer_key(json, "mapper");
+    json_writer_uint(json, header->mapper_id);
+    json_writer_key(json, "prg_rom_size");
+    json_writer_uint(json, header->prg_rom_size);
+    json_writer_key(json, "char_rom_size");
+    json_writer_uint(json, header->char_rom_size);
+    json_writer_key(json, "nametable_mirroring");
+    json_writer_string(json, NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR[header->ntmt]);
+    json_writer_key(json, "persistent_memory");
+    json_writer_bool(json, header->persistent_memory);
+    json_writer_key(json, "trainer");
+    json_writer_bool(json, header->trainer);
+    json_writer_key(json, "console_type");
+    json_writer_string(json, NES_HEADER_CONSOLE_TYPE_STR[header->ct]);
+    if(header->type == NES_HEADER_TYPE_NES_2)
     {
-        char block_num_str[125];
-        sprintf(block_num_str, "%llu", i);
-        strcat(filename_buf, block_num_str);
-        strcat(filename_buf, ".bin");
+        json_writer_key(json, "submapper");
+        json_writer_uint(json, header->nes_2.submapper_id);
+        json_writer_key(json, "prg_ram_size");
+        json_writer_uint(json, header->nes_2.prg_ram_size);
+        json_writer_key(json, "prg_eeprom_size");
+        json_writer_uint(json, header->nes_2.prg_eeprom_size);
+        json_writer_key(json, "char_ram_size");
+        json_writer_uint(json, header->nes_2.char_ram_size);
+        json_writer_key(json, "char_eeprom_size");
+        json_writer_uint(json, header->nes_2.char_eeprom_size);
+        json_writer_key(json, "timing");
+        json_writer_string(json, NES_HEADER_TIMING_TYPE_STR[header->nes_2.tt]);
+        if(header->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+        {
+            json_writer_key(json, "vs_ppu_type");
+            json_writer_uint(json, header->nes_2.console_type_info.vs_system.ppu_type);
+            json_writer_key(json, "vs_hardware_type");
+            json_writer_uint(json, header->nes_2.console_type_info.vs_system.hardware_type);
+        }
+        else if(header->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+        {
+            json_writer_key(json, "extended_console_type");
+            json_writer_uint(json, header->nes_2.console_type_info.extended_console.type);
+        }
+        json_writer_key(json, "misc_roms");
+        json_writer_uint(json, header->nes_2.misc_roms_size);
+        json_writer_key(json, "default_expansion_device");
+        json_writer_uint(json, header->nes_2.default_expansion_device);
+    }
+    json_writer_end_object(json);
+}
 
-        FILE *outfile = fopen(filename_buf, "w");
-        if(!outfile) return 1;
-        fwrite(prg_roms_start, (size_t)PRG_ROM_BLOCK_SIZE, 1, outfile);
-        fclose(outfile);
+// appends one NDJSON line to opts->json_out for a processed ROM: the status,
+// plus the decoded header when it could be parsed, the file's regions when it
+// could be laid out, and their digests when they were computed. The line is
+// written into the caller's json buffer and handed to stdio in one piece, so
+// batch workers sharing the stream never interleave.
+static void emit_json(json_writer_t *json, const parser_options_t *opts, const char *nes_rom_file, return_code_t result, const nes_header_t *header, const nes_parser_layout_t *layout, const rom_digests_t *digests)
+{
+    json_writer_reset(json);
+    json_writer_begin_object(json);
+    json_writer_key(json, "path");
+    json_writer_string(json, nes_rom_file);
+    json_writer_key(json, "result");
+    json_writer_uint(json, result);
+    json_writer_key(json, "status");
+    json_writer_string(json, RETURN_CODE_STR[result]);
+    if(header)
+    {
+        json_writer_key(json, "header");
+        write_header_json(json, header);
+    }
+    if(header && layout)
+    {
+        const nes_pack_region_t *regions = layout->regions;
+        size_t num_regions = layout->num_regions;
+        json_writer_key(json, "file_size");
+        json_writer_uint(json, layout->file_size);
+        json_writer_key(json, "regions");
+        json_writer_begin_array(json);
+        size_t i;
+        for(i = 0; i < num_regions; i++)
+        {
+            json_writer_begin_object(json);
+            json_writer_key(json, "type");
+            json_writer_string(json, MANIFEST_REGION_STR[regions[i].type]);
+            json_writer_key(json, "index");
+            json_writer_uint(json, regions[i].index);
+            json_writer_key(json, "offset");
+            json_writer_uint(json, regions[i].src_offset);
+            json_writer_key(json, "length");
+            json_writer_uint(json, regions[i].length);
+            if(digests && digests->num_regions == num_regions) write_digest_json(json, &digests->regions[i]);
+            json_writer_end_object(json);
+        }
+        json_writer_end_array(json);
+        if(digests && digests->num_regions == num_regions)
+        {
+            json_writer_key(json, "rom");
+            json_writer_begin_object(json);
+            write_digest_json(json, &digests->rom);
+            json_writer_end_object(json);
+            json_writer_key(json, "payload");
+            json_writer_begin_object(json);
+            write_digest_json(json, &digests->payload);
+            json_writer_end_object(json);
+        }
+    }
+    json_writer_end_object(json);
+    if(json->failed)
+    {
+        fprintf(stderr, "%s: could not format JSON record\n", nes_rom_file);
+        return;
+    }
+    flockfile(opts->json_out);
+    fwrite(json->buf, 1, json->len, opts->json_out);
+    putc_unlocked('\n', opts->json_out);
+    funlockfile(opts->json_out);
+}
+
+// writes the outputs opts asks for. Their names are built in place on
+// outfile_base_name, which needs room for 128 more bytes and is left as it
+// was. With --async-io bank files are only queued; the caller hands src to
+// worker_scratch_finish_rom, which sees them written.
+int save_output(const nes_parser_layout_t *layout, const infile_src_t *src, char *outfile_base_name, const parser_options_t *opts, rom_digests_t *digests_out)
+{
+    int result;
+    size_t outfile_base_name_len = strlen(outfile_base_name);
+    uint64_t start = stage_start(src);
+    if(opts->digests && (result = save_digests(layout, src, outfile_base_name, digests_out))) goto end;
+    if(opts->digests) stage_end(src, METRICS_STAGE_DIGESTS, start);
+
+    if(opts->format == OF_PACKED) result = save_packed(layout, src, outfile_base_name);
+    else if(opts->format == OF_STORE) result = save_stored(layout, src, outfile_base_name, opts);
+    else result = save_files(layout, src, outfile_base_name, opts);
+
+end:
+    outfile_base_name[outfile_base_name_len] = '\0';
+    return result;
+}
 
-        prg_roms_start += (size_t)PRG_ROM_BLOCK_SIZE;
-        filename_buf[filename_basename_len] = '\0';
+static const size_t ZIP_CHUNK_SIZE = 0x10000;
+
+// the state of a zip entry that is written out while it is still being
+// inflated
+typedef struct zip_stream
+{
+    const parser_options_t *opts;
+    infile_src_t src;            // the inflated image, complete up to what progress was told
+    char *outfile_name;          // the base name, with room for suffixes
+    size_t outfile_base_name_len;
+    nes_header_t header;
+    bool header_parsed;
+    return_code_t result;
+    nes_parser_layout_t layout;  // files mode writes the regions out in order as they complete
+    size_t next_region;
+} zip_stream_t;
+
+static int zip_stream_progress(void *ctx, const uint8_t *out, uint64_t produced)
+{
+    zip_stream_t *stream = ctx;
+    if(!stream->header_parsed)
+    {
+        if(produced < 16) return 0;
+        if((stream->result = parse_header((char *)out, &stream->header))) return 1;
+        stream->header_parsed = true;
+        // the rest of the entry is not needed
+        if(stream->opts->header_only) return 1;
+        if(nes_parser_layout(stream->src.parser, &stream->header, stream->src.size, &stream->layout))
+        {
+            stream->result = RC_ERR_BANK_SAVE_ERR;
+            return 1;
+        }
+    }
+    // files mode writes each bank as soon as all of its bytes are in, while
+    // the next ones are still being inflated
+    while(stream->opts->format == OF_FILES && stream->next_region < stream->layout.num_regions)
+    {
+        const nes_pack_region_t *region = &stream->layout.regions[stream->next_region];
+        if(region->src_offset + region->length > produced) break;
+        stream->next_region++;
+        if(!region_wanted(stream->opts, region)) continue;
+
+        region_file_name(stream->outfile_name, stream->outfile_base_name_len, region);
+        int save_result = save_region(&stream->src, region->src_offset, region->length, stream->outfile_name);
+        stream->outfile_name[stream->outfile_base_name_len] = '\0';
+        if(save_result)
+        {
+            stream->result = RC_ERR_BANK_SAVE_ERR;
+            return 1;
+        }
     }
     return 0;
 }
 
-static int save_char_roms(char *char_roms_start, size_t num_blocks, char *filename_buf)
+// parses the first .nes entry of a zip archive without unpacking it to disk:
+// the entry is inflated into the worker's reusable image buffer, its header
+// decoded as soon as the first 16 bytes are out, and in files mode every bank
+// written as soon as it is complete. Outputs are named after the archive.
+static return_code_t process_zip_file(const char *zip_file, const parser_options_t *opts, worker_scratch_t *scratch)
 {
-    size_t filename_basename_len = strlen(filename_buf);
-    size_t i = 0;
-    for(i = 0; i < num_blocks; i++)
+    nes_parser_reset(&scratch->parser);
+    json_writer_t *json = opts->json_out ? &scratch->json : NULL;
+    zip_stream_t stream = { .opts = opts, .src = { .buf = NULL, .fd = -1, .size = 0, .zero_copy = false, .writer = scratch->has_writer ? &scratch->writer : NULL, .metrics = scratch->metrics, .parser = &scratch->parser }, .outfile_name = NULL, .header_parsed = false, .result = RC_SUCCESS, .next_region = 0 };
+    rom_digests_t digests = { .num_regions = 0, .regions = NULL };
+    bool complete = false;
+
+    zip_reader_t zip;
+    uint64_t start = stage_start(&stream.src);
+    zip_reader_result_t zip_result = zip_reader_open(zip_file, &zip);
+    if(zip_result)
+    {
+        stream.result = zip_result == ZIP_READER_RESULT_OPEN_ERR ? RC_ERR_INFILE_OPEN_ERR : RC_ERR_INFILE_CORRUPTED;
+        goto end;
+    }
+    stage_end(&stream.src, METRICS_STAGE_OPEN, start);
+    const zip_entry_t *entry = zip_reader_find_suffix(&zip, NES_SUFFIX);
+    if(!entry || entry->uncompressed_size < 16)
+    {
+        stream.result = RC_ERR_INVALID_INPUT_FILETYPE;
+        goto close_zip;
+    }
+    if(entry->uncompressed_size > scratch->image_cap)
     {
-        char block_num_str[125];
-        sprintf(block_num_str, "%llu", i);
-        strcat(filename_buf, block_num_str);
-        strcat(filename_buf, ".chr");
+        uint8_t *grown = entry->uncompressed_size <= SIZE_MAX ? realloc(scratch->image, entry->uncompressed_size) : NULL;
+        if(!grown)
+        {
+            stream.result = RC_ERR_ALLOC_ERR;
+            goto close_zip;
+        }
+        scratch->image = grown;
+        scratch->image_cap = entry->uncompressed_size;
+    }
+    stream.src.buf = (const char *)scratch->image;
+    stream.src.size = entry->uncompressed_size;
 
-        FILE *outfile = fopen(filename_buf, "w");
-        if(!outfile) return 1;
-        fwrite(char_roms_start, (size_t)CHAR_ROM_BLOCK_SIZE, 1, outfile);
-        fclose(outfile);
+    if(!(stream.outfile_name = nes_parser_base_name(&scratch->parser, zip_file, ZIP_SUFFIX, 128)))
+    {
+        stream.result = RC_ERR_ALLOC_ERR;
+        goto close_zip;
+    }
+    stream.outfile_base_name_len = strlen(stream.outfile_name);
 
-        char_roms_start += (size_t)CHAR_ROM_BLOCK_SIZE;
-        filename_buf[filename_basename_len] = '\0';
+    zip_result = zip_reader_extract(&zip, entry, scratch->image, ZIP_CHUNK_SIZE, zip_stream_progress, &stream);
+    if(zip_result == ZIP_READER_RESULT_STOPPED)
+    {
+        if(opts->header_only && !stream.result && !json) print_header(stdout, zip_file, &stream.header);
+        goto close_zip;
     }
-    return 0;
+    if(zip_result)
+    {
+        stream.result = RC_ERR_INFILE_CORRUPTED;
+        goto close_zip;
+    }
+    complete = true;
+    if(stream.src.metrics) stream.src.metrics->bytes_in += entry->uncompressed_size;
+
+    // files mode already wrote the banks, everything else needs the whole ROM
+    if(opts->format == OF_FILES)
+    {
+        if(opts->digests && save_digests(&stream.layout, &stream.src, stream.outfile_name, json ? &digests : NULL)) stream.result = RC_ERR_BANK_SAVE_ERR;
+    }
+    else if(save_output(&stream.layout, &stream.src, stream.outfile_name, opts, json ? &digests : NULL)) stream.result = RC_ERR_BANK_SAVE_ERR;
+
+close_zip:
+    // queued bank files point into the image, which this takes over
+    if(stream.src.writer && worker_scratch_finish_rom(scratch, NULL) && !stream.result) stream.result = RC_ERR_BANK_SAVE_ERR;
+    zip_reader_close(&zip);
+end:
+    if(json) emit_json(json, opts, zip_file, stream.result, stream.header_parsed ? &stream.header : NULL, complete ? &stream.layout : NULL, &digests);
+    return stream.result;
 }
 
-int save_output(ines_header_t *header, char *infile_buf, char *outfile_base_name)
+static const size_t STREAM_BUFFER_SIZE = 0x40000;
+
+// moves up to len bytes (UINT64_MAX: up to the end of the stream) from the
+// ring to out_fd (-1 to only hash them), feeding every given digest context
+// on the way. *streamed_out says how many there were before the stream ended.
+static return_code_t stream_region(ring_buffer_t *ring, int in_fd, uint64_t len, int out_fd, rom_digest_ctx_t **ctxs, size_t num_ctxs, uint64_t *streamed_out)
 {
-    int result;
-    char *outfile_name = malloc(strlen(outfile_base_name) + 129);
-    size_t outfile_base_name_len = strlen(outfile_base_name);
-    strcpy(outfile_name, outfile_base_name);
+    uint64_t done = 0;
+    return_code_t result = RC_SUCCESS;
+    while(done < len)
+    {
+        size_t span;
+        const uint8_t *data = ring_buffer_peek(ring, &span);
+        if(!span)
+        {
+            ssize_t got = ring_buffer_fill(ring, in_fd);
+            if(got < 0) result = RC_ERR_INFILE_OPEN_ERR;
+            if(got <= 0) break;
+            continue;
+        }
+        if(span > len - done) span = len - done;
+        if(out_fd >= 0 && fd_copy(-1, 0, out_fd, span, (const char *)data, false))
+        {
+            result = RC_ERR_BANK_SAVE_ERR;
+            break;
+        }
+        size_t i;
+        for(i = 0; i < num_ctxs; i++) rom_digest_update(ctxs[i], data, span);
+        ring_buffer_consume(ring, span);
+        done += span;
+    }
+    *streamed_out = done;
+    return result;
+}
 
-    // save header
-    strcat(outfile_name, ".ineshdr");
-    if(result = save_header(infile_buf, outfile_name)) return result;
-    outfile_name[outfile_base_name_len] = '\0'; // ensure next strcat encounters this null character first.
+// parses a ROM read sequentially from in_fd, which need not be seekable: a
+// pipe, a socket, stdin. The bytes pass through a fixed-size ring buffer, and
+// each region is written out (files mode) and hashed as its bytes arrive, so
+// memory use does not depend on the size of the ROM. Outputs are named after
+// outfile_base_name, which needs room for 128 more bytes; name is what
+// messages and the NDJSON record call the input. The region list and digests
+// go in the worker's arena, which the caller resets beforehand (it may hold
+// outfile_base_name too).
+static return_code_t process_rom_stream(int in_fd, const char *name, char *outfile_base_name, const parser_options_t *opts, worker_scratch_t *scratch)
+{
+    json_writer_t *json = opts->json_out ? &scratch->json : NULL;
+    return_code_t result = RC_SUCCESS;
+    nes_header_t header;
+    bool header_parsed = false;
+    bool complete = false;
+    nes_parser_layout_t layout;
+    rom_digests_t digests = { .num_regions = 0, .regions = NULL };
 
-    // save PRG-ROM blocks
-    if(result = save_prg_roms(infile_buf + 16, header->prg_rom_size, outfile_name)) return result;
+    ring_buffer_t ring;
+    if(ring_buffer_init(&ring, STREAM_BUFFER_SIZE)) return RC_ERR_ALLOC_ERR;
+    while(ring.len < 16)
+    {
+        ssize_t got = ring_buffer_fill(&ring, in_fd);
+        if(got < 0) result = RC_ERR_INFILE_OPEN_ERR;
+        else if(!got) result = RC_ERR_INVALID_INPUT_FILETYPE;
+        if(got <= 0) goto end;
+    }
+    // the ring starts out empty, so the first 16 bytes are contiguous
+    size_t span;
+    char *header_buf = (char *)ring_buffer_peek(&ring, &span);
+    if((result = parse_header(header_buf, &header))) goto end;
+    header_parsed = true;
+    if(opts->header_only)
+    {
+        if(!json) print_header(stdout, name, &header);
+        goto end;
+    }
 
-    // save CHR-ROM blocks
-    if(result = save_char_roms(infile_buf + 16 + ((size_t)PRG_ROM_BLOCK_SIZE * header->prg_rom_size), header->char_rom_size, outfile_name)) return result;
+    // The header may declare far more than the stream holds, so the layout is
+    // worked out a region at a time and only the regions whose bytes arrived
+    // are kept. The total size is only known at the end; until then the misc
+    // ROM, the one region without a size of its own, runs to the end of the
+    // stream.
+    memset(&layout, 0, sizeof(layout));
+    size_t digests_capacity = 0;
+    rom_digest_ctx_t rom_ctx;
+    rom_digest_ctx_t payload_ctx;
+    rom_digest_init(&rom_ctx);
+    rom_digest_init(&payload_ctx);
 
-    return 0;
-    // TODO handle the "miscellaneous rom area" described at:
-    // https://wiki.nesdev.com/w/index.php/NES_2.0#Miscellaneous_ROM_Area
-}
\ No newline at end of file
+    size_t outfile_base_name_len = strlen(outfile_base_name);
+    uint64_t total = 0;
+    nes_pack_region_t next;
+    bool more;
+    for(more = nes_parser_layout_next(&header, UINT64_MAX, NULL, &next); more; more = nes_parser_layout_next(&header, UINT64_MAX, &next, &next))
+    {
+        const nes_pack_region_t *region = &next;
+        // the misc ROM is only known to exist once its first byte is in, and
+        // an empty one gets no file, as for mapped files
+        if(region->type == NES_PACK_REGION_TYPE_MISC_ROM && !ring.len)
+        {
+            ssize_t got = ring_buffer_fill(&ring, in_fd);
+            if(got < 0)
+            {
+                result = RC_ERR_INFILE_OPEN_ERR;
+                goto end;
+            }
+            if(!got) break;
+        }
+        int out_fd = -1;
+        if(opts->format == OF_FILES && region_wanted(opts, region))
+        {
+            region_file_name(outfile_base_name, outfile_base_name_len, region);
+            out_fd = open(outfile_base_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            outfile_base_name[outfile_base_name_len] = '\0';
+            if(out_fd < 0)
+            {
+                result = RC_ERR_BANK_SAVE_ERR;
+                goto end;
+            }
+        }
+        rom_digest_ctx_t region_ctx;
+        rom_digest_init(&region_ctx);
+        rom_digest_ctx_t *ctxs[] = {&region_ctx, &rom_ctx, &payload_ctx};
+        size_t num_ctxs = !opts->digests ? 0 : region->type == NES_PACK_REGION_TYPE_HEADER ? 2 : 3;
+        uint64_t streamed;
+        result = stream_region(&ring, in_fd, region->length, out_fd, ctxs, num_ctxs, &streamed);
+        if(out_fd >= 0 && close(out_fd) && !result) result = RC_ERR_BANK_SAVE_ERR;
+        total += streamed;
+        if(result) goto end;
+        // like a mapped file that is too short for its header; the misc ROM
+        // is sized once the stream has ended
+        if(region->type != NES_PACK_REGION_TYPE_MISC_ROM && streamed < region->length)
+        {
+            result = RC_ERR_BANK_SAVE_ERR;
+            goto end;
+        }
+        // the misc ROM ends with the stream
+        nes_pack_region_t arrived = next;
+        arrived.length = streamed;
+        if(nes_parser_layout_append(&scratch->parser, &layout, &arrived))
+        {
+            result = RC_ERR_ALLOC_ERR;
+            goto end;
+        }
+        if(opts->digests)
+        {
+            if(digests.num_regions == digests_capacity)
+            {
+                // grows like the region list, in the same arena
+                digests_capacity = layout.capacity;
+                rom_digest_t *grown = nes_parser_alloc(&scratch->parser, digests_capacity * sizeof(rom_digest_t));
+                if(!grown)
+                {
+                    result = RC_ERR_ALLOC_ERR;
+                    goto end;
+                }
+                if(digests.num_regions) memcpy(grown, digests.regions, digests.num_regions * sizeof(rom_digest_t));
+                digests.regions = grown;
+            }
+            rom_digest_final(&region_ctx, &digests.regions[digests.num_regions++]);
+        }
+    }
+    // whatever follows the ROM proper is read too, so the writer of a pipe is
+    // not cut off and the file digest covers everything
+    uint64_t rest;
+    rom_digest_ctx_t *rom_ctxs[] = {&rom_ctx};
+    if((result = stream_region(&ring, in_fd, UINT64_MAX, -1, rom_ctxs, opts->digests ? 1 : 0, &rest))) goto end;
+    total += rest;
+    layout.file_size = total;
+    // every region before the misc ROM arrived in full, so this cannot fail
+    nes_parser_rom_area_end(&header, total, &layout.rom_end);
+    complete = true;
+
+    if(opts->digests)
+    {
+        rom_digest_final(&rom_ctx, &digests.rom);
+        rom_digest_final(&payload_ctx, &digests.payload);
+        if(write_digests(&scratch->parser, layout.regions, &digests, outfile_base_name)) result = RC_ERR_BANK_SAVE_ERR;
+    }
+
+end:
+    if(json) emit_json(json, opts, name, result, header_parsed ? &header : NULL, complete ? &layout : NULL, &digests);
+    ring_buffer_clear(&ring);
+    return result;
+}
@@ -2,113 +2,337 @@
 
 #include <string.h>
 
-// the following functions use the tests recommended at:
+#include <pthread.h>
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NES_HEADER_HAVE_AVX2
+#endif
+
+// the following function uses the tests recommended at:
 // https://wiki.nesdev.com/w/index.php/NES_2.0#Identification
-static bool header_is_ines(char *header_buf)
+static bool header_is_ines(const char *header_buf)
 {
     return !memcmp(NES_HEADER_MAGIC, header_buf, sizeof(NES_HEADER_MAGIC));
 }
 
-static bool header_is_nes_2(char *header_buf)
+nes_header_result_t nes_header_view_init(const void *header_buf, size_t header_buf_size, nes_header_view_t *out)
 {
-    char header_type_indicator = header_buf[7] & 0x0c;
-    return header_is_ines(header_buf) && (header_type_indicator == 0x08);
+    if(header_buf_size != NES_HEADER_SIZE) return NES_HEADER_RESULT_WRONG_BUF_SIZE;
+    if(!header_is_ines(header_buf)) return NES_HEADER_RESULT_INVALID_HEADER;
+    out->raw = header_buf;
+    return NES_HEADER_RESULT_SUCCESS;
 }
 
 // the following function uses documentation available at:
 // https://wiki.nesdev.com/w/index.php/INES
-static nes_header_result_t parse_ines_header(char *header_buf, nes_header_t *out)
+// https://wiki.nesdev.com/w/index.php/NES_2.0
+// It reads the bytes directly rather than through the view accessors: each
+// of those repeats the NES 2.0 test, and as out may alias the raw bytes the
+// compiler cannot fold them, which costs about 15% of the parse rate.
+// The NES 2.0 fields are left alone for iNES headers.
+void nes_header_view_decode(nes_header_view_t view, nes_header_t *out)
 {
-    memcpy(&(out->parser_version), PARSER_VERSION, sizeof(PARSER_VERSION));
-    out->type = IHT_INES;
-    out->prg_rom_size = *((uint8_t *)(header_buf + 4));
-    out->char_rom_size = *((uint8_t *)(header_buf + 5));
-    uint8_t byte6 = *((uint8_t *)(header_buf + 6));
-    uint8_t byte7 = *((uint8_t *)(header_buf + 7));
-    out->mapper_id = ((byte6 & 0xf0) >> 4) | (byte7 & 0xf0);
-    if(byte6 & 0x08) out->ntmt = NMT_NO_MIRRORING;
-    else if(byte6 & 0x01) out->ntmt = NMT_VERTICAL;
-    else out->ntmt = NMT_HORIZONTAL;
+    const uint8_t *raw = view.raw;
+    uint8_t byte6 = raw[6];
+    uint8_t byte7 = raw[7];
+    memcpy(&(out->parser_version), NES_HEADER_PARSER_VERSION, sizeof(NES_HEADER_PARSER_VERSION));
+    out->type = nes_header_view_type(view);
+    out->prg_rom_bytes = (uint64_t)raw[4] << NES_HEADER_PROG_ROM_BLOCK_SHIFT;
+    out->char_rom_bytes = (uint64_t)raw[5] << NES_HEADER_CHAR_ROM_BLOCK_SHIFT;
+    out->prg_rom_size = raw[4];
+    out->char_rom_size = raw[5];
+    out->mapper_id = (byte6 >> 4) | (byte7 & 0xf0);
+    if(byte6 & 0x08) out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING;
+    else if(byte6 & 0x01) out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL;
+    else out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_HORIZONTAL;
     out->persistent_memory = byte6 & 0x02;
     out->trainer = byte6 & 0x04;
-    out->ct = (console_type_t)(byte7 & 0x03);
-    return PR_SUCCESS;
+    out->ct = (nes_header_console_type_t)(byte7 & 0x03);
+    if(out->type != NES_HEADER_TYPE_NES_2) return;
+
+    out->nes_2.submapper_id = raw[8] >> 4;
+    out->mapper_id |= (uint16_t)(raw[8] & 0x0f) << 8;
+    out->prg_rom_bytes = nes_header_decode_rom_bytes(raw[4] | (uint16_t)(raw[9] & 0x0f) << 8, NES_HEADER_PROG_ROM_BLOCK_SHIFT);
+    out->char_rom_bytes = nes_header_decode_rom_bytes(raw[5] | (uint16_t)(raw[9] & 0xf0) << 4, NES_HEADER_CHAR_ROM_BLOCK_SHIFT);
+    out->prg_rom_size = nes_header_rom_banks(out->prg_rom_bytes, NES_HEADER_PROG_ROM_BLOCK_SHIFT);
+    out->char_rom_size = nes_header_rom_banks(out->char_rom_bytes, NES_HEADER_CHAR_ROM_BLOCK_SHIFT);
+    out->nes_2.prg_ram_size = nes_header_decode_shift(raw[10] & 0x0f);
+    out->nes_2.prg_eeprom_size = nes_header_decode_shift(raw[10] >> 4);
+    out->nes_2.char_ram_size = nes_header_decode_shift(raw[11] & 0x0f);
+    out->nes_2.char_eeprom_size = nes_header_decode_shift(raw[11] >> 4);
+    out->nes_2.tt = (nes_header_timing_type_t)(raw[12] & 0x03);
+    if(out->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+    {
+        out->nes_2.console_type_info.vs_system.ppu_type = raw[13] & 0x0f;
+        out->nes_2.console_type_info.vs_system.hardware_type = raw[13] >> 4;
+    }
+    else if(out->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+    {
+        out->nes_2.console_type_info.extended_console.type = raw[13] & 0x0f;
+    }
+    out->nes_2.misc_roms_size = raw[14] & 0x03;
+    out->nes_2.default_expansion_device = raw[15] & 0x3f;
+}
+
+nes_header_result_t nes_header_parse(char *header_buf, size_t header_buf_size, nes_header_t *out)
+{
+    nes_header_view_t view;
+    nes_header_result_t result = nes_header_view_init(header_buf, header_buf_size, &view);
+    if(result) return result;
+    nes_header_view_decode(view, out);
+    return NES_HEADER_RESULT_SUCCESS;
 }
 
-static uint16_t handle_shift(uint8_t shift)
+// the 12-bit NES 2.0 size field for a ROM of size bytes: the count of
+// 2^block_shift byte banks where size is whole banks and the count fits below
+// the $f00 marker, else exponent-multiplier notation (see
+// nes_header_decode_rom_bytes)
+static bool encode_rom_size(uint64_t size, uint8_t block_shift, uint16_t *out)
 {
-    if(!shift)
+    if(!(size & (((uint64_t)1 << block_shift) - 1)) && size >> block_shift < 0xf00)
     {
-        return 0;
+        *out = size >> block_shift;
+        return true;
     }
-    else
+    uint8_t exponent = __builtin_ctzll(size);
+    uint64_t multiplier = size >> exponent;
+    if(multiplier > 7) return false;
+    *out = 0x0f00 | exponent << 2 | (multiplier - 1) / 2;
+    return true;
+}
+
+// the shift count nes_header_decode_shift turns back into size
+static bool encode_shift(uint16_t size, uint8_t *out)
+{
+    if(size & (size - 1)) return false;
+    *out = size ? __builtin_ctz(size) + 1 : 0;
+    return true;
+}
+
+nes_header_result_t nes_header_serialize(const nes_header_t *in, char *out_buf, size_t out_buf_size)
+{
+    if(out_buf_size != NES_HEADER_SIZE) return NES_HEADER_RESULT_WRONG_BUF_SIZE;
+    uint8_t b[16] = {0};
+    memcpy(b, NES_HEADER_MAGIC, sizeof(NES_HEADER_MAGIC));
+    b[6] = (in->mapper_id & 0x0f) << 4;
+    if(in->ntmt == NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING) b[6] |= 0x08;
+    else if(in->ntmt == NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL) b[6] |= 0x01;
+    if(in->persistent_memory) b[6] |= 0x02;
+    if(in->trainer) b[6] |= 0x04;
+    b[7] = (in->mapper_id & 0xf0) | (in->ct & 0x03);
+    if(in->type != NES_HEADER_TYPE_NES_2)
     {
-        return 1 << (shift - 1);
+        if(in->mapper_id > 0xff
+            || in->prg_rom_bytes & (NES_HEADER_PROG_ROM_BLOCK_SIZE - 1) || in->prg_rom_bytes >> NES_HEADER_PROG_ROM_BLOCK_SHIFT > 0xff
+            || in->char_rom_bytes & (NES_HEADER_CHAR_ROM_BLOCK_SIZE - 1) || in->char_rom_bytes >> NES_HEADER_CHAR_ROM_BLOCK_SHIFT > 0xff)
+            return NES_HEADER_RESULT_UNENCODABLE;
+        b[4] = in->prg_rom_bytes >> NES_HEADER_PROG_ROM_BLOCK_SHIFT;
+        b[5] = in->char_rom_bytes >> NES_HEADER_CHAR_ROM_BLOCK_SHIFT;
+        memcpy(out_buf, b, sizeof(b));
+        return NES_HEADER_RESULT_SUCCESS;
     }
+
+    uint16_t prg_rom_size;
+    uint16_t char_rom_size;
+    uint8_t shifts[4];
+    if(in->mapper_id > 0xfff || in->nes_2.submapper_id > 0x0f
+        || !encode_rom_size(in->prg_rom_bytes, NES_HEADER_PROG_ROM_BLOCK_SHIFT, &prg_rom_size)
+        || !encode_rom_size(in->char_rom_bytes, NES_HEADER_CHAR_ROM_BLOCK_SHIFT, &char_rom_size)
+        || !encode_shift(in->nes_2.prg_ram_size, &shifts[0]) || !encode_shift(in->nes_2.prg_eeprom_size, &shifts[1])
+        || !encode_shift(in->nes_2.char_ram_size, &shifts[2]) || !encode_shift(in->nes_2.char_eeprom_size, &shifts[3])
+        || shifts[0] > 0x0f || shifts[1] > 0x0f || shifts[2] > 0x0f || shifts[3] > 0x0f)
+        return NES_HEADER_RESULT_UNENCODABLE;
+    b[4] = prg_rom_size & 0xff;
+    b[5] = char_rom_size & 0xff;
+    b[7] |= 0x08;
+    b[8] = in->nes_2.submapper_id << 4 | in->mapper_id >> 8;
+    b[9] = (char_rom_size >> 4 & 0xf0) | prg_rom_size >> 8;
+    b[10] = shifts[1] << 4 | shifts[0];
+    b[11] = shifts[3] << 4 | shifts[2];
+    b[12] = in->nes_2.tt & 0x03;
+    if(in->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+        b[13] = (in->nes_2.console_type_info.vs_system.hardware_type & 0x0f) << 4 | (in->nes_2.console_type_info.vs_system.ppu_type & 0x0f);
+    else if(in->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+        b[13] = in->nes_2.console_type_info.extended_console.type & 0x0f;
+    b[14] = in->nes_2.misc_roms_size & 0x03;
+    b[15] = in->nes_2.default_expansion_device & 0x3f;
+    memcpy(out_buf, b, sizeof(b));
+    return NES_HEADER_RESULT_SUCCESS;
 }
 
-// If the highest nibble is $f, exponent-multiplier notation is used. See:
-// https://wiki.nesdev.com/w/index.php/NES_2.0#PRG-ROM_Area
-// note that the highest possible value of the exponent is 63, so there is 
-// a chance that, with a value of 63 and a multiplier > 1, we will overflow.
-// Not sure how to handle that without using a bignum library, but it seems 
-// unlikely to overflow in practice.
-// In fact, the mmap will fail before this overflows because of the large file 
-// size.
-static uint64_t handle_rom_size_encoding(uint64_t input_rom_size)
+// the 12-bit NES 2.0 size fields need the (scalar) exponent-multiplier
+// decoding, so batches fill them in here after the vector part
+static void unpack_rom_sizes(const uint8_t *header, nes_header_packed_t *out)
 {
-    uint16_t irs_u16 = (uint16_t)input_rom_size;
-    if(irs_u16 & 0x0f00 == 0x0f00)
+    if(!out->type)
     {
-        uint8_t exponent = (irs_u16 & 0x00fc) >> 2;
-        uint8_t multiplier = irs_u16 & 0x0003;
-        return (1 << exponent) * (multiplier * 2 + 1);
+        out->prg_rom_bytes = out->char_rom_bytes = 0;
+        return;
     }
-    else return input_rom_size;
+    nes_header_view_t view = { .raw = header };
+    out->prg_rom_bytes = nes_header_view_prg_rom_bytes(view);
+    out->char_rom_bytes = nes_header_view_char_rom_bytes(view);
 }
 
-// the following function uses documentation available at:
-// https://wiki.nesdev.com/w/index.php/INES
-// https://wiki.nesdev.com/w/index.php/NES_2.0
-static parse_result_t parse_nes_2_header(char *header_buf, nes_header_t *out)
+static void parse_packed(const uint8_t *header, nes_header_packed_t *out)
 {
-    parse_result_t result = parse_ines_header(header_buf, out);
-    if(result) return result; // if non-zero (iNES parser had an error), propagate error.
-    out->type = IHT_NES_2;
-    uint8_t *header_buf_uint8 = (uint8_t *)header_buf;
-    out->nes_2.submapper_id = (header_buf_uint8[8] & 0xf0) >> 4;
-    out->mapper_id |= ((uint16_t)(header_buf_uint8[8] & 0x0f)) << 8;
-    out->prg_rom_size |= ((uint64_t)(header_buf_uint8[9] & 0x0f)) << 8;
-    out->prg_rom_size = handle_rom_size_encoding(out->prg_rom_size);
-    out->char_rom_size |= ((uint64_t)(header_buf_uint8[9] & 0xf0)) << 4;
-    out->char_rom_size = handle_rom_size_encoding(out->char_rom_size);
-
-    out->nes_2.prg_ram_size = handle_shift((uint8_t)(header_buf_uint8[10] & 0x0f));
-    out->nes_2.prg_eeprom_size = handle_shift((uint8_t)((header_buf_uint8[10] & 0xf0) >> 4));
-    out->nes_2.char_ram_size = handle_shift((uint8_t)(header_buf_uint8[11] & 0x0f));
-    out->nes_2.char_eeprom_size = handle_shift((uint8_t)((header_buf_uint8[11] & 0xf0) >> 4));
-
-    out->nes_2.tt = (timing_type_t)(header_buf_uint8[12] & 0x03);
-
-    if(out->ct == CT_VS_SYSTEM)
+    memset(out, 0, sizeof(*out));
+    nes_header_view_t view;
+    if(nes_header_view_init(header, NES_HEADER_SIZE, &view)) return;
+    out->type = nes_header_view_type(view);
+    out->mapper_id = (header[6] >> 4) | (header[7] & 0xf0);
+    if(header[6] & 0x08) out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING;
+    else if(header[6] & 0x01) out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL;
+    else out->ntmt = NES_HEADER_NAMETABLE_MIRRORING_TYPE_HORIZONTAL;
+    out->flags = (header[6] >> 1) & 0x03;
+    out->ct = header[7] & 0x03;
+    if(out->type == NES_HEADER_TYPE_NES_2)
     {
-        out->nes_2.console_type_info.vs_system.ppu_type = header_buf_uint8[13] & 0x0f;
-        out->nes_2.console_type_info.vs_system.hardware_type = (header_buf_uint8[13] & 0xf0) >> 4;
+        out->mapper_id |= (uint16_t)(header[8] & 0x0f) << 8;
+        out->submapper_id = header[8] >> 4;
+        out->tt = header[12] & 0x03;
+        out->prg_ram_shift = header[10] & 0x0f;
+        out->prg_eeprom_shift = header[10] >> 4;
+        out->char_ram_shift = header[11] & 0x0f;
+        out->char_eeprom_shift = header[11] >> 4;
+        out->misc_roms_size = header[14] & 0x03;
+        out->default_expansion_device = header[15] & 0x3f;
+        out->console_type_info = header[13];
     }
-    else if(out->ct == CT_EXTENDED)
+    unpack_rom_sizes(header, out);
+}
+
+#ifdef NES_HEADER_HAVE_AVX2
+// Decodes all but the ROM sizes of an even number of headers into packed
+// records, two per iteration. Each header sits in its own 128-bit lane and
+// pshufb works per lane, so one set of shuffles moves the nibbles of both:
+// every source vector below is shuffled into place (0x80 entries clear the
+// byte) and the results ORed.
+__attribute__((target("avx2")))
+static void parse_batch_avx2(const uint8_t *headers, size_t num_headers, nes_header_packed_t *out)
+{
+#define LANES(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+    const char Z = (char)0x80;
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    // ntmt and flags, indexed by the low nibble of byte 6
+    const __m256i ntmt_lut = LANES(0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2);
+    const __m256i flags_lut = LANES(0, 0, 1, 1, 2, 2, 3, 3, 0, 0, 1, 1, 2, 2, 3, 3);
+    // where each packed byte (mapper_id lo, hi, type, submapper_id, ntmt,
+    // flags, ct, tt, shifts, misc, expansion, console info, reserved) comes from
+    const __m256i from_hi = LANES(6, Z, Z, 8, Z, Z, Z, Z, Z, 10, Z, 11, Z, Z, Z, Z);
+    const __m256i from_top = LANES(7, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z);
+    const __m256i from_lo = LANES(Z, 8, Z, Z, Z, Z, Z, Z, 10, Z, 11, Z, Z, Z, Z, Z);
+    const __m256i from_ntmt = LANES(Z, Z, Z, Z, 6, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z);
+    const __m256i from_flags = LANES(Z, Z, Z, Z, Z, 6, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z);
+    const __m256i from_lo3 = LANES(Z, Z, Z, Z, Z, Z, 7, 12, Z, Z, Z, Z, 14, Z, Z, Z);
+    const __m256i from_low6 = LANES(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 15, Z, Z);
+    const __m256i from_raw = LANES(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 13, Z);
+    const __m256i nes_2_only = LANES(0, -1, 0, -1, 0, 0, 0, -1, -1, -1, -1, -1, -1, -1, -1, 0);
+    const __m256i type_ines = LANES(0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i broadcast_7 = _mm256_set1_epi8(7);
+    const __m256i type_indicator_mask = _mm256_set1_epi8(0x0c);
+    const __m256i type_indicator_nes_2 = _mm256_set1_epi8(0x08);
+    uint32_t magic;
+    memcpy(&magic, NES_HEADER_MAGIC, sizeof(magic));
+    const __m256i magic_v = _mm256_setr_epi32(magic, 0, 0, 0, magic, 0, 0, 0);
+#undef LANES
+
+    size_t i;
+    for(i = 0; i + 2 <= num_headers; i += 2)
     {
-        out->nes_2.console_type_info.extended_console.type = header_buf_uint8[13] & 0x0f;
+        __m256i x = _mm256_loadu_si256((const __m256i *)(headers + i * NES_HEADER_SIZE));
+        __m256i lo = _mm256_and_si256(x, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+
+        // all ones across a lane whose header has the magic number, resp. passes
+        // the NES 2.0 test on byte 7
+        __m256i valid = _mm256_shuffle_epi32(_mm256_cmpeq_epi32(x, magic_v), 0);
+        __m256i nes_2 = _mm256_shuffle_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(x, type_indicator_mask), type_indicator_nes_2), broadcast_7);
+
+        __m256i packed = _mm256_shuffle_epi8(hi, from_hi);
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(_mm256_andnot_si256(nibble, x), from_top));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(lo, from_lo));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(_mm256_shuffle_epi8(ntmt_lut, lo), from_ntmt));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(_mm256_shuffle_epi8(flags_lut, lo), from_flags));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(_mm256_and_si256(lo, _mm256_set1_epi8(0x03)), from_lo3));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(_mm256_and_si256(x, _mm256_set1_epi8(0x3f)), from_low6));
+        packed = _mm256_or_si256(packed, _mm256_shuffle_epi8(x, from_raw));
+        packed = _mm256_andnot_si256(_mm256_andnot_si256(nes_2, nes_2_only), packed);
+        // type is 1, plus 1 for NES 2.0
+        packed = _mm256_add_epi8(packed, _mm256_add_epi8(type_ines, _mm256_and_si256(nes_2, type_ines)));
+        packed = _mm256_and_si256(packed, valid);
+
+        _mm_storeu_si128((__m128i *)&out[i].mapper_id, _mm256_castsi256_si128(packed));
+        _mm_storeu_si128((__m128i *)&out[i + 1].mapper_id, _mm256_extracti128_si256(packed, 1));
     }
-    out->nes_2.misc_roms_size = header_buf_uint8[14] & 0x03;
-    out->nes_2.default_expansion_device = header_buf_uint8[15] & 0x3f;
-    return PR_SUCCESS;
+    // the scalar code that follows must not pay for dirty upper halves
+    _mm256_zeroupper();
 }
+#endif
 
-nes_header_result_t nes_header_parse(char *header_buf, size_t header_buf_size, nes_header_t *out)
+static bool use_avx2;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void)
 {
-    if(header_buf_size != NES_HEADER_SIZE) return NES_HEADER_RESULT_WRONG_BUF_SIZE;
+    use_avx2 = cpu_features_get()->avx2;
+}
+
+size_t nes_header_parse_batch(const uint8_t *headers, size_t num_headers, nes_header_packed_t *out)
+{
+    pthread_once(&init_once, init);
+    size_t i = 0;
+#ifdef NES_HEADER_HAVE_AVX2
+    if(use_avx2)
+    {
+        i = num_headers & ~(size_t)1;
+        parse_batch_avx2(headers, i, out);
+        size_t j;
+        for(j = 0; j < i; j++) unpack_rom_sizes(headers + j * NES_HEADER_SIZE, &out[j]);
+    }
+#endif
+    for(; i < num_headers; i++) parse_packed(headers + i * NES_HEADER_SIZE, &out[i]);
+
+    size_t num_valid = 0;
+    for(i = 0; i < num_headers; i++) num_valid += out[i].type != 0;
+    return num_valid;
+}
+
+nes_header_result_t nes_header_unpack(const nes_header_packed_t *in, nes_header_t *out)
+{
+    if(!in->type) return NES_HEADER_RESULT_INVALID_HEADER;
+    memcpy(&(out->parser_version), NES_HEADER_PARSER_VERSION, sizeof(NES_HEADER_PARSER_VERSION));
+    out->type = (nes_header_type_t)in->type;
+    out->prg_rom_bytes = in->prg_rom_bytes;
+    out->char_rom_bytes = in->char_rom_bytes;
+    out->prg_rom_size = nes_header_rom_banks(in->prg_rom_bytes, NES_HEADER_PROG_ROM_BLOCK_SHIFT);
+    out->char_rom_size = nes_header_rom_banks(in->char_rom_bytes, NES_HEADER_CHAR_ROM_BLOCK_SHIFT);
+    out->mapper_id = in->mapper_id;
+    out->ntmt = (nes_header_nametable_mirroring_type_t)in->ntmt;
+    out->persistent_memory = in->flags & NES_HEADER_PACKED_FLAG_PERSISTENT_MEMORY;
+    out->trainer = in->flags & NES_HEADER_PACKED_FLAG_TRAINER;
+    out->ct = (nes_header_console_type_t)in->ct;
+    if(out->type != NES_HEADER_TYPE_NES_2) return NES_HEADER_RESULT_SUCCESS;
 
-    if(header_is_nes_2(header_buf)) return parse_nes_2_header(header_buf, out);
-    else if(header_is_ines(header_buf)) return parse_ines_header(header_buf, out);
-    else return NES_HEADER_RESULT_INVALID_HEADER;
-}
\ No newline at end of file
+    out->nes_2.submapper_id = in->submapper_id;
+    out->nes_2.prg_ram_size = nes_header_decode_shift(in->prg_ram_shift);
+    out->nes_2.prg_eeprom_size = nes_header_decode_shift(in->prg_eeprom_shift);
+    out->nes_2.char_ram_size = nes_header_decode_shift(in->char_ram_shift);
+    out->nes_2.char_eeprom_size = nes_header_decode_shift(in->char_eeprom_shift);
+    out->nes_2.tt = (nes_header_timing_type_t)in->tt;
+    if(out->ct == NES_HEADER_CONSOLE_TYPE_VS_SYSTEM)
+    {
+        out->nes_2.console_type_info.vs_system.ppu_type = in->console_type_info & 0x0f;
+        out->nes_2.console_type_info.vs_system.hardware_type = in->console_type_info >> 4;
+    }
+    else if(out->ct == NES_HEADER_CONSOLE_TYPE_EXTENDED)
+    {
+        out->nes_2.console_type_info.extended_console.type = in->console_type_info & 0x0f;
+    }
+    out->nes_2.misc_roms_size = in->misc_roms_size;
+    out->nes_2.default_expansion_device = in->default_expansion_device;
+    return NES_HEADER_RESULT_SUCCESS;
+}
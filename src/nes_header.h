@@ -1,25 +1,33 @@
 #ifndef NES_HEADER_H
 #define NES_HEADER_H
 
-const uint64_t NES_HEADER_PARSER_VERSION[] = {0, 1, 0};
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
 
-const size_t NES_HEADER_SIZE = 16;
+static const uint64_t NES_HEADER_PARSER_VERSION[] = {0, 1, 0};
 
-const char NES_HEADER_MAGIC[] = {'\x4e', '\x45', '\x53', '\x1a'};
+static const size_t NES_HEADER_SIZE = 16;
 
-const uint16_t NES_HEADER_PROG_ROM_BLOCK_SIZE = 0x4000;
-const uint16_t NES_HEADER_CHAR_ROM_BLOCK_SIZE = 0x2000;
-const uint8_t NES_HEADER_PROG_RAM_BLOCK_SIZE = 0x40;
-const uint8_t NES_HEADER_PROG_EEPRON_BLOCK_SIZE = 0x40;
-const uint8_t NES_HEADER_CHAR_RAM_BLOCK_SIZE = 0x40;
-const uint8_t NES_HEADER_CHAR_EEPRON_BLOCK_SIZE = 0x40;
+static const char NES_HEADER_MAGIC[] = {'\x4e', '\x45', '\x53', '\x1a'};
+
+// flagged in byte 6, sits between the header and PRG-ROM
+static const uint16_t NES_HEADER_TRAINER_SIZE = 0x200;
+static const uint16_t NES_HEADER_PROG_ROM_BLOCK_SIZE = 0x4000;
+static const uint16_t NES_HEADER_CHAR_ROM_BLOCK_SIZE = 0x2000;
+static const uint8_t NES_HEADER_PROG_ROM_BLOCK_SHIFT = 14;
+static const uint8_t NES_HEADER_CHAR_ROM_BLOCK_SHIFT = 13;
+static const uint8_t NES_HEADER_PROG_RAM_BLOCK_SIZE = 0x40;
+static const uint8_t NES_HEADER_PROG_EEPRON_BLOCK_SIZE = 0x40;
+static const uint8_t NES_HEADER_CHAR_RAM_BLOCK_SIZE = 0x40;
+static const uint8_t NES_HEADER_CHAR_EEPRON_BLOCK_SIZE = 0x40;
 
 typedef enum nes_header_type
 {
     NES_HEADER_TYPE_INES = 1,
     NES_HEADER_TYPE_NES_2 = 2
 } nes_header_type_t;
-const char *NES_HEADER_TYPE_STR[] = {"", "iNES", "NES 2.0"};
+static const char *const NES_HEADER_TYPE_STR[] = {"", "iNES", "NES 2.0"};
 
 typedef enum nes_header_nametable_mirroring_type
 {
@@ -27,7 +35,7 @@ typedef enum nes_header_nametable_mirroring_type
     NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL = 1,
     NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING = 2
 } nes_header_nametable_mirroring_type_t;
-const char *NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR[] = {"horizontal", "vertical", "no mirroring"};
+static const char *const NES_HEADER_NAMETABLE_MIRRORING_TYPE_STR[] = {"horizontal", "vertical", "no mirroring"};
 
 typedef enum nes_header_console_type
 {
@@ -36,7 +44,7 @@ typedef enum nes_header_console_type
     NES_HEADER_CONSOLE_TYPE_PLAYCHOICE_10 = 2,
     NES_HEADER_CONSOLE_TYPE_EXTENDED = 3
 } nes_header_console_type_t;
-const char *NES_HEADER_CONSOLE_TYPE_STR[] = {"NES", "Vs. System", "Playchoice-10", "extended"};
+static const char *const NES_HEADER_CONSOLE_TYPE_STR[] = {"NES", "Vs. System", "Playchoice-10", "extended"};
 
 typedef enum nes_header_timing_type
 {
@@ -45,19 +53,23 @@ typedef enum nes_header_timing_type
     NES_HEADER_TIMING_TYPE_MULTI = 2,
     NES_HEADER_TIMING_TYPE_DENDY = 3
 } nes_header_timing_type_t;
-const char *NES_HEADER_TIMING_TYPE_STR[] = {"NTSC", "PAL", "multi-region", "Dendy"};
+static const char *const NES_HEADER_TIMING_TYPE_STR[] = {"NTSC", "PAL", "multi-region", "Dendy"};
 
 typedef struct nes_header
 {
     uint64_t parser_version[3];
-    ines_header_type_t type;
-    uint64_t prg_rom_size;  // number of 16K PRG-ROM banks
-    uint64_t char_rom_size; // number of 8K CHR-ROM banks
+    nes_header_type_t type;
+    // The ROM areas in bytes. NES 2.0 exponent-multiplier sizes need not be
+    // whole banks, so these, not the bank counts, say where the areas end.
+    uint64_t prg_rom_bytes;
+    uint64_t char_rom_bytes;
+    uint64_t prg_rom_size;  // number of 16K PRG-ROM banks, a partial last bank counted
+    uint64_t char_rom_size; // number of 8K CHR-ROM banks, a partial last bank counted
     uint16_t mapper_id;
-    nametable_mirroring_type_t ntmt;
+    nes_header_nametable_mirroring_type_t ntmt;
     bool persistent_memory;
     bool trainer;
-    console_type_t ct;
+    nes_header_console_type_t ct;
     struct
     {
         uint8_t submapper_id;
@@ -65,7 +77,7 @@ typedef struct nes_header
         uint16_t prg_eeprom_size;  // the total PRG-EEPROM size is 64 * prg_eeprom_size
         uint16_t char_ram_size;    // the total CHR-RAM    size is 64 * char_ram_size
         uint16_t char_eeprom_size; // the total CHR-EEPROM size is 64 * char_eeprom_size
-        timing_type_t tt;
+        nes_header_timing_type_t tt;
         union
         {
             struct
@@ -87,11 +99,231 @@ typedef enum nes_header_result
 {
     NES_HEADER_RESULT_SUCCESS = 0,
     NES_HEADER_RESULT_WRONG_BUF_SIZE,
-    NES_HEADER_RESULT_INVALID_HEADER
+    NES_HEADER_RESULT_INVALID_HEADER,
+    NES_HEADER_RESULT_UNENCODABLE
 } nes_header_result_t;
-char *NES_HEADER_RESULT_STR[] = {"success", "Wrong buffer size given. iNES headers must be 16 bytes long.", "invalid header"};
+static const char *const NES_HEADER_RESULT_STR[] = {"success", "Wrong buffer size given. iNES headers must be 16 bytes long.", "invalid header", "header fields do not fit the header format"};
 
 nes_header_result_t nes_header_parse(char *header_buf, size_t header_buf_size, nes_header_t *out);
-nes_header_result_t nes_header_serialize(nes_header_t *in, char *out_buf, size_t out_buf_size);
+
+// the inverse of nes_header_parse: writes the 16 bytes that parse back into
+// in. Fields the format cannot hold, such as a mapper above 255 in an iNES
+// header or a NES 2.0 ROM size that is neither a 12-bit bank count nor a
+// power of two times 1, 3, 5 or 7 bytes, give NES_HEADER_RESULT_UNENCODABLE.
+// The ROM sizes come from prg_rom_bytes and char_rom_bytes; the bank counts
+// are derived from those and, like parser_version, ignored.
+nes_header_result_t nes_header_serialize(const nes_header_t *in, char *out_buf, size_t out_buf_size);
+
+// One header decoded by nes_header_parse_batch, packed into 32 bytes so large
+// batches stay cache friendly. Fields that only NES 2.0 headers carry are zero
+// for iNES headers, and the whole record is zero (type 0) if the magic number
+// did not match.
+typedef struct nes_header_packed
+{
+    uint64_t prg_rom_bytes;         // as nes_header_t; the bank counts follow from these
+    uint64_t char_rom_bytes;        // as nes_header_t
+    uint16_t mapper_id;
+    uint8_t type;                   // nes_header_type_t, or 0 for an invalid header
+    uint8_t submapper_id;
+    uint8_t ntmt;                   // nes_header_nametable_mirroring_type_t
+    uint8_t flags;                  // NES_HEADER_PACKED_FLAG_*
+    uint8_t ct;                     // nes_header_console_type_t
+    uint8_t tt;                     // nes_header_timing_type_t
+    uint8_t prg_ram_shift;          // the raw shift counts of bytes 10 and 11
+    uint8_t prg_eeprom_shift;
+    uint8_t char_ram_shift;
+    uint8_t char_eeprom_shift;
+    uint8_t misc_roms_size;
+    uint8_t default_expansion_device;
+    uint8_t console_type_info;      // byte 13 as is
+    uint8_t reserved;
+} nes_header_packed_t;
+
+_Static_assert(sizeof(nes_header_packed_t) == 32, "nes_header_packed_t is meant to be 32 bytes");
+
+static const uint8_t NES_HEADER_PACKED_FLAG_PERSISTENT_MEMORY = 0x01;
+static const uint8_t NES_HEADER_PACKED_FLAG_TRAINER = 0x02;
+
+// decodes num_headers headers stored back to back (16 bytes each) into out,
+// two at a time with AVX2 where the CPU has it. Returns how many were valid.
+size_t nes_header_parse_batch(const uint8_t *headers, size_t num_headers, nes_header_packed_t *out);
+
+// expands a packed record into the nes_header_t nes_header_parse would have
+// produced for the same header
+nes_header_result_t nes_header_unpack(const nes_header_packed_t *in, nes_header_t *out);
+
+// If the highest nibble of a 12-bit NES 2.0 ROM size is $f, exponent-
+// multiplier notation is used. See:
+// https://wiki.nesdev.com/w/index.php/NES_2.0#PRG-ROM_Area
+// The low byte is then EEEEEEMM and gives the size in bytes, 2^E * (MM*2+1),
+// which need not be a whole number of banks. Everything else counts banks of
+// 2^block_shift bytes. Returns the size in bytes; the largest encodable size
+// (2^63 * 7 bytes) does not fit in 64 bits and saturates to UINT64_MAX, which
+// no file can hold anyway.
+static inline uint64_t nes_header_decode_rom_bytes(uint16_t raw_size, uint8_t block_shift)
+{
+    if((raw_size & 0x0f00) != 0x0f00) return (uint64_t)raw_size << block_shift;
+    uint8_t exponent = (raw_size & 0x00fc) >> 2;
+    uint64_t multiplier = (raw_size & 0x0003) * 2 + 1;
+    if(multiplier > UINT64_MAX >> exponent) return UINT64_MAX;
+    return multiplier << exponent;
+}
+
+// the number of 2^block_shift byte banks needed to hold size bytes, counting a
+// partial last bank as a whole one
+static inline uint64_t nes_header_rom_banks(uint64_t size, uint8_t block_shift)
+{
+    return (size >> block_shift) + ((size & (((uint64_t)1 << block_shift) - 1)) != 0);
+}
+
+// the RAM/EEPROM size fields hold a shift count: 64 << (shift - 1) bytes, or
+// none for 0. Returns the size in 64-byte units, as nes_header_t keeps it.
+static inline uint16_t nes_header_decode_shift(uint8_t shift)
+{
+    return shift ? 1 << (shift - 1) : 0;
+}
+
+// A header decoded in place. The view is just a pointer to the 16 raw bytes,
+// which can sit anywhere, e.g. in the mmap of a ROM or a catalog, and every
+// accessor decodes its one field from them when called. Callers that only look
+// at a few fields, as filters on mapper and sizes do, never pay for the rest
+// or for copying a whole nes_header_t.
+//
+// Accessors give the values nes_header_parse would put in nes_header_t.
+// Fields only NES 2.0 headers carry read as 0 for iNES headers. The bytes must
+// stay valid (and unchanged) for as long as the view is used.
+typedef struct nes_header_view
+{
+    const uint8_t *raw;
+} nes_header_view_t;
+
+// checks the size and the magic number; nothing else is decoded
+nes_header_result_t nes_header_view_init(const void *header_buf, size_t header_buf_size, nes_header_view_t *out);
+
+// https://wiki.nesdev.com/w/index.php/NES_2.0#Identification
+static inline bool nes_header_view_is_nes_2(nes_header_view_t view)
+{
+    return (view.raw[7] & 0x0c) == 0x08;
+}
+
+static inline nes_header_type_t nes_header_view_type(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? NES_HEADER_TYPE_NES_2 : NES_HEADER_TYPE_INES;
+}
+
+static inline uint16_t nes_header_view_mapper_id(nes_header_view_t view)
+{
+    uint16_t mapper_id = (view.raw[6] >> 4) | (view.raw[7] & 0xf0);
+    if(nes_header_view_is_nes_2(view)) mapper_id |= (uint16_t)(view.raw[8] & 0x0f) << 8;
+    return mapper_id;
+}
+
+static inline uint8_t nes_header_view_submapper_id(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[8] >> 4 : 0;
+}
+
+// in bytes, like nes_header_t
+static inline uint64_t nes_header_view_prg_rom_bytes(nes_header_view_t view)
+{
+    if(!nes_header_view_is_nes_2(view)) return (uint64_t)view.raw[4] << NES_HEADER_PROG_ROM_BLOCK_SHIFT;
+    return nes_header_decode_rom_bytes(view.raw[4] | (uint16_t)(view.raw[9] & 0x0f) << 8, NES_HEADER_PROG_ROM_BLOCK_SHIFT);
+}
+
+// in bytes, like nes_header_t
+static inline uint64_t nes_header_view_char_rom_bytes(nes_header_view_t view)
+{
+    if(!nes_header_view_is_nes_2(view)) return (uint64_t)view.raw[5] << NES_HEADER_CHAR_ROM_BLOCK_SHIFT;
+    return nes_header_decode_rom_bytes(view.raw[5] | (uint16_t)(view.raw[9] & 0xf0) << 4, NES_HEADER_CHAR_ROM_BLOCK_SHIFT);
+}
+
+// in 16K banks, like nes_header_t
+static inline uint64_t nes_header_view_prg_rom_size(nes_header_view_t view)
+{
+    return nes_header_rom_banks(nes_header_view_prg_rom_bytes(view), NES_HEADER_PROG_ROM_BLOCK_SHIFT);
+}
+
+// in 8K banks, like nes_header_t
+static inline uint64_t nes_header_view_char_rom_size(nes_header_view_t view)
+{
+    return nes_header_rom_banks(nes_header_view_char_rom_bytes(view), NES_HEADER_CHAR_ROM_BLOCK_SHIFT);
+}
+
+static inline nes_header_nametable_mirroring_type_t nes_header_view_ntmt(nes_header_view_t view)
+{
+    if(view.raw[6] & 0x08) return NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING;
+    return view.raw[6] & 0x01 ? NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL : NES_HEADER_NAMETABLE_MIRRORING_TYPE_HORIZONTAL;
+}
+
+static inline bool nes_header_view_persistent_memory(nes_header_view_t view)
+{
+    return view.raw[6] & 0x02;
+}
+
+static inline bool nes_header_view_trainer(nes_header_view_t view)
+{
+    return view.raw[6] & 0x04;
+}
+
+static inline nes_header_console_type_t nes_header_view_ct(nes_header_view_t view)
+{
+    return (nes_header_console_type_t)(view.raw[7] & 0x03);
+}
+
+static inline nes_header_timing_type_t nes_header_view_tt(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? (nes_header_timing_type_t)(view.raw[12] & 0x03) : NES_HEADER_TIMING_TYPE_NTSC;
+}
+
+// the RAM and EEPROM sizes are in 64-byte units, like nes_header_t
+static inline uint16_t nes_header_view_prg_ram_size(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? nes_header_decode_shift(view.raw[10] & 0x0f) : 0;
+}
+
+static inline uint16_t nes_header_view_prg_eeprom_size(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? nes_header_decode_shift(view.raw[10] >> 4) : 0;
+}
+
+static inline uint16_t nes_header_view_char_ram_size(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? nes_header_decode_shift(view.raw[11] & 0x0f) : 0;
+}
+
+static inline uint16_t nes_header_view_char_eeprom_size(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? nes_header_decode_shift(view.raw[11] >> 4) : 0;
+}
+
+// only meaningful for Vs. System headers
+static inline uint8_t nes_header_view_vs_ppu_type(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[13] & 0x0f : 0;
+}
+
+static inline uint8_t nes_header_view_vs_hardware_type(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[13] >> 4 : 0;
+}
+
+// only meaningful for extended console type headers
+static inline uint8_t nes_header_view_extended_console_type(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[13] & 0x0f : 0;
+}
+
+static inline uint8_t nes_header_view_misc_roms_size(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[14] & 0x03 : 0;
+}
+
+static inline uint8_t nes_header_view_default_expansion_device(nes_header_view_t view)
+{
+    return nes_header_view_is_nes_2(view) ? view.raw[15] & 0x3f : 0;
+}
+
+// decodes every field into a nes_header_t, as nes_header_parse does
+void nes_header_view_decode(nes_header_view_t view, nes_header_t *out);
 
 #endif
@@ -0,0 +1,386 @@
+#include "nes_header_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NES_HEADER_TABLE_HAVE_AVX2
+#endif
+
+void nes_header_table_init(nes_header_table_t *table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+// grows every column by the same amount and zeroes the new tail
+static bool grow_column(void **column, size_t elem_size, size_t old_capacity, size_t new_capacity)
+{
+    void *grown = realloc(*column, new_capacity * elem_size);
+    if(!grown) return false;
+    memset((char *)grown + old_capacity * elem_size, 0, (new_capacity - old_capacity) * elem_size);
+    *column = grown;
+    return true;
+}
+
+static nes_header_table_result_t reserve(nes_header_table_t *table, size_t num_rows)
+{
+    if(num_rows <= table->capacity) return NES_HEADER_TABLE_RESULT_SUCCESS;
+    size_t new_capacity = table->capacity ? table->capacity : 1024;
+    while(new_capacity < num_rows) new_capacity *= 2;
+    size_t old_capacity = table->capacity;
+    // the columns that did grow stay valid either way, so capacity is only
+    // raised once all of them have
+    bool ok = grow_column((void **)&table->type, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->mapper_id, sizeof(uint16_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->submapper_id, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->prg_rom_size, sizeof(uint64_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->char_rom_size, sizeof(uint64_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->ntmt, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->persistent_memory, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->trainer, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->ct, sizeof(uint8_t), old_capacity, new_capacity)
+        && grow_column((void **)&table->tt, sizeof(uint8_t), old_capacity, new_capacity);
+    if(!ok) return NES_HEADER_TABLE_RESULT_ALLOC_ERR;
+    table->capacity = new_capacity;
+    return NES_HEADER_TABLE_RESULT_SUCCESS;
+}
+
+nes_header_table_result_t nes_header_table_append(nes_header_table_t *table, const nes_header_t *header)
+{
+    if(reserve(table, table->num_rows + 1)) return NES_HEADER_TABLE_RESULT_ALLOC_ERR;
+    size_t row = table->num_rows++;
+    bool nes_2 = header->type == NES_HEADER_TYPE_NES_2;
+    table->type[row] = header->type;
+    table->mapper_id[row] = header->mapper_id;
+    table->submapper_id[row] = nes_2 ? header->nes_2.submapper_id : 0;
+    table->prg_rom_size[row] = header->prg_rom_size;
+    table->char_rom_size[row] = header->char_rom_size;
+    table->ntmt[row] = header->ntmt;
+    table->persistent_memory[row] = header->persistent_memory;
+    table->trainer[row] = header->trainer;
+    table->ct[row] = header->ct;
+    table->tt[row] = nes_2 ? header->nes_2.tt : 0;
+    return NES_HEADER_TABLE_RESULT_SUCCESS;
+}
+
+nes_header_table_result_t nes_header_table_append_catalog(nes_header_table_t *table, const nes_catalog_t *catalog)
+{
+    if(reserve(table, table->num_rows + catalog->num_records)) return NES_HEADER_TABLE_RESULT_ALLOC_ERR;
+    size_t i;
+    for(i = 0; i < catalog->num_records; i++)
+    {
+        const nes_catalog_record_t *record = &catalog->records[i];
+        size_t row = table->num_rows++;
+        if(!(record->flags & NES_CATALOG_FLAG_HEADER_VALID)) continue; // stays all zero
+        table->type[row] = record->type;
+        table->mapper_id[row] = record->mapper_id;
+        table->submapper_id[row] = record->submapper_id;
+        table->prg_rom_size[row] = record->prg_rom_size;
+        table->char_rom_size[row] = record->char_rom_size;
+        table->ntmt[row] = record->ntmt;
+        table->persistent_memory[row] = record->persistent_memory;
+        table->trainer[row] = record->trainer;
+        table->ct[row] = record->ct;
+        table->tt[row] = record->tt;
+    }
+    return NES_HEADER_TABLE_RESULT_SUCCESS;
+}
+
+// a column as raw bytes plus its element width (1, 2 or 8)
+static const void *column(const nes_header_table_t *table, nes_catalog_field_t field, size_t *width_out)
+{
+    switch(field)
+    {
+    case NES_CATALOG_FIELD_TYPE:      *width_out = 1; return table->type;
+    case NES_CATALOG_FIELD_MAPPER:    *width_out = 2; return table->mapper_id;
+    case NES_CATALOG_FIELD_SUBMAPPER: *width_out = 1; return table->submapper_id;
+    case NES_CATALOG_FIELD_PRG:       *width_out = 8; return table->prg_rom_size;
+    case NES_CATALOG_FIELD_CHR:       *width_out = 8; return table->char_rom_size;
+    case NES_CATALOG_FIELD_MIRRORING: *width_out = 1; return table->ntmt;
+    case NES_CATALOG_FIELD_BATTERY:   *width_out = 1; return table->persistent_memory;
+    case NES_CATALOG_FIELD_TRAINER:   *width_out = 1; return table->trainer;
+    case NES_CATALOG_FIELD_CONSOLE:   *width_out = 1; return table->ct;
+    case NES_CATALOG_FIELD_TIMING:    *width_out = 1; return table->tt;
+    default:                          *width_out = 0; return NULL;
+    }
+}
+
+static uint64_t column_value(const void *col, size_t width, size_t row)
+{
+    if(width == 1) return ((const uint8_t *)col)[row];
+    if(width == 2) return ((const uint16_t *)col)[row];
+    return ((const uint64_t *)col)[row];
+}
+
+// Each of these returns the in-range bitmap of the 64 rows starting at col.
+// min <= max and both fit the column width.
+
+static uint64_t range_mask_8(const uint8_t *col, uint8_t min, uint8_t max)
+{
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i++) mask |= (uint64_t)(col[i] >= min && col[i] <= max) << i;
+    return mask;
+}
+
+static uint64_t range_mask_16(const uint16_t *col, uint16_t min, uint16_t max)
+{
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i++) mask |= (uint64_t)(col[i] >= min && col[i] <= max) << i;
+    return mask;
+}
+
+static uint64_t range_mask_64(const uint64_t *col, uint64_t min, uint64_t max)
+{
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i++) mask |= (uint64_t)(col[i] >= min && col[i] <= max) << i;
+    return mask;
+}
+
+#ifdef NES_HEADER_TABLE_HAVE_AVX2
+// unsigned x >= min is max(x, min) == x, x <= max is min(x, max) == x
+
+__attribute__((target("avx2")))
+static uint64_t range_mask_8_avx2(const uint8_t *col, uint8_t min, uint8_t max)
+{
+    const __m256i vmin = _mm256_set1_epi8((char)min);
+    const __m256i vmax = _mm256_set1_epi8((char)max);
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(col + i));
+        __m256i in = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, vmin), x), _mm256_cmpeq_epi8(_mm256_min_epu8(x, vmax), x));
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t range_mask_16_avx2(const uint16_t *col, uint16_t min, uint16_t max)
+{
+    const __m256i vmin = _mm256_set1_epi16((short)min);
+    const __m256i vmax = _mm256_set1_epi16((short)max);
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(col + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(col + i + 16));
+        __m256i in_a = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(a, vmin), a), _mm256_cmpeq_epi16(_mm256_min_epu16(a, vmax), a));
+        __m256i in_b = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(b, vmin), b), _mm256_cmpeq_epi16(_mm256_min_epu16(b, vmax), b));
+        // packs works per 128-bit lane, the permute puts the rows back in order
+        __m256i in = _mm256_permute4x64_epi64(_mm256_packs_epi16(in_a, in_b), 0xd8);
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t range_mask_64_avx2(const uint64_t *col, uint64_t min, uint64_t max)
+{
+    // AVX2 only has a signed 64-bit compare, so flip the sign bits first
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i vmin = _mm256_set1_epi64x((long long)(min ^ 0x8000000000000000ULL));
+    const __m256i vmax = _mm256_set1_epi64x((long long)(max ^ 0x8000000000000000ULL));
+    uint64_t mask = 0;
+    int i;
+    for(i = 0; i < 64; i += 4)
+    {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(col + i)), sign);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(vmin, x), _mm256_cmpgt_epi64(x, vmax));
+        mask |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf) << i;
+    }
+    return mask;
+}
+#endif
+
+static bool use_avx2;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void)
+{
+    use_avx2 = cpu_features_get()->avx2;
+}
+
+size_t nes_header_table_selection_words(const nes_header_table_t *table)
+{
+    return (table->num_rows + 63) / 64;
+}
+
+static void apply_predicate(const nes_header_table_t *table, const nes_header_table_predicate_t *predicate, uint64_t *selection, size_t num_words)
+{
+    size_t width;
+    const void *col = column(table, predicate->field, &width);
+    uint64_t width_max = width == 1 ? 0xff : width == 2 ? 0xffff : UINT64_MAX;
+    if(!col || predicate->min > predicate->max || predicate->min > width_max)
+    {
+        memset(selection, 0, num_words * sizeof(uint64_t));
+        return;
+    }
+    uint64_t min = predicate->min;
+    uint64_t max = predicate->max < width_max ? predicate->max : width_max;
+
+    size_t w;
+    for(w = 0; w < num_words; w++)
+    {
+        if(!selection[w]) continue;
+        size_t row = w * 64;
+        uint64_t mask;
+#ifdef NES_HEADER_TABLE_HAVE_AVX2
+        if(use_avx2)
+        {
+            if(width == 1) mask = range_mask_8_avx2((const uint8_t *)col + row, min, max);
+            else if(width == 2) mask = range_mask_16_avx2((const uint16_t *)col + row, min, max);
+            else mask = range_mask_64_avx2((const uint64_t *)col + row, min, max);
+        }
+        else
+#endif
+        {
+            if(width == 1) mask = range_mask_8((const uint8_t *)col + row, min, max);
+            else if(width == 2) mask = range_mask_16((const uint16_t *)col + row, min, max);
+            else mask = range_mask_64((const uint64_t *)col + row, min, max);
+        }
+        selection[w] &= mask;
+    }
+}
+
+void nes_header_table_filter(
+    const nes_header_table_t *table,
+    const nes_header_table_predicate_t *predicates,
+    size_t num_predicates,
+    uint64_t *selection_out)
+{
+    pthread_once(&init_once, init);
+    size_t num_words = nes_header_table_selection_words(table);
+    if(!num_words) return;
+    memset(selection_out, 0xff, num_words * sizeof(uint64_t));
+    // the padding rows past num_rows are never selected
+    if(table->num_rows % 64) selection_out[num_words - 1] = (UINT64_C(1) << (table->num_rows % 64)) - 1;
+
+    size_t i;
+    for(i = 0; i < num_predicates; i++) apply_predicate(table, &predicates[i], selection_out, num_words);
+}
+
+size_t nes_header_table_predicates_from_filter(const nes_catalog_filter_t *filter, nes_header_table_predicate_t *predicates_out)
+{
+    size_t num_predicates = 0;
+    // rows without a valid header have type 0 and must never match
+    predicates_out[num_predicates++] = (nes_header_table_predicate_t){ .field = NES_CATALOG_FIELD_TYPE, .min = NES_HEADER_TYPE_INES, .max = NES_HEADER_TYPE_NES_2 };
+    uint32_t field;
+    for(field = 0; field < NES_CATALOG_FIELD_COUNT; field++)
+    {
+        if(!(filter->fields_set & (1u << field))) continue;
+        if(field == NES_CATALOG_FIELD_TYPE) num_predicates = 0; // replaces the validity test above
+        predicates_out[num_predicates++] = (nes_header_table_predicate_t){ .field = (nes_catalog_field_t)field, .min = filter->values[field], .max = filter->values[field] };
+    }
+    return num_predicates;
+}
+
+size_t nes_header_table_count(const nes_header_table_t *table, const uint64_t *selection)
+{
+    size_t count = 0;
+    size_t w;
+    for(w = 0; w < nes_header_table_selection_words(table); w++) count += __builtin_popcountll(selection[w]);
+    return count;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+nes_header_table_result_t nes_header_table_group_count(
+    const nes_header_table_t *table,
+    const uint64_t *selection,
+    nes_catalog_field_t field,
+    nes_header_table_group_t **groups_out,
+    size_t *num_groups_out)
+{
+    *groups_out = NULL;
+    *num_groups_out = 0;
+    size_t width;
+    const void *col = column(table, field, &width);
+    if(!col) return NES_HEADER_TABLE_RESULT_SUCCESS;
+
+    // narrow columns are counted directly into a table indexed by value, wide
+    // ones are sorted and run-length counted
+    size_t num_selected = nes_header_table_count(table, selection);
+    size_t domain = width == 1 ? 0x100 : width == 2 ? 0x10000 : 0;
+    size_t *counts = domain ? calloc(domain, sizeof(size_t)) : NULL;
+    uint64_t *values = domain ? NULL : malloc((num_selected ? num_selected : 1) * sizeof(uint64_t));
+    if(domain ? !counts : !values)
+    {
+        free(counts);
+        free(values);
+        return NES_HEADER_TABLE_RESULT_ALLOC_ERR;
+    }
+
+    size_t num_values = 0;
+    size_t w;
+    for(w = 0; w < nes_header_table_selection_words(table); w++)
+    {
+        uint64_t bits = selection[w];
+        while(bits)
+        {
+            size_t row = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint64_t value = column_value(col, width, row);
+            if(domain) counts[value]++;
+            else values[num_values++] = value;
+        }
+    }
+
+    nes_header_table_group_t *groups = NULL;
+    size_t num_groups = 0;
+    if(domain)
+    {
+        size_t v;
+        for(v = 0; v < domain; v++) num_groups += counts[v] != 0;
+        groups = malloc((num_groups ? num_groups : 1) * sizeof(nes_header_table_group_t));
+        num_groups = 0;
+        for(v = 0; groups && v < domain; v++)
+            if(counts[v]) groups[num_groups++] = (nes_header_table_group_t){ .value = v, .count = counts[v] };
+    }
+    else
+    {
+        qsort(values, num_values, sizeof(uint64_t), compare_u64);
+        groups = malloc((num_values ? num_values : 1) * sizeof(nes_header_table_group_t));
+        size_t i;
+        for(i = 0; groups && i < num_values; i++)
+        {
+            if(num_groups && groups[num_groups - 1].value == values[i]) groups[num_groups - 1].count++;
+            else groups[num_groups++] = (nes_header_table_group_t){ .value = values[i], .count = 1 };
+        }
+    }
+    free(counts);
+    free(values);
+    if(!groups) return NES_HEADER_TABLE_RESULT_ALLOC_ERR;
+    *groups_out = groups;
+    *num_groups_out = num_groups;
+    return NES_HEADER_TABLE_RESULT_SUCCESS;
+}
+
+void nes_header_table_clear(nes_header_table_t *table)
+{
+    free(table->type);
+    free(table->mapper_id);
+    free(table->submapper_id);
+    free(table->prg_rom_size);
+    free(table->char_rom_size);
+    free(table->ntmt);
+    free(table->persistent_memory);
+    free(table->trainer);
+    free(table->ct);
+    free(table->tt);
+    nes_header_table_init(table);
+}
@@ -1,84 +1,377 @@
 #include "nes_mapper.h"
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "nes_mapper_00000.h"
+#include "nes_mapper_00001.h"
+#include "nes_mapper_00002.h"
+#include "nes_mapper_00003.h"
+#include "nes_mapper_00004.h"
 
 /*  TEMPLATE FOR MAPPER .c FILE IMPLEMENTATIONS
-static nes_mapper_result_t procw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+static nes_mapper_result_t cpuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
 {
 
 }
 
-static nes_mapper_result_t procr8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
+static nes_mapper_result_t cpur8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
 {
 
 }
 
-static nes_mapper_result_t procr16(nes_mapper_t *self, uint16_t addr, uint8_t *out_buf, size_t out_buf_size)
+static nes_mapper_result_t ppuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
 {
 
 }
 
-static nes_mapper_result_t procr24(nes_mapper_t *self, uint16_t addr, uint8_t *out_buf, size_t out_buf_size)
+static nes_mapper_result_t ppur8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
 {
 
 }
 
-static nes_mapper_result_t procgf(nes_mapper_t *self, uint16_t addr, uint8_t *flags_out, uint16_t *start_addr_out, uint16_t *end_addr_out)
+static void scln(nes_mapper_t *self)
 {
 
 }
 
-static nes_mapper_result_t ppuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+static void clr(nes_mapper_t *self)
 {
 
 }
+*/
+/*  TEMPLATE FOR MAPPER VTABLE ASSIGNMENTS
+static const nes_mapper_iface_t NES_MAPPER_VT =
+{
+    .cpu_write_8 = cpuw8,
+    .cpu_read_8 =  cpur8,
+    .ppu_write_8 = ppuw8,
+    .ppu_read_8 =  ppur8,
+    .scanline =    scln,  // or NULL
+    .clear =       clr
+};
+*/
 
-static nes_mapper_result_t ppur8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
+void nes_mapper_init(nes_mapper_t *mapper, const nes_mapper_iface_t *vtable, nes_rom_t *rom)
 {
+    memset(mapper, 0, sizeof(*mapper));
+    mapper->vtable = vtable;
+    mapper->rom = nes_rom_retain(rom);
+    nes_mapper_map_cpu(mapper, NES_MAPPER_RAM_MIRROR_INFO.start, NES_MAPPER_RAM_MIRROR_INFO.len * NES_MAPPER_RAM_MIRROR_INFO.num_mirrors,
+        mapper->ram, mapper->ram, NES_MAPPER_RAM_MIRROR_INFO.len);
+    switch(rom->header.ntmt)
+    {
+    case NES_HEADER_NAMETABLE_MIRRORING_TYPE_VERTICAL:     nes_mapper_set_mirroring(mapper, NES_MAPPER_MIRRORING_VERTICAL); break;
+    case NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING: nes_mapper_set_mirroring(mapper, NES_MAPPER_MIRRORING_FOUR_SCREEN); break;
+    default:                                               nes_mapper_set_mirroring(mapper, NES_MAPPER_MIRRORING_HORIZONTAL); break;
+    }
+}
 
+static void map_pages(nes_mapper_page_t *pages, uint16_t addr, uint32_t len, const uint8_t *read, uint8_t *write, uint32_t mem_len)
+{
+    nes_mapper_page_t *page = &pages[addr >> NES_MAPPER_PAGE_SHIFT];
+    nes_mapper_page_t *end = page + (len >> NES_MAPPER_PAGE_SHIFT);
+    // where in mem the page is, wrapped without a division per page: bank
+    // switches come through here many times a frame
+    uint32_t mem_offset = 0;
+    for(; page < end; page++)
+    {
+        page->read = read ? read + mem_offset : NULL;
+        page->write = write ? write + mem_offset : NULL;
+        mem_offset += NES_MAPPER_PAGE_SIZE;
+        if(mem_offset == mem_len) mem_offset = 0;
+    }
 }
 
-static nes_mapper_result_t ppugf(nes_mapper_t *self, uint16_t addr, uint8_t *flags_out, uint16_t *start_addr_out, uint16_t *end_addr_out)
+void nes_mapper_map_cpu(nes_mapper_t *mapper, uint16_t addr, uint32_t len, const uint8_t *read, uint8_t *write, uint32_t mem_len)
 {
+    map_pages(mapper->cpu_pages, addr, len, read, write, mem_len);
+}
 
+void nes_mapper_map_ppu(nes_mapper_t *mapper, uint16_t addr, uint32_t len, const uint8_t *read, uint8_t *write, uint32_t mem_len)
+{
+    map_pages(mapper->ppu_pages, addr, len, read, write, mem_len);
 }
 
-static nes_mapper_result_t clr(nes_mapper_t *self)
+void nes_mapper_map_prg(nes_mapper_t *mapper, uint16_t addr, uint32_t len, size_t bank)
 {
+    const uint8_t *bank_ptr = mapper->rom->prg_rom + bank % nes_mapper_prg_banks(mapper, len) * len;
+    nes_mapper_map_cpu(mapper, addr, len, bank_ptr, NULL, len);
+}
 
+void nes_mapper_map_chr(nes_mapper_t *mapper, uint16_t addr, uint32_t len, size_t bank, uint8_t *chr_ram, size_t chr_ram_size)
+{
+    if(mapper->rom->chr_rom)
+    {
+        size_t num_banks = mapper->rom->chr_rom_size / len;
+        nes_mapper_map_ppu(mapper, addr, len, mapper->rom->chr_rom + bank % num_banks * len, NULL, len);
+    }
+    else
+    {
+        uint8_t *bank_ptr = chr_ram + bank % (chr_ram_size / len) * len;
+        nes_mapper_map_ppu(mapper, addr, len, bank_ptr, bank_ptr, len);
+    }
 }
-*/
-/*  TEMPLATE FOR MAPPER VTABLE ASSIGNMENTS
-static const nes_mapper_iface_t NES_MAPPER_VT = 
-{
-    .proc_write_8 =   procw8,
-    .proc_read_8 =    procr8,
-    .proc_read_16 =   procr16,
-    .proc_read_24 =   procr24,
-    .proc_get_flags = procgf,
-    .ppu_write_8 =    ppuw8,
-    .ppu_read_8 =     ppur8,
-    .ppu_get_flags =  ppugf,
-    .clear =          clr
+
+// which 1K of VRAM each nametable is, by nes_mapper_mirroring_t
+static const uint8_t NAMETABLE_BLOCKS[][4] =
+{
+    {0, 0, 1, 1},
+    {0, 1, 0, 1},
+    {0, 0, 0, 0},
+    {1, 1, 1, 1},
+    {0, 1, 2, 3}
 };
-*/
 
-nes_mapper_result_t nes_mapper_create(
-    uint16_t mapper_id,
-    uint8_t submapper_id,
-    char *prg_rom_array,
-    size_t prg_rom_size,
-    char *chr_rom_array,
-    size_t chr_rom_size,
-    nes_mapper_t **result)
+void nes_mapper_set_mirroring(nes_mapper_t *mapper, nes_mapper_mirroring_t mirroring)
+{
+    size_t i;
+    for(i = 0; i < 4; i++)
+    {
+        uint8_t *block = mapper->vram + NAMETABLE_BLOCKS[mirroring][i] * 0x400;
+        nes_mapper_map_ppu(mapper, 0x2000 + i * 0x400, 0x400, block, block, 0x400);
+        // the mirror stops short of the palette
+        nes_mapper_map_ppu(mapper, 0x3000 + i * 0x400, i < 3 ? 0x400 : 0x300, block, block, 0x400);
+    }
+}
+
+// the address passed into this should already have its mirrors handled.
+static bool cpu_addr_is_read_only(uint16_t addr)
+{
+    return addr == 0x2002
+        || addr == 0x4018
+        || addr == 0x4019
+        || addr >= 0x8000;
+}
+
+static bool cpu_addr_is_unmapped(uint16_t addr)
+{
+    return addr >= 0x4020
+        && addr <  0x8000;
+}
+
+// the register behind addr, which must be mapped and below $8000
+static uint8_t *cpu_reg(nes_mapper_t *self, uint16_t addr)
+{
+    if(addr < 0x4000) return &self->ppu_regs[addr - NES_MAPPER_PPU_REG_MIRROR_INFO.start];
+    return &self->io_regs[addr - 0x4000];
+}
+
+nes_mapper_result_t nes_mapper_default_cpu_write_8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    addr = mem_mirror_collapse(&NES_MAPPER_PPU_REG_MIRROR_INFO, addr);
+    if(cpu_addr_is_read_only(addr)) return NES_MAPPER_RESULT_WRITE_TO_READ_ONLY;
+    if(cpu_addr_is_unmapped(addr)) return NES_MAPPER_RESULT_ADDR_UNMAPPED;
+    *cpu_reg(self, addr) = in;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+nes_mapper_result_t nes_mapper_default_cpu_read_8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
+{
+    addr = mem_mirror_collapse(&NES_MAPPER_PPU_REG_MIRROR_INFO, addr);
+    if(cpu_addr_is_unmapped(addr) || addr >= 0x8000) return NES_MAPPER_RESULT_ADDR_UNMAPPED;
+    *out = *cpu_reg(self, addr);
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+// the palette entry behind addr, which must be at $3f00 or above: the palette
+// mirrors every 32 bytes, and the first color of each sprite palette is that
+// of the background palette below it
+static uint8_t *palette_entry(nes_mapper_t *self, uint16_t addr)
+{
+    uint16_t index = addr & 0x1f;
+    if((index & 0x13) == 0x10) index &= 0x0f;
+    return &self->palette[index];
+}
+
+nes_mapper_result_t nes_mapper_default_ppu_write_8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    addr &= NES_MAPPER_PPU_ADDR_MASK;
+    if(addr < 0x3f00) return NES_MAPPER_RESULT_WRITE_TO_READ_ONLY;
+    *palette_entry(self, addr) = in;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+nes_mapper_result_t nes_mapper_default_ppu_read_8(nes_mapper_t *self, uint16_t addr, uint8_t *out)
+{
+    addr &= NES_MAPPER_PPU_ADDR_MASK;
+    if(addr < 0x3f00) return NES_MAPPER_RESULT_ADDR_UNMAPPED;
+    *out = *palette_entry(self, addr);
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+nes_mapper_result_t nes_mapper_create(nes_rom_t *rom, nes_mapper_t **result)
 {
-    switch(mapper_id)
+    const nes_header_t *header = &rom->header;
+    uint8_t submapper_id = header->type == NES_HEADER_TYPE_NES_2 ? header->nes_2.submapper_id : 0;
+    switch(header->mapper_id)
     {
     case 0:
-        return nes_mapper_00000_create(submapper_id, prg_rom_array, prg_rom_size, chr_rom_array, chr_rom_size, result);
-        break;
+        return nes_mapper_00000_create(submapper_id, rom, result);
+    case 1:
+        return nes_mapper_00001_create(submapper_id, rom, result);
+    case 2:
+        return nes_mapper_00002_create(submapper_id, rom, result);
+    case 3:
+        return nes_mapper_00003_create(submapper_id, rom, result);
+    case 4:
+        return nes_mapper_00004_create(submapper_id, rom, result);
     default:
         return NES_MAPPER_RESULT_UNSUPPORTED_MAPPER_ID;
     }
+}
+
+// one side of the bus: its page table, and the mask that wraps its addresses
+typedef struct bus
+{
+    const nes_mapper_page_t *pages;
+    uint16_t addr_mask;
+} bus_t;
+
+static bus_t cpu_bus(const nes_mapper_t *mapper)
+{
+    return (bus_t){ mapper->cpu_pages, 0xffff };
+}
+
+static bus_t ppu_bus(const nes_mapper_t *mapper)
+{
+    return (bus_t){ mapper->ppu_pages, NES_MAPPER_PPU_ADDR_MASK };
+}
+
+// the memory behind addr (already masked) in the read or the write pointers,
+// and how far it runs on through the pages that follow it in memory too
+static uint8_t *bus_run(bus_t bus, uint16_t addr, bool write, size_t *len)
+{
+    size_t num_pages = ((size_t)bus.addr_mask + 1) >> NES_MAPPER_PAGE_SHIFT;
+    size_t first = addr >> NES_MAPPER_PAGE_SHIFT;
+    uint8_t *start = write ? bus.pages[first].write : (uint8_t *)bus.pages[first].read;
+    if(!start) return NULL;
+    size_t i;
+    for(i = first + 1; i < num_pages; i++)
+    {
+        uint8_t *next = write ? bus.pages[i].write : (uint8_t *)bus.pages[i].read;
+        if(next != start + (i - first) * NES_MAPPER_PAGE_SIZE) break;
+    }
+    size_t in_page = addr & (NES_MAPPER_PAGE_SIZE - 1);
+    *len = (i - first) * NES_MAPPER_PAGE_SIZE - in_page;
+    return start + in_page;
+}
+
+// bytes from addr to the end of its page, at most len
+static size_t page_rest(uint16_t addr, size_t len)
+{
+    size_t rest = NES_MAPPER_PAGE_SIZE - (addr & (NES_MAPPER_PAGE_SIZE - 1));
+    return rest < len ? rest : len;
+}
+
+static nes_mapper_result_t read_span(
+    nes_mapper_t *mapper,
+    bus_t bus,
+    nes_mapper_result_t (*handler)(nes_mapper_t *self, uint16_t addr, uint8_t *out),
+    uint16_t addr,
+    uint8_t *out,
+    size_t len)
+{
+    while(len)
+    {
+        addr &= bus.addr_mask;
+        size_t seg_len;
+        const uint8_t *src = bus_run(bus, addr, false, &seg_len);
+        if(src)
+        {
+            if(seg_len > len) seg_len = len;
+            memcpy(out, src, seg_len);
+        }
+        else
+        {
+            seg_len = page_rest(addr, len);
+            size_t i;
+            for(i = 0; i < seg_len; i++)
+            {
+                nes_mapper_result_t result = handler(mapper, addr + i, out + i);
+                if(result) return result;
+            }
+        }
+        addr += seg_len;
+        out += seg_len;
+        len -= seg_len;
+    }
     return NES_MAPPER_RESULT_SUCCESS;
-}
\ No newline at end of file
+}
+
+static nes_mapper_result_t write_span(
+    nes_mapper_t *mapper,
+    bus_t bus,
+    nes_mapper_result_t (*handler)(nes_mapper_t *self, uint16_t addr, uint8_t in),
+    uint16_t addr,
+    const uint8_t *in,
+    size_t len)
+{
+    while(len)
+    {
+        addr &= bus.addr_mask;
+        size_t seg_len;
+        uint8_t *dst = bus_run(bus, addr, true, &seg_len);
+        if(dst)
+        {
+            if(seg_len > len) seg_len = len;
+            memcpy(dst, in, seg_len);
+        }
+        else
+        {
+            seg_len = page_rest(addr, len);
+            size_t i;
+            for(i = 0; i < seg_len; i++)
+            {
+                nes_mapper_result_t result = handler(mapper, addr + i, in[i]);
+                if(result) return result;
+            }
+        }
+        addr += seg_len;
+        in += seg_len;
+        len -= seg_len;
+    }
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+nes_mapper_result_t nes_mapper_cpu_read_span(nes_mapper_t *mapper, uint16_t addr, uint8_t *out, size_t len)
+{
+    return read_span(mapper, cpu_bus(mapper), mapper->vtable->cpu_read_8, addr, out, len);
+}
+
+nes_mapper_result_t nes_mapper_cpu_write_span(nes_mapper_t *mapper, uint16_t addr, const uint8_t *in, size_t len)
+{
+    return write_span(mapper, cpu_bus(mapper), mapper->vtable->cpu_write_8, addr, in, len);
+}
+
+nes_mapper_result_t nes_mapper_ppu_read_span(nes_mapper_t *mapper, uint16_t addr, uint8_t *out, size_t len)
+{
+    return read_span(mapper, ppu_bus(mapper), mapper->vtable->ppu_read_8, addr, out, len);
+}
+
+nes_mapper_result_t nes_mapper_ppu_write_span(nes_mapper_t *mapper, uint16_t addr, const uint8_t *in, size_t len)
+{
+    return write_span(mapper, ppu_bus(mapper), mapper->vtable->ppu_write_8, addr, in, len);
+}
+
+const uint8_t *nes_mapper_cpu_peek(const nes_mapper_t *mapper, uint16_t addr, size_t *len)
+{
+    return bus_run(cpu_bus(mapper), addr, false, len);
+}
+
+const uint8_t *nes_mapper_ppu_peek(const nes_mapper_t *mapper, uint16_t addr, size_t *len)
+{
+    return bus_run(ppu_bus(mapper), addr & NES_MAPPER_PPU_ADDR_MASK, false, len);
+}
+
+void nes_mapper_scanline(nes_mapper_t *mapper)
+{
+    if(mapper->vtable->scanline) mapper->vtable->scanline(mapper);
+}
+
+void nes_mapper_clear(nes_mapper_t *mapper)
+{
+    nes_rom_t *rom = mapper->rom;
+    mapper->vtable->clear(mapper);
+    nes_rom_release(rom);
+}
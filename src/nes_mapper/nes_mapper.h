@@ -2,78 +2,223 @@
 #define NES_MAPPER_H
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include "../mem_mirror.h"
+#include "../nes_header.h"
+#include "../nes_rom.h"
 
-typedef struct nes_mapper_result
+typedef enum nes_mapper_result
 {
     NES_MAPPER_RESULT_SUCCESS = 0,
     NES_MAPPER_RESULT_UNSUPPORTED_MAPPER_ID,
     NES_MAPPER_RESULT_ROM_SIZE_MAPPER_INCOMPATIBILITY,
     NES_MAPPER_RESULT_WRITE_TO_READ_ONLY,
     NES_MAPPER_RESULT_ADDR_UNMAPPED,
-    NES_MAPPER_RESULT_BUFFER_TOO_SMALL
+    NES_MAPPER_RESULT_BUFFER_TOO_SMALL,
+    NES_MAPPER_RESULT_ALLOC_ERR
 } nes_mapper_result_t;
+static const char *const NES_MAPPER_RESULT_STR[] = {"success", "unsupported mapper", "ROM size does not fit the mapper", "write to read-only memory", "address is not mapped", "buffer too small", "memory allocation failed"};
 
-typedef struct nes_mapper_mem_flags
+// The CPU bus is a page table: the 64K address space is split into 256 pages
+// of 256 bytes, and each page holds a pointer to the memory behind it, one for
+// reads and one for writes. RAM and its mirrors, PRG-ROM and PRG-RAM are all
+// plain memory, so reading them is an indexed load off the page pointer, with
+// no range compares on the way. A NULL pointer marks a page that only the
+// mapper's handler can serve (the PPU and APU registers, writes to ROM that
+// bank switching mappers watch, unmapped space), which is the slow path.
+//
+// The PPU's 16K address space is paged the same way, 64 pages: CHR banks and
+// the nametables with their mirrors are plain memory, and the palette page,
+// which mirrors every 32 bytes, is left to the handler.
+//
+// Mappers switch banks by pointing pages elsewhere with nes_mapper_map_cpu and
+// nes_mapper_map_ppu.
+#define NES_MAPPER_PAGE_SHIFT 8
+#define NES_MAPPER_PAGE_SIZE (1 << NES_MAPPER_PAGE_SHIFT)
+#define NES_MAPPER_CPU_NUM_PAGES (0x10000 >> NES_MAPPER_PAGE_SHIFT)
+#define NES_MAPPER_PPU_ADDR_MASK 0x3fff
+#define NES_MAPPER_PPU_NUM_PAGES ((NES_MAPPER_PPU_ADDR_MASK + 1) >> NES_MAPPER_PAGE_SHIFT)
+
+typedef struct nes_mapper_page
 {
-    uint8_t read: 1;
-    uint8_t write: 1;
-    uint8_t persistent: 1;
-} nes_mapper_mem_flags_t;
+    const uint8_t *read;  // the page's bytes for reads, or NULL for the handler
+    uint8_t *write;       // the page's bytes for writes, or NULL for the handler
+} nes_mapper_page_t;
 
 typedef struct nes_mapper_iface nes_mapper_iface_t;
 typedef struct nes_mapper nes_mapper_t;
 struct nes_mapper_iface
 {
-    (nes_mapper_result_t)(*cpu_write_8)(nes_mapper_t *self, uint16_t addr, uint8_t in);
-    (nes_mapper_result_t)(*cpu_read_8)(nes_mapper_t *self, uint16_t addr, uint8_t *out);
-    (nes_mapper_result_t)(*cpu_read_16)(nes_mapper_t *self, uint16_t addr, uint8_t *out_buf, size_t out_buf_size);
-    (nes_mapper_result_t)(*cpu_read_24)(nes_mapper_t *self, uint16_t addr, uint8_t *out_buf, size_t out_buf_size);
-    // gets the flags (read, write, persistent) for the given address as well as the start of
-    // the block of address space for which these flags persist and 
-    (nes_mapper_result_t)(*cpu_get_flags)(nes_mapper_t *self, uint16_t addr, uint8_t *flags_out, uint16_t *start_addr_out, uint16_t *end_addr_out);
-
-    (nes_mapper_result_t)(*ppu_write_8)(nes_mapper_t *self, uint16_t addr, uint8_t in);
-    (nes_mapper_result_t)(*ppu_read_8)(nes_mapper_t *self, uint16_t addr, uint8_t *out);
-    // gets the flags (read, write, persistent) for the given address as well as the start of
-    // the block of address space for which these flags persist and 
-    (nes_mapper_result_t)(*ppu_get_flags)(nes_mapper_t *self, uint16_t addr, uint8_t *flags_out, uint16_t *start_addr_out, uint16_t *end_addr_out);
-
-    // releases all resources that this object allocated
-    (nes_mapper_result_t)(*clear)(nes_mapper_t *self);
+    // the slow path of the CPU bus, for the pages without a read (or write)
+    // pointer
+    nes_mapper_result_t (*cpu_write_8)(nes_mapper_t *self, uint16_t addr, uint8_t in);
+    nes_mapper_result_t (*cpu_read_8)(nes_mapper_t *self, uint16_t addr, uint8_t *out);
+
+    nes_mapper_result_t (*ppu_write_8)(nes_mapper_t *self, uint16_t addr, uint8_t in);
+    nes_mapper_result_t (*ppu_read_8)(nes_mapper_t *self, uint16_t addr, uint8_t *out);
+
+    // clocked once per rendered scanline, for mappers that count them (MMC3's
+    // IRQ). NULL for the others.
+    void (*scanline)(nes_mapper_t *self);
+
+    // releases all resources that this object allocated, itself included
+    void (*clear)(nes_mapper_t *self);
 };
 
-const mem_mirror_info_t NES_MAPPER_RAM_MIRROR_INFO = 
+// how the four 1K nametables at $2000-$2fff share VRAM
+typedef enum nes_mapper_mirroring
+{
+    NES_MAPPER_MIRRORING_HORIZONTAL = 0,
+    NES_MAPPER_MIRRORING_VERTICAL,
+    NES_MAPPER_MIRRORING_SINGLE_LOWER,
+    NES_MAPPER_MIRRORING_SINGLE_UPPER,
+    NES_MAPPER_MIRRORING_FOUR_SCREEN
+} nes_mapper_mirroring_t;
+
+// the 2K of internal RAM, mirrored up to $1fff
+static const mem_mirror_info_t NES_MAPPER_RAM_MIRROR_INFO =
 {
     .start = 0,
     .len = 0x0800,
     .num_mirrors = 4
 };
 
+// the 8 PPU registers, mirrored up to $3fff
+static const mem_mirror_info_t NES_MAPPER_PPU_REG_MIRROR_INFO =
+{
+    .start = 0x2000,
+    .len = 8,
+    .num_mirrors = 0x400
+};
+
+// What one running instance owns. ROM is never copied in: the pages point into
+// the shared image, so an instance is its page tables plus RAM, VRAM and OAM.
 struct nes_mapper
 {
-    nes_mapper_iface_t *vtable;
-    uint8_t cpu_addr_space[0x10000];
-    uint16_t cpu_last_addr;
-    uint8_t ppu_addr_space[0x4000];
-    uint16_t ppu_last_addr;
+    const nes_mapper_iface_t *vtable;
+    nes_rom_t *rom;  // a reference, dropped by nes_mapper_clear
+    nes_mapper_page_t cpu_pages[NES_MAPPER_CPU_NUM_PAGES];
+    nes_mapper_page_t ppu_pages[NES_MAPPER_PPU_NUM_PAGES];
+    uint8_t ram[0x0800];
+    uint8_t ppu_regs[8];     // $2000-$2007, mirrored up to $3fff
+    uint8_t io_regs[0x20];   // $4000-$401f
+    uint8_t vram[0x1000];    // the nametables; only four-screen boards use all 4K
+    uint8_t palette[0x20];   // $3f00-$3f1f
     uint8_t oam_mem[0x100];
-    uint8_t oam_last_addr;
+    bool irq;                // the mapper is asserting the CPU's IRQ line
 };
 
+// sets up what every mapper has in common: the vtable, a reference to rom,
+// RAM with its mirrors in the CPU page table and the nametables in the PPU's,
+// mirrored as the header says. Every other page starts out on the slow path.
+void nes_mapper_init(nes_mapper_t *mapper, const nes_mapper_iface_t *vtable, nes_rom_t *rom);
+
+// points the pages of [addr, addr + len) at mem, repeated as often as it
+// takes to fill the range (len a multiple of mem_len, mem_len a multiple of
+// the page size). Either pointer may be NULL to send that direction of the
+// range to the handler.
+void nes_mapper_map_cpu(nes_mapper_t *mapper, uint16_t addr, uint32_t len, const uint8_t *read, uint8_t *write, uint32_t mem_len);
+void nes_mapper_map_ppu(nes_mapper_t *mapper, uint16_t addr, uint32_t len, const uint8_t *read, uint8_t *write, uint32_t mem_len);
+
+// Bank switching is repointing pages: the CPU pages of [addr, addr + len) at
+// PRG-ROM bank `bank` of len bytes, and the PPU pages at CHR bank `bank` of len
+// bytes. Bank numbers wrap around the size of the ROM, as the unconnected
+// high bits of a bank register do on a smaller board. A cartridge without
+// CHR-ROM has chr_ram_size bytes of CHR-RAM at chr_ram instead, which is
+// mapped writable. Either costs len / NES_MAPPER_PAGE_SIZE pointer stores,
+// whatever is in the bank, and never allocates.
+void nes_mapper_map_prg(nes_mapper_t *mapper, uint16_t addr, uint32_t len, size_t bank);
+void nes_mapper_map_chr(nes_mapper_t *mapper, uint16_t addr, uint32_t len, size_t bank, uint8_t *chr_ram, size_t chr_ram_size);
+
+// PRG-ROM banks of len bytes, e.g. to find the last one
+static inline size_t nes_mapper_prg_banks(const nes_mapper_t *mapper, uint32_t len)
+{
+    return mapper->rom->prg_rom_size / len;
+}
+
+// points the nametables and their mirrors at $3000-$3eff into VRAM, for the
+// mappers that switch mirroring at run time
+void nes_mapper_set_mirroring(nes_mapper_t *mapper, nes_mapper_mirroring_t mirroring);
+
+// The handler accesses that are the same on every board: the PPU and APU/IO
+// registers, unmapped space and writes to PRG-ROM on the CPU side, the palette
+// and writes to CHR-ROM on the PPU side. A mapper puts these in its vtable, or
+// calls them for whatever it does not handle itself.
+nes_mapper_result_t nes_mapper_default_cpu_write_8(nes_mapper_t *self, uint16_t addr, uint8_t in);
+nes_mapper_result_t nes_mapper_default_cpu_read_8(nes_mapper_t *self, uint16_t addr, uint8_t *out);
+nes_mapper_result_t nes_mapper_default_ppu_write_8(nes_mapper_t *self, uint16_t addr, uint8_t in);
+nes_mapper_result_t nes_mapper_default_ppu_read_8(nes_mapper_t *self, uint16_t addr, uint8_t *out);
+
+// Attempts to create a new NES memory mapper object which handles bank switching
+// correctly for the mapper and submapper of rom's header. The mapper takes a
+// reference to rom of its own; the caller keeps (and eventually releases)
+// theirs.
+nes_mapper_result_t nes_mapper_create(nes_rom_t *rom, nes_mapper_t **result);
+
+// The CPU issues millions of bus accesses per emulated second, so the two
+// below are inline: a page with a pointer (RAM, mapped ROM) costs a table load
+// and an indexed load or store, and only a page without one pays the call
+// through the vtable.
+static inline nes_mapper_result_t nes_mapper_cpu_read_8(nes_mapper_t *mapper, uint16_t addr, uint8_t *out)
+{
+    const uint8_t *page = mapper->cpu_pages[addr >> NES_MAPPER_PAGE_SHIFT].read;
+    if(!page) return mapper->vtable->cpu_read_8(mapper, addr, out);
+    *out = page[addr & (NES_MAPPER_PAGE_SIZE - 1)];
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static inline nes_mapper_result_t nes_mapper_cpu_write_8(nes_mapper_t *mapper, uint16_t addr, uint8_t in)
+{
+    uint8_t *page = mapper->cpu_pages[addr >> NES_MAPPER_PAGE_SHIFT].write;
+    if(!page) return mapper->vtable->cpu_write_8(mapper, addr, in);
+    page[addr & (NES_MAPPER_PAGE_SIZE - 1)] = in;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+// PPU addresses are 14 bits; the bits above are ignored
+static inline nes_mapper_result_t nes_mapper_ppu_read_8(nes_mapper_t *mapper, uint16_t addr, uint8_t *out)
+{
+    const uint8_t *page = mapper->ppu_pages[(addr & NES_MAPPER_PPU_ADDR_MASK) >> NES_MAPPER_PAGE_SHIFT].read;
+    if(!page) return mapper->vtable->ppu_read_8(mapper, addr, out);
+    *out = page[addr & (NES_MAPPER_PAGE_SIZE - 1)];
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static inline nes_mapper_result_t nes_mapper_ppu_write_8(nes_mapper_t *mapper, uint16_t addr, uint8_t in)
+{
+    uint8_t *page = mapper->ppu_pages[(addr & NES_MAPPER_PPU_ADDR_MASK) >> NES_MAPPER_PAGE_SHIFT].write;
+    if(!page) return mapper->vtable->ppu_write_8(mapper, addr, in);
+    page[addr & (NES_MAPPER_PAGE_SIZE - 1)] = in;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+// Bulk access for instruction fetch, DMA, disassemblers and memory dumps: len
+// bytes from addr on, wrapping around at the top of the address space. The
+// span is split where the page table stops being contiguous; every run of
+// plain memory is a single memcpy and only handler pages go a byte at a time.
+// On an error from the handler the bytes before it have been transferred.
+nes_mapper_result_t nes_mapper_cpu_read_span(nes_mapper_t *mapper, uint16_t addr, uint8_t *out, size_t len);
+nes_mapper_result_t nes_mapper_cpu_write_span(nes_mapper_t *mapper, uint16_t addr, const uint8_t *in, size_t len);
+nes_mapper_result_t nes_mapper_ppu_read_span(nes_mapper_t *mapper, uint16_t addr, uint8_t *out, size_t len);
+nes_mapper_result_t nes_mapper_ppu_write_span(nes_mapper_t *mapper, uint16_t addr, const uint8_t *in, size_t len);
+
+// zero-copy reads: the memory behind addr, with *len set to how many bytes
+// follow it contiguously (up to the top of the address space), or NULL if
+// addr is on a handler page. The pointer is good until the mapper switches
+// banks.
+const uint8_t *nes_mapper_cpu_peek(const nes_mapper_t *mapper, uint16_t addr, size_t *len);
+const uint8_t *nes_mapper_ppu_peek(const nes_mapper_t *mapper, uint16_t addr, size_t *len);
 
-// Attempts to create a new NES memory mapper object which handles bank switching 
-// correctly for the given mapper_id and submapper_id
-nes_mapper_result_t nes_mapper_create(
-    uint16_t mapper_id,
-    uint8_t submapper_id,
-    char *prg_rom_array,
-    size_t prg_rom_size, // number of banks as specified in the iNES header, not the total size of the prg_rom_array buffer
-    char *chr_rom_array,
-    size_t chr_rom_size, // number of banks as specified in the iNES header, not the total size of the chr_rom_array buffer
-    nes_mapper_t **result);
+// to be called by the PPU once per rendered scanline (at the rise of A12 for
+// the sprite fetches, as the MMC3 sees it). Afterwards, mapper->irq tells
+// whether the mapper wants an interrupt; the mapper clears it itself when the
+// program acknowledges it.
+void nes_mapper_scanline(nes_mapper_t *mapper);
 
-nes_mapper_result_t nes_mapper_
+// releases all resources that this object allocated, the mapper itself
+// included, and its reference to the ROM
+void nes_mapper_clear(nes_mapper_t *mapper);
 
-#endif
\ No newline at end of file
+#endif
@@ -3,12 +3,6 @@
 
 #include "nes_mapper.h"
 
-nes_mapper_result_t nes_mapper_00000_create(
-    uint8_t submapper_id,
-    char *prg_rom_array,
-    size_t prg_rom_size,
-    char *chr_rom_array,
-    size_t chr_rom_size,
-    nes_mapper_t **result);
+nes_mapper_result_t nes_mapper_00000_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result);
 
 #endif
\ No newline at end of file
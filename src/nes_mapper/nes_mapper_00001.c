@@ -0,0 +1,155 @@
+#include "nes_mapper_00001.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// MMC1 (SxROM): four 5-bit registers written a bit at a time through a shift
+// register at $8000-$ffff. They switch 16K or 32K of PRG-ROM, 4K or 8K of CHR,
+// the nametable mirroring and whether the 8K of PRG-RAM at $6000 is there. On
+// boards with 512K of PRG-ROM (SUROM) bit 4 of the CHR registers selects the
+// 256K half that the PRG banks are in.
+typedef struct nes_mapper_00001
+{
+    nes_mapper_t super;
+    uint8_t shift;        // the bits written so far, the first in bit 0
+    uint8_t shift_count;
+    uint8_t control;      // $8000-$9fff
+    uint8_t chr_bank[2];  // $a000-$bfff and $c000-$dfff
+    uint8_t prg_bank;     // $e000-$ffff
+    uint8_t prg_ram[0x2000];
+    uint8_t chr_ram[0x2000];
+} nes_mapper_00001_t;
+
+static const nes_mapper_mirroring_t CONTROL_MIRRORING[] =
+{
+    NES_MAPPER_MIRRORING_SINGLE_LOWER,
+    NES_MAPPER_MIRRORING_SINGLE_UPPER,
+    NES_MAPPER_MIRRORING_VERTICAL,
+    NES_MAPPER_MIRRORING_HORIZONTAL
+};
+
+static void update_prg(nes_mapper_00001_t *ts)
+{
+    nes_mapper_t *self = &ts->super;
+    // 16K banks: the 256K half, then the bank within it
+    size_t outer = nes_mapper_prg_banks(self, 0x4000) > 0x10 ? ts->chr_bank[0] & 0x10 : 0;
+    size_t bank = outer | (ts->prg_bank & 0x0f);
+    switch((ts->control >> 2) & 3)
+    {
+    case 0:
+    case 1:
+        // one 32K bank, the low bit ignored
+        nes_mapper_map_prg(self, 0x8000, 0x4000, bank & ~1);
+        nes_mapper_map_prg(self, 0xc000, 0x4000, bank | 1);
+        break;
+    case 2:
+        nes_mapper_map_prg(self, 0x8000, 0x4000, outer);
+        nes_mapper_map_prg(self, 0xc000, 0x4000, bank);
+        break;
+    case 3:
+        nes_mapper_map_prg(self, 0x8000, 0x4000, bank);
+        nes_mapper_map_prg(self, 0xc000, 0x4000, outer | 0x0f);
+        break;
+    }
+    // bit 4 of the PRG register disables PRG-RAM
+    if(ts->prg_bank & 0x10) nes_mapper_map_cpu(self, 0x6000, 0x2000, NULL, NULL, 0x2000);
+    else nes_mapper_map_cpu(self, 0x6000, 0x2000, ts->prg_ram, ts->prg_ram, 0x2000);
+}
+
+static void update_chr(nes_mapper_00001_t *ts)
+{
+    if(ts->control & 0x10)
+    {
+        nes_mapper_map_chr(&ts->super, 0x0000, 0x1000, ts->chr_bank[0], ts->chr_ram, sizeof(ts->chr_ram));
+        nes_mapper_map_chr(&ts->super, 0x1000, 0x1000, ts->chr_bank[1], ts->chr_ram, sizeof(ts->chr_ram));
+    }
+    else nes_mapper_map_chr(&ts->super, 0x0000, 0x2000, ts->chr_bank[0] >> 1, ts->chr_ram, sizeof(ts->chr_ram));
+}
+
+static void write_control(nes_mapper_00001_t *ts, uint8_t value)
+{
+    ts->control = value;
+    nes_mapper_set_mirroring(&ts->super, CONTROL_MIRRORING[value & 3]);
+    update_prg(ts);
+    update_chr(ts);
+}
+
+static nes_mapper_result_t cpuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    nes_mapper_00001_t *ts = (nes_mapper_00001_t *)self;
+    if(addr < 0x8000) return nes_mapper_default_cpu_write_8(self, addr, in);
+    if(in & 0x80)
+    {
+        // a reset: the shift register empties and PRG mode 3 comes back
+        ts->shift = 0;
+        ts->shift_count = 0;
+        write_control(ts, ts->control | 0x0c);
+        return NES_MAPPER_RESULT_SUCCESS;
+    }
+    ts->shift |= (in & 1) << ts->shift_count;
+    if(++ts->shift_count < 5) return NES_MAPPER_RESULT_SUCCESS;
+
+    // the fifth write picks the register by its address
+    uint8_t value = ts->shift;
+    ts->shift = 0;
+    ts->shift_count = 0;
+    switch((addr >> 13) & 3)
+    {
+    case 0:
+        write_control(ts, value);
+        break;
+    case 1:
+        ts->chr_bank[0] = value;
+        update_chr(ts);
+        // the SUROM PRG half
+        update_prg(ts);
+        break;
+    case 2:
+        ts->chr_bank[1] = value;
+        update_chr(ts);
+        break;
+    case 3:
+        ts->prg_bank = value;
+        update_prg(ts);
+        break;
+    }
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static void clr(nes_mapper_t *self)
+{
+    free(self);
+}
+
+static const nes_mapper_iface_t NES_MAPPER_VT =
+{
+    .cpu_write_8 = cpuw8,
+    .cpu_read_8 =  nes_mapper_default_cpu_read_8,
+    .ppu_write_8 = nes_mapper_default_ppu_write_8,
+    .ppu_read_8 =  nes_mapper_default_ppu_read_8,
+    .scanline =    NULL,
+    .clear =       clr
+};
+
+nes_mapper_result_t nes_mapper_00001_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result)
+{
+    // the MMC1 submappers are deprecated or describe board variants this
+    // already handles (SUROM) from the ROM size
+    (void)submapper_id;
+    if(rom->prg_rom_banks == 0 || rom->prg_rom_banks > 0x20 || rom->chr_rom_banks > 0x10)
+        return NES_MAPPER_RESULT_ROM_SIZE_MAPPER_INCOMPATIBILITY;
+    nes_mapper_00001_t *r = malloc(sizeof(nes_mapper_00001_t));
+    if(!r) return NES_MAPPER_RESULT_ALLOC_ERR;
+    nes_mapper_init(&r->super, &NES_MAPPER_VT, rom);
+    r->shift = 0;
+    r->shift_count = 0;
+    r->chr_bank[0] = 0;
+    r->chr_bank[1] = 0;
+    r->prg_bank = 0;
+    memset(r->prg_ram, 0, sizeof(r->prg_ram));
+    memset(r->chr_ram, 0, sizeof(r->chr_ram));
+    // the last bank is at $c000 on power up, where the reset vector is
+    write_control(r, 0x0c);
+    *result = &r->super;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#include "nes_mapper_00002.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// UxROM: a 16K PRG-ROM bank at $8000 switched by any write to $8000-$ffff, the
+// last bank fixed at $c000, and 8K of CHR-RAM (or, on a few boards, CHR-ROM).
+typedef struct nes_mapper_00002
+{
+    nes_mapper_t super;
+    bool bus_conflicts;  // submapper 2: the ROM drives the bus too, and wins on 0 bits
+    uint8_t chr_ram[0x2000];
+} nes_mapper_00002_t;
+
+static nes_mapper_result_t cpuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    nes_mapper_00002_t *ts = (nes_mapper_00002_t *)self;
+    if(addr < 0x8000) return nes_mapper_default_cpu_write_8(self, addr, in);
+    if(ts->bus_conflicts)
+    {
+        uint8_t rom_value;
+        nes_mapper_cpu_read_8(self, addr, &rom_value);
+        in &= rom_value;
+    }
+    nes_mapper_map_prg(self, 0x8000, 0x4000, in);
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static void clr(nes_mapper_t *self)
+{
+    free(self);
+}
+
+static const nes_mapper_iface_t NES_MAPPER_VT =
+{
+    .cpu_write_8 = cpuw8,
+    .cpu_read_8 =  nes_mapper_default_cpu_read_8,
+    .ppu_write_8 = nes_mapper_default_ppu_write_8,
+    .ppu_read_8 =  nes_mapper_default_ppu_read_8,
+    .scanline =    NULL,
+    .clear =       clr
+};
+
+nes_mapper_result_t nes_mapper_00002_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result)
+{
+    if(rom->prg_rom_banks == 0 || rom->chr_rom_banks > 1)
+        return NES_MAPPER_RESULT_ROM_SIZE_MAPPER_INCOMPATIBILITY;
+    nes_mapper_00002_t *r = malloc(sizeof(nes_mapper_00002_t));
+    if(!r) return NES_MAPPER_RESULT_ALLOC_ERR;
+    nes_mapper_init(&r->super, &NES_MAPPER_VT, rom);
+    r->bus_conflicts = submapper_id == 2;
+    memset(r->chr_ram, 0, sizeof(r->chr_ram));
+    nes_mapper_map_prg(&r->super, 0x8000, 0x4000, 0);
+    nes_mapper_map_prg(&r->super, 0xc000, 0x4000, nes_mapper_prg_banks(&r->super, 0x4000) - 1);
+    nes_mapper_map_chr(&r->super, 0, 0x2000, 0, r->chr_ram, sizeof(r->chr_ram));
+    *result = &r->super;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#include "nes_mapper_00003.h"
+
+#include <stdlib.h>
+
+// CNROM: PRG-ROM as NROM has it, and an 8K CHR-ROM bank switched by any write
+// to $8000-$ffff.
+typedef struct nes_mapper_00003
+{
+    nes_mapper_t super;
+    bool bus_conflicts;  // submapper 2: the ROM drives the bus too, and wins on 0 bits
+} nes_mapper_00003_t;
+
+static nes_mapper_result_t cpuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    nes_mapper_00003_t *ts = (nes_mapper_00003_t *)self;
+    if(addr < 0x8000) return nes_mapper_default_cpu_write_8(self, addr, in);
+    if(ts->bus_conflicts)
+    {
+        uint8_t rom_value;
+        nes_mapper_cpu_read_8(self, addr, &rom_value);
+        in &= rom_value;
+    }
+    nes_mapper_map_chr(self, 0, 0x2000, in, NULL, 0);
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static void clr(nes_mapper_t *self)
+{
+    free(self);
+}
+
+static const nes_mapper_iface_t NES_MAPPER_VT =
+{
+    .cpu_write_8 = cpuw8,
+    .cpu_read_8 =  nes_mapper_default_cpu_read_8,
+    .ppu_write_8 = nes_mapper_default_ppu_write_8,
+    .ppu_read_8 =  nes_mapper_default_ppu_read_8,
+    .scanline =    NULL,
+    .clear =       clr
+};
+
+nes_mapper_result_t nes_mapper_00003_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result)
+{
+    if(rom->prg_rom_banks > 2 || rom->prg_rom_banks == 0 || rom->chr_rom_banks == 0)
+        return NES_MAPPER_RESULT_ROM_SIZE_MAPPER_INCOMPATIBILITY;
+    nes_mapper_00003_t *r = malloc(sizeof(nes_mapper_00003_t));
+    if(!r) return NES_MAPPER_RESULT_ALLOC_ERR;
+    nes_mapper_init(&r->super, &NES_MAPPER_VT, rom);
+    r->bus_conflicts = submapper_id == 2;
+    nes_mapper_map_cpu(&r->super, 0x8000, 0x8000, rom->prg_rom, NULL, NES_HEADER_PROG_ROM_BLOCK_SIZE * rom->prg_rom_banks);
+    nes_mapper_map_chr(&r->super, 0, 0x2000, 0, NULL, 0);
+    *result = &r->super;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
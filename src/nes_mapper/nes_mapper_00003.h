@@ -0,0 +1,8 @@
+#ifndef NES_MAPPER_00003_H
+#define NES_MAPPER_00003_H
+
+#include "nes_mapper.h"
+
+nes_mapper_result_t nes_mapper_00003_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result);
+
+#endif
\ No newline at end of file
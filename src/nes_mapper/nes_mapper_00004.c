@@ -0,0 +1,166 @@
+#include "nes_mapper_00004.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// MMC3 (TxROM): four 8K PRG-ROM windows, two of them switchable, and CHR in
+// two 2K and four 1K windows, with either half of the pattern tables
+// swappable for the other. Eight bank registers are written through a bank
+// select register. A scanline counter raises an IRQ when it runs out, which
+// games use for split screens.
+typedef struct nes_mapper_00004
+{
+    nes_mapper_t super;
+    uint8_t bank_select;  // the register the next $8001 write goes to, and the PRG and CHR modes
+    uint8_t regs[8];      // R0-R5 CHR banks in 1K units, R6-R7 PRG banks in 8K units
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+    bool four_screen;     // the board has its own VRAM, and $a000 does nothing
+    uint8_t prg_ram[0x2000];
+    uint8_t chr_ram[0x2000];
+} nes_mapper_00004_t;
+
+// maps the window that bank register reg (R0-R7) feeds, and nothing else
+static void map_reg(nes_mapper_00004_t *ts, size_t reg)
+{
+    nes_mapper_t *self = &ts->super;
+    // PRG mode 1 swaps $8000 and $c000, CHR mode 1 the pattern table halves
+    uint16_t r6_addr = ts->bank_select & 0x40 ? 0xc000 : 0x8000;
+    uint16_t invert = ts->bank_select & 0x80 ? 0x1000 : 0;
+    switch(reg)
+    {
+    case 0:
+    case 1:
+        nes_mapper_map_chr(self, (reg * 0x800) ^ invert, 0x0800, ts->regs[reg] >> 1, ts->chr_ram, sizeof(ts->chr_ram));
+        break;
+    case 6:
+        nes_mapper_map_prg(self, r6_addr, 0x2000, ts->regs[6] & 0x3f);
+        break;
+    case 7:
+        nes_mapper_map_prg(self, 0xa000, 0x2000, ts->regs[7] & 0x3f);
+        break;
+    default:
+        nes_mapper_map_chr(self, (0x1000 + (reg - 2) * 0x400) ^ invert, 0x0400, ts->regs[reg], ts->chr_ram, sizeof(ts->chr_ram));
+        break;
+    }
+}
+
+// the whole of PRG-ROM: after a PRG mode change, or at power up
+static void update_prg(nes_mapper_00004_t *ts)
+{
+    size_t last = nes_mapper_prg_banks(&ts->super, 0x2000) - 1;
+    uint16_t r6_addr = ts->bank_select & 0x40 ? 0xc000 : 0x8000;
+    nes_mapper_map_prg(&ts->super, r6_addr ^ 0x4000, 0x2000, last - 1);
+    nes_mapper_map_prg(&ts->super, 0xe000, 0x2000, last);
+    map_reg(ts, 6);
+    map_reg(ts, 7);
+}
+
+static void update_chr(nes_mapper_00004_t *ts)
+{
+    size_t reg;
+    for(reg = 0; reg < 6; reg++) map_reg(ts, reg);
+}
+
+static nes_mapper_result_t cpuw8(nes_mapper_t *self, uint16_t addr, uint8_t in)
+{
+    nes_mapper_00004_t *ts = (nes_mapper_00004_t *)self;
+    if(addr < 0x8000) return nes_mapper_default_cpu_write_8(self, addr, in);
+    // each register pair repeats over 8K, even and odd addresses
+    switch(addr & 0xe001)
+    {
+    case 0x8000:
+    {
+        // games write this before every bank switch, mostly with the modes
+        // unchanged, which leaves nothing to remap
+        uint8_t changed = ts->bank_select ^ in;
+        ts->bank_select = in;
+        if(changed & 0x40) update_prg(ts);
+        if(changed & 0x80) update_chr(ts);
+        break;
+    }
+    case 0x8001:
+        ts->regs[ts->bank_select & 7] = in;
+        map_reg(ts, ts->bank_select & 7);
+        break;
+    case 0xa000:
+        if(!ts->four_screen) nes_mapper_set_mirroring(self, in & 1 ? NES_MAPPER_MIRRORING_HORIZONTAL : NES_MAPPER_MIRRORING_VERTICAL);
+        break;
+    case 0xa001:
+        // bit 7 enables PRG-RAM, bit 6 protects it from writes
+        nes_mapper_map_cpu(self, 0x6000, 0x2000, in & 0x80 ? ts->prg_ram : NULL, (in & 0xc0) == 0x80 ? ts->prg_ram : NULL, 0x2000);
+        break;
+    case 0xc000:
+        ts->irq_latch = in;
+        break;
+    case 0xc001:
+        ts->irq_counter = 0;
+        ts->irq_reload = true;
+        break;
+    case 0xe000:
+        ts->irq_enabled = false;
+        self->irq = false;
+        break;
+    case 0xe001:
+        ts->irq_enabled = true;
+        break;
+    }
+    return NES_MAPPER_RESULT_SUCCESS;
+}
+
+static void scln(nes_mapper_t *self)
+{
+    nes_mapper_00004_t *ts = (nes_mapper_00004_t *)self;
+    if(!ts->irq_counter || ts->irq_reload)
+    {
+        ts->irq_counter = ts->irq_latch;
+        ts->irq_reload = false;
+    }
+    else ts->irq_counter--;
+    if(!ts->irq_counter && ts->irq_enabled) self->irq = true;
+}
+
+static void clr(nes_mapper_t *self)
+{
+    free(self);
+}
+
+static const nes_mapper_iface_t NES_MAPPER_VT =
+{
+    .cpu_write_8 = cpuw8,
+    .cpu_read_8 =  nes_mapper_default_cpu_read_8,
+    .ppu_write_8 = nes_mapper_default_ppu_write_8,
+    .ppu_read_8 =  nes_mapper_default_ppu_read_8,
+    .scanline =    scln,
+    .clear =       clr
+};
+
+nes_mapper_result_t nes_mapper_00004_create(uint8_t submapper_id, nes_rom_t *rom, nes_mapper_t **result)
+{
+    // the other submappers are MMC6 and clones whose IRQ or PRG-RAM behave
+    // differently
+    if(submapper_id != 0) return NES_MAPPER_RESULT_UNSUPPORTED_MAPPER_ID;
+    if(rom->prg_rom_banks == 0 || rom->prg_rom_banks > 0x20 || rom->chr_rom_banks > 0x20)
+        return NES_MAPPER_RESULT_ROM_SIZE_MAPPER_INCOMPATIBILITY;
+    nes_mapper_00004_t *r = malloc(sizeof(nes_mapper_00004_t));
+    if(!r) return NES_MAPPER_RESULT_ALLOC_ERR;
+    nes_mapper_init(&r->super, &NES_MAPPER_VT, rom);
+    r->bank_select = 0;
+    // R0-R7 come up unknown; these give the usual view of the first banks
+    static const uint8_t INITIAL_REGS[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+    memcpy(r->regs, INITIAL_REGS, sizeof(r->regs));
+    r->irq_latch = 0;
+    r->irq_counter = 0;
+    r->irq_reload = false;
+    r->irq_enabled = false;
+    r->four_screen = rom->header.ntmt == NES_HEADER_NAMETABLE_MIRRORING_TYPE_NO_MIRRORING;
+    memset(r->prg_ram, 0, sizeof(r->prg_ram));
+    memset(r->chr_ram, 0, sizeof(r->chr_ram));
+    nes_mapper_map_cpu(&r->super, 0x6000, 0x2000, r->prg_ram, r->prg_ram, 0x2000);
+    update_prg(r);
+    update_chr(r);
+    *result = &r->super;
+    return NES_MAPPER_RESULT_SUCCESS;
+}
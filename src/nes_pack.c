@@ -0,0 +1,171 @@
+#include "nes_pack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fd_copy.h"
+
+static uint64_t align_up(uint64_t value)
+{
+    return (value + NES_PACK_ALIGN - 1) & ~(NES_PACK_ALIGN - 1);
+}
+
+nes_pack_result_t nes_pack_write(
+    int out_fd,
+    int in_fd,
+    const char *in_buf,
+    const nes_pack_region_t *regions,
+    size_t num_regions,
+    bool allow_zero_copy,
+    void *table_buf)
+{
+    nes_pack_result_t result = NES_PACK_RESULT_SUCCESS;
+    size_t table_size = nes_pack_table_size(num_regions);
+    char *table = table_buf ? table_buf : malloc(table_size);
+    if(!table) return NES_PACK_RESULT_ALLOC_ERR;
+    memset(table, 0, table_size);
+    nes_pack_file_header_t *header = (nes_pack_file_header_t *)table;
+    nes_pack_entry_t *entries = (nes_pack_entry_t *)(table + sizeof(nes_pack_file_header_t));
+
+    uint32_t num_prg_banks = 0;
+    uint32_t num_chr_banks = 0;
+    uint32_t first_prg_entry = num_regions;
+    uint32_t first_chr_entry = num_regions;
+    uint64_t offset = align_up(table_size);
+    size_t i;
+    for(i = 0; i < num_regions; i++)
+    {
+        if(regions[i].type == NES_PACK_REGION_TYPE_PRG_ROM)
+        {
+            if(!num_prg_banks++) first_prg_entry = i;
+        }
+        else if(regions[i].type == NES_PACK_REGION_TYPE_CHR_ROM)
+        {
+            if(!num_chr_banks++) first_chr_entry = i;
+        }
+        entries[i].type = htole32(regions[i].type);
+        entries[i].index = htole32(regions[i].index);
+        entries[i].offset = htole64(offset);
+        entries[i].length = htole64(regions[i].length);
+        offset = align_up(offset + regions[i].length);
+    }
+
+    memcpy(header->magic, NES_PACK_MAGIC, sizeof(NES_PACK_MAGIC));
+    header->version = htole32(NES_PACK_VERSION);
+    header->num_entries = htole32(num_regions);
+    header->entries_offset = htole64(sizeof(nes_pack_file_header_t));
+    header->file_size = htole64(offset);
+    header->num_prg_banks = htole32(num_prg_banks);
+    header->num_chr_banks = htole32(num_chr_banks);
+    header->first_prg_entry = htole32(first_prg_entry);
+    header->first_chr_entry = htole32(first_chr_entry);
+
+    if(pwrite(out_fd, table, table_size, 0) != (ssize_t)table_size)
+    {
+        result = NES_PACK_RESULT_WRITE_ERR;
+        goto end;
+    }
+    // payloads go through the file position so fd_copy can use the kernel
+    // copy paths; seeking past the padding leaves it as a hole.
+    for(i = 0; i < num_regions; i++)
+    {
+        if(lseek(out_fd, (off_t)le64toh(entries[i].offset), SEEK_SET) < 0
+            || fd_copy(in_fd, (off_t)regions[i].src_offset, out_fd, regions[i].length, in_buf + regions[i].src_offset, allow_zero_copy))
+        {
+            result = NES_PACK_RESULT_WRITE_ERR;
+            goto end;
+        }
+    }
+    if(ftruncate(out_fd, (off_t)offset)) result = NES_PACK_RESULT_WRITE_ERR;
+
+end:
+    if(!table_buf) free(table);
+    return result;
+}
+
+nes_pack_result_t nes_pack_open(const char *path, nes_pack_t *out)
+{
+    nes_pack_result_t result = NES_PACK_RESULT_SUCCESS;
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NES_PACK_RESULT_OPEN_ERR;
+
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(nes_pack_file_header_t))
+    {
+        result = NES_PACK_RESULT_INVALID_PACK;
+        goto close_fd;
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        result = NES_PACK_RESULT_OPEN_ERR;
+        goto close_fd;
+    }
+
+    // everything a lookup will touch is bounds checked here, once.
+    const nes_pack_file_header_t *header = (const nes_pack_file_header_t *)map;
+    uint64_t entries_offset = le64toh(header->entries_offset);
+    uint64_t num_entries = le32toh(header->num_entries);
+    bool valid = !memcmp(header->magic, NES_PACK_MAGIC, sizeof(NES_PACK_MAGIC))
+        && le32toh(header->version) == NES_PACK_VERSION
+        && le64toh(header->file_size) == (uint64_t)st.st_size
+        && entries_offset == sizeof(nes_pack_file_header_t)
+        && num_entries <= (st.st_size - entries_offset) / sizeof(nes_pack_entry_t)
+        && le32toh(header->first_prg_entry) + (uint64_t)le32toh(header->num_prg_banks) <= num_entries
+        && le32toh(header->first_chr_entry) + (uint64_t)le32toh(header->num_chr_banks) <= num_entries;
+    const nes_pack_entry_t *entries = (const nes_pack_entry_t *)(map + entries_offset);
+    uint64_t i;
+    for(i = 0; valid && i < num_entries; i++)
+    {
+        uint64_t offset = le64toh(entries[i].offset);
+        uint64_t length = le64toh(entries[i].length);
+        valid = offset <= (uint64_t)st.st_size && length <= (uint64_t)st.st_size - offset;
+    }
+    if(!valid)
+    {
+        munmap((void *)map, st.st_size);
+        result = NES_PACK_RESULT_INVALID_PACK;
+        goto close_fd;
+    }
+
+    out->map = map;
+    out->map_size = st.st_size;
+    out->header = header;
+    out->entries = entries;
+
+close_fd:
+    // the mapping stays valid after the descriptor is closed.
+    close(fd);
+    return result;
+}
+
+static const char *entry_payload(const nes_pack_t *pack, uint32_t first, uint32_t count, uint32_t bank, uint64_t *length_out)
+{
+    if(bank >= count) return NULL;
+    const nes_pack_entry_t *entry = &pack->entries[first + bank];
+    if(length_out) *length_out = le64toh(entry->length);
+    return pack->map + le64toh(entry->offset);
+}
+
+const char *nes_pack_prg_bank(const nes_pack_t *pack, uint32_t bank, uint64_t *length_out)
+{
+    return entry_payload(pack, le32toh(pack->header->first_prg_entry), le32toh(pack->header->num_prg_banks), bank, length_out);
+}
+
+const char *nes_pack_chr_bank(const nes_pack_t *pack, uint32_t bank, uint64_t *length_out)
+{
+    return entry_payload(pack, le32toh(pack->header->first_chr_entry), le32toh(pack->header->num_chr_banks), bank, length_out);
+}
+
+void nes_pack_close(nes_pack_t *pack)
+{
+    if(pack->map) munmap((void *)pack->map, pack->map_size);
+    memset(pack, 0, sizeof(*pack));
+}
@@ -0,0 +1,121 @@
+#ifndef NES_PACK_H
+#define NES_PACK_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+// The .nespack container holds every region of one ROM in a single file that
+// can be mmapped and indexed without any directory lookups:
+//
+//   offset 0      nes_pack_file_header_t
+//   offset 64     nes_pack_entry_t[num_entries]
+//   4K aligned    payload of entry 0
+//   4K aligned    payload of entry 1
+//   ...
+//
+// Entries are stored in the order header, trainer, PRG banks, CHR banks, misc
+// ROM, so PRG bank i is entry first_prg_entry + i. All integers are little
+// endian. Padding between payloads is left as a hole where the filesystem
+// supports it.
+
+static const char NES_PACK_MAGIC[8] = {'N', 'E', 'S', 'P', 'A', 'C', 'K', '\x1a'};
+static const uint32_t NES_PACK_VERSION = 1;
+static const uint64_t NES_PACK_ALIGN = 0x1000;
+
+typedef enum nes_pack_region_type
+{
+    NES_PACK_REGION_TYPE_HEADER = 0,
+    NES_PACK_REGION_TYPE_TRAINER = 1,
+    NES_PACK_REGION_TYPE_PRG_ROM = 2,
+    NES_PACK_REGION_TYPE_CHR_ROM = 3,
+    NES_PACK_REGION_TYPE_MISC_ROM = 4
+} nes_pack_region_type_t;
+static const char *const NES_PACK_REGION_TYPE_STR[] = {"header", "trainer", "PRG-ROM", "CHR-ROM", "misc ROM"};
+
+typedef struct nes_pack_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t entries_offset;
+    uint64_t file_size;
+    uint32_t num_prg_banks;
+    uint32_t num_chr_banks;
+    uint32_t first_prg_entry;
+    uint32_t first_chr_entry;
+    uint8_t reserved[16];
+} nes_pack_file_header_t;
+
+typedef struct nes_pack_entry
+{
+    uint32_t type;  // nes_pack_region_type_t
+    uint32_t index; // bank number within its type, 0 for the other regions
+    uint64_t offset;
+    uint64_t length;
+} nes_pack_entry_t;
+
+_Static_assert(sizeof(nes_pack_file_header_t) == 64, "nes_pack_file_header_t is part of the file format");
+_Static_assert(sizeof(nes_pack_entry_t) == 24, "nes_pack_entry_t is part of the file format");
+
+typedef enum nes_pack_result
+{
+    NES_PACK_RESULT_SUCCESS = 0,
+    NES_PACK_RESULT_ALLOC_ERR,
+    NES_PACK_RESULT_OPEN_ERR,
+    NES_PACK_RESULT_WRITE_ERR,
+    NES_PACK_RESULT_INVALID_PACK
+} nes_pack_result_t;
+static const char *const NES_PACK_RESULT_STR[] = {"success", "memory allocation failed", "could not open file", "error writing file", "not a valid .nespack file"};
+
+// a region of the source .nes file to be stored in the pack
+typedef struct nes_pack_region
+{
+    nes_pack_region_type_t type;
+    uint32_t index;
+    uint64_t src_offset;
+    uint64_t length;
+} nes_pack_region_t;
+
+// the bytes nes_pack_write needs for the file header and entry table of a
+// pack with num_regions regions
+static inline size_t nes_pack_table_size(size_t num_regions)
+{
+    return sizeof(nes_pack_file_header_t) + num_regions * sizeof(nes_pack_entry_t);
+}
+
+// writes a pack holding the given regions of in_fd (whose contents are also
+// mapped at in_buf) to out_fd, which must be empty. Regions must already be
+// in entry order (see above). The table is built in table_buf, which holds
+// nes_pack_table_size(num_regions) bytes, or in a buffer of its own if that
+// is NULL.
+nes_pack_result_t nes_pack_write(
+    int out_fd,
+    int in_fd,
+    const char *in_buf,
+    const nes_pack_region_t *regions,
+    size_t num_regions,
+    bool allow_zero_copy,
+    void *table_buf);
+
+// read side: a validated, read-only mapping of a pack
+typedef struct nes_pack
+{
+    const char *map;
+    size_t map_size;
+    const nes_pack_file_header_t *header;
+    const nes_pack_entry_t *entries;
+} nes_pack_t;
+
+nes_pack_result_t nes_pack_open(const char *path, nes_pack_t *out);
+
+// O(1) lookup of a bank's payload, NULL if out of range
+const char *nes_pack_prg_bank(const nes_pack_t *pack, uint32_t bank, uint64_t *length_out);
+const char *nes_pack_chr_bank(const nes_pack_t *pack, uint32_t bank, uint64_t *length_out);
+
+// releases all resources that this object allocated
+void nes_pack_close(nes_pack_t *pack);
+
+#endif
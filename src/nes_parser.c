@@ -0,0 +1,136 @@
+#include "nes_parser.h"
+
+#include <string.h>
+
+void nes_parser_init(nes_parser_t *parser)
+{
+    arena_init(&parser->arena);
+}
+
+void nes_parser_reset(nes_parser_t *parser)
+{
+    arena_reset(&parser->arena);
+}
+
+void *nes_parser_alloc(nes_parser_t *parser, size_t size)
+{
+    return arena_alloc(&parser->arena, size);
+}
+
+nes_parser_result_t nes_parser_parse(nes_parser_t *parser, const uint8_t *buf, size_t size, nes_parser_rom_t *out)
+{
+    if(size < NES_HEADER_SIZE) return NES_PARSER_RESULT_TRUNCATED;
+    nes_header_t *header = arena_alloc(&parser->arena, sizeof(nes_header_t));
+    if(!header) return NES_PARSER_RESULT_ALLOC_ERR;
+    if(nes_header_parse((char *)buf, NES_HEADER_SIZE, header)) return NES_PARSER_RESULT_INVALID_HEADER;
+    out->header = header;
+    return nes_parser_layout(parser, header, size, &out->layout);
+}
+
+nes_parser_result_t nes_parser_rom_area_end(const nes_header_t *header, uint64_t file_size, uint64_t *end_out)
+{
+    // each area is checked against what is left of the file before it is
+    // added, so sizes near UINT64_MAX cannot wrap the sum
+    uint64_t end = NES_HEADER_SIZE + (header->trainer ? NES_HEADER_TRAINER_SIZE : 0);
+    if(end > file_size || header->prg_rom_bytes > file_size - end) return NES_PARSER_RESULT_TRUNCATED;
+    end += header->prg_rom_bytes;
+    if(header->char_rom_bytes > file_size - end) return NES_PARSER_RESULT_TRUNCATED;
+    end += header->char_rom_bytes;
+    *end_out = end;
+    return NES_PARSER_RESULT_SUCCESS;
+}
+
+static uint64_t add_saturating(uint64_t a, uint64_t b)
+{
+    return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+bool nes_parser_layout_next(const nes_header_t *header, uint64_t file_size, const nes_pack_region_t *prev, nes_pack_region_t *out)
+{
+    // the areas in file order, each cut into banks of BANK_SIZE[type] bytes
+    // with a shorter last one where NES 2.0 exponent sizes are not whole banks
+    static const uint64_t BANK_SIZE[NES_PARSER_NUM_REGION_TYPES] =
+        { NES_HEADER_SIZE, NES_HEADER_TRAINER_SIZE, NES_HEADER_PROG_ROM_BLOCK_SIZE, NES_HEADER_CHAR_ROM_BLOCK_SIZE, UINT64_MAX };
+    uint64_t size[NES_PARSER_NUM_REGION_TYPES] =
+        { NES_HEADER_SIZE, header->trainer ? NES_HEADER_TRAINER_SIZE : 0, header->prg_rom_bytes, header->char_rom_bytes, 0 };
+    // https://wiki.nesdev.com/w/index.php/NES_2.0#Miscellaneous_ROM_Area
+    // The misc ROM area runs to the end of the file. Sizes no file can hold
+    // saturate rather than wrap; the caller runs out of input before that.
+    uint64_t rom_end = add_saturating(add_saturating(NES_HEADER_SIZE + size[NES_PACK_REGION_TYPE_TRAINER], size[NES_PACK_REGION_TYPE_PRG_ROM]), size[NES_PACK_REGION_TYPE_CHR_ROM]);
+    if(header->type == NES_HEADER_TYPE_NES_2 && header->nes_2.misc_roms_size && file_size > rom_end)
+        size[NES_PACK_REGION_TYPE_MISC_ROM] = file_size - rom_end;
+
+    nes_pack_region_type_t type = prev ? prev->type : NES_PACK_REGION_TYPE_HEADER;
+    uint64_t start = 0;
+    int t;
+    for(t = 0; t < (int)type; t++) start = add_saturating(start, size[t]);
+    uint64_t offset = prev ? prev->src_offset + prev->length : 0;
+    uint32_t index = prev ? prev->index + 1 : 0;
+    while(offset - start >= size[type])
+    {
+        start = add_saturating(start, size[type]);
+        if(type == NES_PACK_REGION_TYPE_MISC_ROM) return false;
+        type++;
+        offset = start;
+        index = 0;
+    }
+    uint64_t left = size[type] - (offset - start);
+    *out = (nes_pack_region_t){ .type = type, .index = index, .src_offset = offset, .length = left < BANK_SIZE[type] ? left : BANK_SIZE[type] };
+    return true;
+}
+
+nes_parser_result_t nes_parser_layout_append(nes_parser_t *parser, nes_parser_layout_t *layout, const nes_pack_region_t *region)
+{
+    if(layout->num_regions == layout->capacity)
+    {
+        // the old list stays in the arena until the next reset, which at most
+        // doubles what the list takes
+        size_t capacity = layout->capacity ? layout->capacity * 2 : 16;
+        nes_pack_region_t *regions = capacity <= SIZE_MAX / sizeof(nes_pack_region_t) ? arena_alloc(&parser->arena, capacity * sizeof(nes_pack_region_t)) : NULL;
+        if(!regions) return NES_PARSER_RESULT_ALLOC_ERR;
+        if(layout->num_regions) memcpy(regions, layout->regions, layout->num_regions * sizeof(nes_pack_region_t));
+        layout->regions = regions;
+        layout->capacity = capacity;
+    }
+    if(!layout->count[region->type]) layout->first[region->type] = layout->num_regions;
+    layout->regions[layout->num_regions++] = *region;
+    layout->count[region->type]++;
+    // types that have not started (or have no regions) start after this one
+    int t;
+    for(t = region->type + 1; t < NES_PARSER_NUM_REGION_TYPES; t++) layout->first[t] = layout->num_regions;
+    return NES_PARSER_RESULT_SUCCESS;
+}
+
+nes_parser_result_t nes_parser_layout(nes_parser_t *parser, const nes_header_t *header, uint64_t file_size, nes_parser_layout_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if(nes_parser_rom_area_end(header, file_size, &out->rom_end)) return NES_PARSER_RESULT_TRUNCATED;
+    // A bank is at least 8K of the file_size bytes checked above, so for a
+    // real file this is small. Callers that pass UINT64_MAX have no such
+    // bound and get a list as long as the header declares, which on 32-bit
+    // may not even fit size_t.
+    uint64_t max_regions = 3 + header->prg_rom_size + header->char_rom_size;
+    if(max_regions > SIZE_MAX / sizeof(nes_pack_region_t)) return NES_PARSER_RESULT_ALLOC_ERR;
+    if(!(out->regions = arena_alloc(&parser->arena, max_regions * sizeof(nes_pack_region_t)))) return NES_PARSER_RESULT_ALLOC_ERR;
+    out->capacity = max_regions;
+    out->file_size = file_size;
+
+    nes_pack_region_t region;
+    bool more;
+    for(more = nes_parser_layout_next(header, file_size, NULL, &region); more; more = nes_parser_layout_next(header, file_size, &region, &region))
+        nes_parser_layout_append(parser, out, &region);
+    return NES_PARSER_RESULT_SUCCESS;
+}
+
+char *nes_parser_base_name(nes_parser_t *parser, const char *path, const char *suffix, size_t extra)
+{
+    size_t len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+    if(len >= suffix_len && !strcmp(path + len - suffix_len, suffix)) len -= suffix_len;
+    return arena_strndup(&parser->arena, path, len, extra);
+}
+
+void nes_parser_clear(nes_parser_t *parser)
+{
+    arena_clear(&parser->arena);
+}
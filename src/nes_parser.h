@@ -0,0 +1,123 @@
+#ifndef NES_PARSER_H
+#define NES_PARSER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "nes_header.h"
+#include "nes_pack.h"
+
+// The parser as a library: what nes_file_parser does with a ROM short of
+// writing anything, for programs that want to look into ROMs in process
+// instead of running the CLI.
+//
+// A context is meant to live for a whole batch, one per thread. Everything a
+// call hands back (decoded headers, region lists, names) is carved out of the
+// context's arena and stays valid until nes_parser_reset, which the caller
+// does between ROMs. Once the arena has grown to the largest ROM seen, no
+// call allocates from the heap.
+//
+//     nes_parser_t parser;
+//     nes_parser_init(&parser);
+//     for each ROM:
+//         nes_parser_reset(&parser);
+//         nes_parser_rom_t rom;
+//         if(!nes_parser_parse(&parser, buf, size, &rom)) use rom.header, rom.layout
+//     nes_parser_clear(&parser);
+
+typedef struct nes_parser
+{
+    arena_t arena;
+} nes_parser_t;
+
+// one past the last nes_pack_region_type_t
+#define NES_PARSER_NUM_REGION_TYPES (NES_PACK_REGION_TYPE_MISC_ROM + 1)
+
+typedef enum nes_parser_result
+{
+    NES_PARSER_RESULT_SUCCESS = 0,
+    NES_PARSER_RESULT_ALLOC_ERR,
+    NES_PARSER_RESULT_INVALID_HEADER,
+    NES_PARSER_RESULT_TRUNCATED
+} nes_parser_result_t;
+static const char *const NES_PARSER_RESULT_STR[] = {"success", "memory allocation failed", "invalid header", "file is shorter than its header declares"};
+
+// where everything of one ROM is, worked out once from its header and the
+// file size and checked against the latter. Extraction, hashing and mapper
+// creation all index into it rather than redoing the offset arithmetic, and
+// can pick the regions they need without looking at the others.
+typedef struct nes_parser_layout
+{
+    nes_pack_region_t *regions;  // every region in file order, as nes_pack_write takes them
+    size_t num_regions;
+    size_t capacity;             // room in regions, for nes_parser_layout_append
+    // where each nes_pack_region_type_t starts in regions and how many there
+    // are, e.g. PRG bank i is regions[first[NES_PACK_REGION_TYPE_PRG_ROM] + i]
+    size_t first[NES_PARSER_NUM_REGION_TYPES];
+    size_t count[NES_PARSER_NUM_REGION_TYPES];
+    uint64_t rom_end;            // just past CHR-ROM, where the misc ROM area starts
+    uint64_t file_size;
+} nes_parser_layout_t;
+
+// one ROM as parsed by nes_parser_parse
+typedef struct nes_parser_rom
+{
+    const nes_header_t *header;
+    nes_parser_layout_t layout;
+} nes_parser_rom_t;
+
+void nes_parser_init(nes_parser_t *parser);
+
+// ends the current ROM: everything handed out since the last reset goes
+void nes_parser_reset(nes_parser_t *parser);
+
+// size bytes that last until the next reset, for callers that keep per-ROM
+// data of their own next to the parser's
+void *nes_parser_alloc(nes_parser_t *parser, size_t size);
+
+// decodes the header of the size-byte image at buf and lists its regions
+nes_parser_result_t nes_parser_parse(nes_parser_t *parser, const uint8_t *buf, size_t size, nes_parser_rom_t *out);
+
+// the offset just past the trainer, PRG-ROM and CHR-ROM the header declares.
+// NES 2.0 exponent sizes can declare far more than any file holds, so this
+// fails if that is beyond file_size, before anything is sized by the bank
+// counts.
+nes_parser_result_t nes_parser_rom_area_end(const nes_header_t *header, uint64_t file_size, uint64_t *end_out);
+
+// lays out a file_size-byte ROM with the given header. A misc ROM area runs
+// to the end of the file. Callers that do not know the size pass UINT64_MAX,
+// making the misc ROM area run to the end of the address space; the region
+// list is then sized by what the header declares rather than by what the
+// file holds. To read a stream, use nes_parser_layout_next instead.
+nes_parser_result_t nes_parser_layout(nes_parser_t *parser, const nes_header_t *header, uint64_t file_size, nes_parser_layout_t *out);
+
+// the layout one region at a time: the region after prev (the first for
+// NULL; prev may be out) in a file_size-byte ROM with the given header, or
+// false after the last. Nothing is allocated and the header is not checked
+// against file_size, so a stream can take each region as its bytes arrive
+// and keep the ones that did with nes_parser_layout_append, however much the
+// header declares. A file_size of UINT64_MAX works as for nes_parser_layout.
+bool nes_parser_layout_next(const nes_header_t *header, uint64_t file_size, const nes_pack_region_t *prev, nes_pack_region_t *out);
+
+// adds region, which must follow the layout's last one, growing the region
+// list in parser's arena as needed. Start from a zeroed layout and fill in
+// rom_end and file_size once known.
+nes_parser_result_t nes_parser_layout_append(nes_parser_t *parser, nes_parser_layout_t *layout, const nes_pack_region_t *region);
+
+// bank (or for the other types, region) index of the given type, or NULL if
+// the ROM has no such region
+static inline const nes_pack_region_t *nes_parser_layout_region(const nes_parser_layout_t *layout, nes_pack_region_type_t type, size_t index)
+{
+    return index < layout->count[type] ? &layout->regions[layout->first[type] + index] : NULL;
+}
+
+// path without suffix (if it ends in it), with room for extra more bytes:
+// the base that output names are made from
+char *nes_parser_base_name(nes_parser_t *parser, const char *path, const char *suffix, size_t extra);
+
+// releases all resources that this object allocated
+void nes_parser_clear(nes_parser_t *parser);
+
+#endif
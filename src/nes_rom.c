@@ -0,0 +1,93 @@
+#include "nes_rom.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nes_parser.h"
+
+// finds PRG-ROM and CHR-ROM in the size-byte image at buf, through the same
+// layout extraction uses
+static nes_rom_result_t locate(const uint8_t *buf, size_t size, nes_rom_t *rom)
+{
+    static const nes_rom_result_t PARSER_RESULT[] =
+        {NES_ROM_RESULT_SUCCESS, NES_ROM_RESULT_ALLOC_ERR, NES_ROM_RESULT_INVALID_HEADER, NES_ROM_RESULT_TRUNCATED};
+    nes_parser_t parser;
+    nes_parser_init(&parser);
+    nes_parser_rom_t parsed;
+    nes_rom_result_t r = PARSER_RESULT[nes_parser_parse(&parser, buf, size, &parsed)];
+    if(r) goto clear_parser;
+    rom->header = *parsed.header;
+    const nes_pack_region_t *prg = nes_parser_layout_region(&parsed.layout, NES_PACK_REGION_TYPE_PRG_ROM, 0);
+    const nes_pack_region_t *chr = nes_parser_layout_region(&parsed.layout, NES_PACK_REGION_TYPE_CHR_ROM, 0);
+    rom->prg_rom = prg ? buf + prg->src_offset : NULL;
+    rom->prg_rom_size = rom->header.prg_rom_bytes;
+    rom->prg_rom_banks = rom->prg_rom_size / NES_HEADER_PROG_ROM_BLOCK_SIZE;
+    rom->chr_rom_size = rom->header.char_rom_bytes;
+    rom->chr_rom_banks = rom->chr_rom_size / NES_HEADER_CHAR_ROM_BLOCK_SIZE;
+    // less than one bank of CHR-ROM cannot be paged in
+    rom->chr_rom = chr && rom->chr_rom_banks ? buf + chr->src_offset : NULL;
+
+clear_parser:
+    nes_parser_clear(&parser);
+    return r;
+}
+
+nes_rom_result_t nes_rom_open(const char *path, nes_rom_t **result)
+{
+    nes_rom_t *rom = calloc(1, sizeof(nes_rom_t));
+    if(!rom) return NES_ROM_RESULT_ALLOC_ERR;
+    nes_rom_result_t r = NES_ROM_RESULT_OPEN_ERR;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) goto free_rom;
+    struct stat st;
+    if(fstat(fd, &st)) goto close_fd;
+    r = NES_ROM_RESULT_TRUNCATED;
+    if(st.st_size < (off_t)NES_HEADER_SIZE) goto close_fd;
+    // a mapper may touch any bank, so the whole file is read in up front
+    r = NES_ROM_RESULT_MAP_ERR;
+    if(mapped_file_open(fd, st.st_size, 0, 0, &rom->file)) goto close_fd;
+    rom->mapped = true;
+    if((r = locate((const uint8_t *)rom->file.buf, rom->file.size, rom))) goto unmap;
+    close(fd);
+    rom->refs = 1;
+    *result = rom;
+    return NES_ROM_RESULT_SUCCESS;
+
+unmap:
+    mapped_file_close(&rom->file);
+close_fd:
+    close(fd);
+free_rom:
+    free(rom);
+    return r;
+}
+
+nes_rom_result_t nes_rom_open_buffer(const uint8_t *buf, size_t size, nes_rom_t **result)
+{
+    nes_rom_t *rom = calloc(1, sizeof(nes_rom_t));
+    if(!rom) return NES_ROM_RESULT_ALLOC_ERR;
+    nes_rom_result_t r = locate(buf, size, rom);
+    if(r)
+    {
+        free(rom);
+        return r;
+    }
+    rom->refs = 1;
+    *result = rom;
+    return NES_ROM_RESULT_SUCCESS;
+}
+
+nes_rom_t *nes_rom_retain(nes_rom_t *rom)
+{
+    __atomic_add_fetch(&rom->refs, 1, __ATOMIC_RELAXED);
+    return rom;
+}
+
+void nes_rom_release(nes_rom_t *rom)
+{
+    if(__atomic_sub_fetch(&rom->refs, 1, __ATOMIC_ACQ_REL)) return;
+    if(rom->mapped) mapped_file_close(&rom->file);
+    free(rom);
+}
@@ -0,0 +1,62 @@
+#ifndef NES_ROM_H
+#define NES_ROM_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "mapped_file.h"
+#include "nes_header.h"
+
+// One ROM image, read-only and shared by every mapper created from it. The
+// .nes file is mapped rather than read, and mappers page straight into the
+// mapping instead of copying PRG-ROM and CHR-ROM, so running hundreds of
+// instances of one game costs one copy of the ROM (in the page cache) and
+// per instance only RAM, VRAM and OAM.
+//
+// The image is reference counted: every mapper holds a reference, and the
+// mapping goes away with the last one. The count is updated atomically, so
+// instances may be created and cleared from any thread.
+
+typedef struct nes_rom
+{
+    unsigned refs;             // only touched with __atomic builtins
+    mapped_file_t file;        // the mapping, unless the image was handed in
+    bool mapped;
+    nes_header_t header;
+    // NES 2.0 sizes need not be whole banks. The bank counts are the whole
+    // banks, which is what mappers check and page in; a partial last bank
+    // only shows in the sizes.
+    const uint8_t *prg_rom;
+    size_t prg_rom_size;       // bytes
+    size_t prg_rom_banks;      // of NES_HEADER_PROG_ROM_BLOCK_SIZE bytes
+    const uint8_t *chr_rom;    // NULL if the cartridge has CHR-RAM instead
+    size_t chr_rom_size;       // bytes
+    size_t chr_rom_banks;      // of NES_HEADER_CHAR_ROM_BLOCK_SIZE bytes
+} nes_rom_t;
+
+typedef enum nes_rom_result
+{
+    NES_ROM_RESULT_SUCCESS = 0,
+    NES_ROM_RESULT_ALLOC_ERR,
+    NES_ROM_RESULT_OPEN_ERR,
+    NES_ROM_RESULT_MAP_ERR,
+    NES_ROM_RESULT_INVALID_HEADER,
+    NES_ROM_RESULT_TRUNCATED
+} nes_rom_result_t;
+static const char *const NES_ROM_RESULT_STR[] = {"success", "memory allocation failed", "could not open file", "could not map file", "invalid header", "file is shorter than its header declares"};
+
+// maps the .nes file at path, holding one reference for the caller
+nes_rom_result_t nes_rom_open(const char *path, nes_rom_t **result);
+
+// the same for an image already in memory, e.g. a zip entry. buf is not
+// copied and has to outlive the last reference.
+nes_rom_result_t nes_rom_open_buffer(const uint8_t *buf, size_t size, nes_rom_t **result);
+
+// another reference to rom, for one more user of it
+nes_rom_t *nes_rom_retain(nes_rom_t *rom);
+
+// drops a reference; the last one unmaps the file and frees rom
+void nes_rom_release(nes_rom_t *rom);
+
+#endif
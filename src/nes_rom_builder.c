@@ -0,0 +1,91 @@
+#include "nes_rom_builder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fd_copy.h"
+
+// the file that holds region, or NULL if the input has none
+static const char *input_path(const nes_rom_builder_input_t *input, const nes_pack_region_t *region)
+{
+    switch(region->type)
+    {
+    case NES_PACK_REGION_TYPE_TRAINER:  return input->trainer;
+    case NES_PACK_REGION_TYPE_PRG_ROM:  return input->prg ? input->prg[region->index] : NULL;
+    case NES_PACK_REGION_TYPE_CHR_ROM:  return input->chr ? input->chr[region->index] : NULL;
+    case NES_PACK_REGION_TYPE_MISC_ROM: return input->misc;
+    default:                            return NULL;
+    }
+}
+
+// appends the whole of path, which must be length bytes unless it is the misc
+// ROM (which is as long as it is)
+static nes_rom_builder_result_t copy_region(const char *path, const nes_pack_region_t *region, int out_fd, bool allow_zero_copy)
+{
+    int in_fd = open(path, O_RDONLY);
+    if(in_fd < 0) return NES_ROM_BUILDER_RESULT_INPUT_OPEN_ERR;
+    nes_rom_builder_result_t result = NES_ROM_BUILDER_RESULT_SUCCESS;
+    struct stat st;
+    if(fstat(in_fd, &st)) result = NES_ROM_BUILDER_RESULT_INPUT_OPEN_ERR;
+    else if(region->type == NES_PACK_REGION_TYPE_MISC_ROM ? !st.st_size : (uint64_t)st.st_size != region->length)
+        result = NES_ROM_BUILDER_RESULT_WRONG_INPUT_SIZE;
+    else if(fd_copy(in_fd, 0, out_fd, st.st_size, NULL, allow_zero_copy)) result = NES_ROM_BUILDER_RESULT_WRITE_ERR;
+    close(in_fd);
+    return result;
+}
+
+// writes header_buf, which decodes to header, and the regions after it
+static nes_rom_builder_result_t write_rom(
+    nes_parser_t *parser,
+    const char *header_buf,
+    const nes_header_t *header,
+    const nes_rom_builder_input_t *input,
+    int out_fd,
+    bool allow_zero_copy)
+{
+    // the file does not exist yet, so nothing bounds the misc ROM
+    nes_parser_layout_t layout;
+    nes_parser_result_t layout_result = nes_parser_layout(parser, header, UINT64_MAX, &layout);
+    if(layout_result) return layout_result == NES_PARSER_RESULT_ALLOC_ERR ? NES_ROM_BUILDER_RESULT_ALLOC_ERR : NES_ROM_BUILDER_RESULT_UNENCODABLE_HEADER;
+    if(input->misc && !layout.count[NES_PACK_REGION_TYPE_MISC_ROM]) return NES_ROM_BUILDER_RESULT_INPUT_MISMATCH;
+
+    // check that every file is there before anything is written
+    size_t i;
+    for(i = 1; i < layout.num_regions; i++)
+        if(!input_path(input, &layout.regions[i]) && layout.regions[i].type != NES_PACK_REGION_TYPE_MISC_ROM) return NES_ROM_BUILDER_RESULT_INPUT_MISMATCH;
+
+    if(fd_copy(-1, 0, out_fd, NES_HEADER_SIZE, header_buf, false)) return NES_ROM_BUILDER_RESULT_WRITE_ERR;
+    for(i = 1; i < layout.num_regions; i++)
+    {
+        const char *path = input_path(input, &layout.regions[i]);
+        if(!path) continue;
+        nes_rom_builder_result_t result = copy_region(path, &layout.regions[i], out_fd, allow_zero_copy);
+        if(result) return result;
+    }
+    return NES_ROM_BUILDER_RESULT_SUCCESS;
+}
+
+nes_rom_builder_result_t nes_rom_builder_write(
+    nes_parser_t *parser,
+    const nes_header_t *header,
+    const nes_rom_builder_input_t *input,
+    int out_fd,
+    bool allow_zero_copy)
+{
+    char header_buf[NES_HEADER_SIZE];
+    if(nes_header_serialize(header, header_buf, sizeof(header_buf))) return NES_ROM_BUILDER_RESULT_UNENCODABLE_HEADER;
+    return write_rom(parser, header_buf, header, input, out_fd, allow_zero_copy);
+}
+
+nes_rom_builder_result_t nes_rom_builder_write_raw(
+    nes_parser_t *parser,
+    const char *header_buf,
+    const nes_rom_builder_input_t *input,
+    int out_fd,
+    bool allow_zero_copy)
+{
+    nes_header_t header;
+    if(nes_header_parse((char *)header_buf, NES_HEADER_SIZE, &header)) return NES_ROM_BUILDER_RESULT_INVALID_HEADER;
+    return write_rom(parser, header_buf, &header, input, out_fd, allow_zero_copy);
+}
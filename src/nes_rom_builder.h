@@ -0,0 +1,61 @@
+#ifndef NES_ROM_BUILDER_H
+#define NES_ROM_BUILDER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "nes_header.h"
+#include "nes_parser.h"
+
+// The way back from the one-file-per-bank output: assembles a .nes from a
+// header and one file per region, e.g. after some banks have been patched.
+// The header is either the 16 bytes extracted, written back as they are so an
+// unpatched ROM comes out byte for byte, or serialized from a nes_header_t
+// whose fields may have been edited. Either way the regions are laid out as
+// nes_parser_layout lays out the file that results. Bank payloads are copied file to file in the kernel
+// (see fd_copy.h) and never read into user space where it allows.
+
+typedef enum nes_rom_builder_result
+{
+    NES_ROM_BUILDER_RESULT_SUCCESS = 0,
+    NES_ROM_BUILDER_RESULT_ALLOC_ERR,
+    NES_ROM_BUILDER_RESULT_UNENCODABLE_HEADER,
+    NES_ROM_BUILDER_RESULT_INVALID_HEADER,
+    NES_ROM_BUILDER_RESULT_INPUT_MISMATCH,
+    NES_ROM_BUILDER_RESULT_INPUT_OPEN_ERR,
+    NES_ROM_BUILDER_RESULT_WRONG_INPUT_SIZE,
+    NES_ROM_BUILDER_RESULT_WRITE_ERR
+} nes_rom_builder_result_t;
+static const char *const NES_ROM_BUILDER_RESULT_STR[] = {"success", "memory allocation failed", "header fields do not fit the header format", "invalid header", "input files do not match the header", "error opening input file", "input file is not the size of its region", "error writing output file"};
+
+// the files a ROM is built from, one per region
+typedef struct nes_rom_builder_input
+{
+    const char *trainer;     // the 512-byte trainer, if the header has one
+    const char *const *prg;  // header->prg_rom_size files of one 16K PRG-ROM bank each,
+                             // the last shorter if prg_rom_bytes is not whole banks
+    const char *const *chr;  // header->char_rom_size files of one 8K CHR-ROM bank each, ditto
+    const char *misc;        // the NES 2.0 miscellaneous ROM area, or NULL for none
+} nes_rom_builder_input_t;
+
+// writes the ROM with header serialized at the current position of out_fd.
+// The layout is carved out of parser's arena, which the caller resets between
+// ROMs as usual. A misc ROM is only accepted if the header declares one.
+nes_rom_builder_result_t nes_rom_builder_write(
+    nes_parser_t *parser,
+    const nes_header_t *header,
+    const nes_rom_builder_input_t *input,
+    int out_fd,
+    bool allow_zero_copy);
+
+// the same with the NES_HEADER_SIZE bytes at header_buf as the header. They
+// have to parse, and are copied as they are: bits nes_header_t does not keep,
+// such as the mirroring bit next to four-screen, survive.
+nes_rom_builder_result_t nes_rom_builder_write_raw(
+    nes_parser_t *parser,
+    const char *header_buf,
+    const nes_rom_builder_input_t *input,
+    int out_fd,
+    bool allow_zero_copy);
+
+#endif
@@ -0,0 +1,59 @@
+#include "ring_buffer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+ring_buffer_result_t ring_buffer_init(ring_buffer_t *ring, size_t cap)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->buf = malloc(cap);
+    if(!ring->buf) return RING_BUFFER_RESULT_ALLOC_ERR;
+    ring->cap = cap;
+    return RING_BUFFER_RESULT_SUCCESS;
+}
+
+ssize_t ring_buffer_fill(ring_buffer_t *ring, int fd)
+{
+    if(ring->len == ring->cap) return 0;
+    // the free space runs from the tail up to the end of the buffer or, once
+    // the tail has wrapped, up to the head
+    size_t tail = (ring->head + ring->len) % ring->cap;
+    size_t room = tail >= ring->head ? ring->cap - tail : ring->head - tail;
+    if(!ring->len)
+    {
+        // an empty ring starts over at the front, so reads stay as large as
+        // they can be
+        ring->head = 0;
+        tail = 0;
+        room = ring->cap;
+    }
+    ssize_t got;
+    do
+    {
+        got = read(fd, ring->buf + tail, room);
+    } while(got < 0 && errno == EINTR);
+    if(got > 0) ring->len += got;
+    return got;
+}
+
+const uint8_t *ring_buffer_peek(const ring_buffer_t *ring, size_t *len_out)
+{
+    size_t to_end = ring->cap - ring->head;
+    *len_out = ring->len < to_end ? ring->len : to_end;
+    return ring->buf + ring->head;
+}
+
+void ring_buffer_consume(ring_buffer_t *ring, size_t len)
+{
+    ring->head = (ring->head + len) % ring->cap;
+    ring->len -= len;
+}
+
+void ring_buffer_clear(ring_buffer_t *ring)
+{
+    free(ring->buf);
+    memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,46 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+// A fixed-size byte ring between a descriptor that is read sequentially (a
+// pipe, a socket, stdin) and whoever consumes the bytes. Reads go straight
+// into the free space and consumers work on the filled space in place, so
+// nothing is ever moved and memory use is the capacity, however long the
+// stream is.
+
+typedef struct ring_buffer
+{
+    uint8_t *buf;
+    size_t cap;
+    size_t head;  // offset of the oldest unconsumed byte
+    size_t len;   // unconsumed bytes
+} ring_buffer_t;
+
+typedef enum ring_buffer_result
+{
+    RING_BUFFER_RESULT_SUCCESS = 0,
+    RING_BUFFER_RESULT_ALLOC_ERR
+} ring_buffer_result_t;
+static const char *const RING_BUFFER_RESULT_STR[] = {"success", "memory allocation failed"};
+
+ring_buffer_result_t ring_buffer_init(ring_buffer_t *ring, size_t cap);
+
+// one read() into the free space. Returns the bytes read, 0 at end of stream
+// or when the ring is full, -1 on error (EINTR is retried).
+ssize_t ring_buffer_fill(ring_buffer_t *ring, int fd);
+
+// the unconsumed bytes that are contiguous in memory, starting at the oldest;
+// *len_out is 0 if the ring is empty
+const uint8_t *ring_buffer_peek(const ring_buffer_t *ring, size_t *len_out);
+
+// drops the len oldest bytes, which must not be more than are unconsumed
+void ring_buffer_consume(ring_buffer_t *ring, size_t len);
+
+// releases all resources that this object allocated
+void ring_buffer_clear(ring_buffer_t *ring);
+
+#endif
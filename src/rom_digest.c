@@ -0,0 +1,35 @@
+#include "rom_digest.h"
+
+#include <stdio.h>
+
+#include "crc32.h"
+
+void rom_digest_init(rom_digest_ctx_t *ctx)
+{
+    ctx->crc32 = 0;
+    md5_init(&ctx->md5);
+    sha1_init(&ctx->sha1);
+}
+
+void rom_digest_update(rom_digest_ctx_t *ctx, const void *data, size_t len)
+{
+    ctx->crc32 = crc32_update(ctx->crc32, data, len);
+    md5_update(&ctx->md5, data, len);
+    sha1_update(&ctx->sha1, data, len);
+}
+
+void rom_digest_final(rom_digest_ctx_t *ctx, rom_digest_t *out)
+{
+    out->crc32 = ctx->crc32;
+    md5_final(&ctx->md5, out->md5);
+    sha1_final(&ctx->sha1, out->sha1);
+}
+
+void rom_digest_to_str(const rom_digest_t *digest, char *str_out)
+{
+    str_out += sprintf(str_out, "crc32:%08" PRIx32 " md5:", digest->crc32);
+    size_t i;
+    for(i = 0; i < sizeof(digest->md5); i++) str_out += sprintf(str_out, "%02x", digest->md5[i]);
+    str_out += sprintf(str_out, " sha1:");
+    sha1_to_hex(digest->sha1, str_out);
+}
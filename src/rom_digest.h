@@ -0,0 +1,35 @@
+#ifndef ROM_DIGEST_H
+#define ROM_DIGEST_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "md5.h"
+#include "sha1.h"
+
+// The CRC32, MD5 and SHA-1 of one stretch of ROM data, i.e. the three
+// digests that No-Intro/GoodNES DAT files list for every entry.
+
+typedef struct rom_digest
+{
+    uint32_t crc32;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+} rom_digest_t;
+
+typedef struct rom_digest_ctx
+{
+    uint32_t crc32;
+    md5_ctx_t md5;
+    sha1_ctx_t sha1;
+} rom_digest_ctx_t;
+
+void rom_digest_init(rom_digest_ctx_t *ctx);
+void rom_digest_update(rom_digest_ctx_t *ctx, const void *data, size_t len);
+void rom_digest_final(rom_digest_ctx_t *ctx, rom_digest_t *out);
+
+// "crc32:xxxxxxxx md5:<32 hex> sha1:<40 hex>" plus a null terminator
+#define ROM_DIGEST_STR_SIZE (6 + 8 + 5 + 32 + 6 + 40 + 1)
+void rom_digest_to_str(const rom_digest_t *digest, char *str_out);
+
+#endif
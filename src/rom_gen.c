@@ -0,0 +1,169 @@
+#include "rom_gen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PRG_ROM_BANK_SIZE 0x4000
+#define CHR_ROM_BANK_SIZE 0x2000
+
+// https://prng.di.unimi.it/splitmix64.c
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+// separate streams for the layout and the payload of a ROM, so the payload
+// can be regenerated without redrawing the layout
+static uint64_t rom_state(uint64_t seed, uint64_t index, uint64_t stream)
+{
+    uint64_t state = seed ^ (index * UINT64_C(0xd1b54a32d192ed03)) ^ stream;
+    splitmix64(&state);
+    return state;
+}
+
+// the exponent-multiplier form of size bytes: EEEEEEMM for 2^E * (MM*2+1)
+static uint8_t exponent_form(unsigned exponent, unsigned multiplier)
+{
+    return (uint8_t)(exponent << 2 | multiplier);
+}
+
+void rom_gen_describe(uint64_t seed, uint64_t index, rom_gen_rom_t *out)
+{
+    uint64_t state = rom_state(seed, index, 0);
+    memset(out, 0, sizeof(*out));
+    out->kind = index % ROM_GEN_NUM_KINDS;
+    unsigned console_type = (index / ROM_GEN_NUM_KINDS) % 4;
+    unsigned timing = (index / (ROM_GEN_NUM_KINDS * 4)) % 4;
+    bool nes_2 = out->kind >= ROM_GEN_KIND_NES_2;
+    uint64_t r = splitmix64(&state);
+
+    uint8_t *h = out->header;
+    h[0] = 'N';
+    h[1] = 'E';
+    h[2] = 'S';
+    h[3] = 0x1a;
+    // 1-8 16K PRG banks, 0-4 8K CHR banks (CHR-RAM when 0)
+    uint64_t prg_banks = 1 + (r & 7);
+    uint64_t chr_banks = (r >> 3) % 5;
+    h[4] = prg_banks;
+    h[5] = chr_banks;
+    out->prg_rom_size = prg_banks * PRG_ROM_BANK_SIZE;
+    out->chr_rom_size = chr_banks * CHR_ROM_BANK_SIZE;
+
+    uint16_t mapper = nes_2 ? (r >> 8) & 0x0fff : (r >> 8) & 0xff;
+    out->trainer = out->kind == ROM_GEN_KIND_INES_TRAINER || out->kind == ROM_GEN_KIND_NES_2_TRAINER_MISC;
+    // mirroring, battery and four-screen bits straight from the PRNG
+    h[6] = (mapper & 0x0f) << 4 | (out->trainer ? 0x04 : 0) | ((r >> 20) & 0x0b);
+    h[7] = (mapper & 0xf0) | console_type | (nes_2 ? 0x08 : 0);
+    if(nes_2)
+    {
+        uint64_t r2 = splitmix64(&state);
+        h[8] = (mapper >> 8) | (r2 & 0xf0);     // submapper in the high nibble
+        h[10] = (r2 >> 8) & 0xff;                // PRG-RAM/NVRAM shifts
+        h[11] = (r2 >> 16) & 0xff;               // CHR-RAM/NVRAM shifts
+        h[12] = timing;
+        h[13] = (r2 >> 24) & 0xff;               // Vs. PPU/hardware or extended console type
+        h[15] = (r2 >> 32) & 0x3f;               // default expansion device
+        if(out->kind == ROM_GEN_KIND_NES_2_EXPONENT_PRG)
+        {
+            // 16K, 32K, 64K or 48K, whole banks either way
+            static const uint8_t EXPONENTS[] = {14, 15, 16, 14};
+            static const uint8_t MULTIPLIERS[] = {0, 0, 0, 1};
+            unsigned pick = (r2 >> 40) & 3;
+            h[4] = exponent_form(EXPONENTS[pick], MULTIPLIERS[pick]);
+            h[9] |= 0x0f;
+            out->prg_rom_size = ((uint64_t)1 << EXPONENTS[pick]) * (MULTIPLIERS[pick] * 2 + 1);
+        }
+        if(out->kind == ROM_GEN_KIND_NES_2_EXPONENT_CHR)
+        {
+            // 8K, 24K or 40K
+            unsigned multiplier = ((r2 >> 40) & 3) % 3;
+            h[5] = exponent_form(13, multiplier);
+            h[9] |= 0xf0;
+            out->chr_rom_size = (uint64_t)CHR_ROM_BANK_SIZE * (multiplier * 2 + 1);
+        }
+        if(out->kind == ROM_GEN_KIND_NES_2_MISC || out->kind == ROM_GEN_KIND_NES_2_TRAINER_MISC)
+        {
+            h[14] = 1 + (r2 >> 42) % 3;
+            out->misc_rom_size = 256 + ((r2 >> 44) & 0x0fff);
+        }
+    }
+    out->size = 16 + (out->trainer ? 512 : 0) + out->prg_rom_size + out->chr_rom_size + out->misc_rom_size;
+}
+
+void rom_gen_fill(uint64_t seed, uint64_t index, const rom_gen_rom_t *rom, uint8_t *out)
+{
+    uint64_t state = rom_state(seed, index, 1);
+    memcpy(out, rom->header, 16);
+    uint64_t i;
+    for(i = 16; i + 8 <= rom->size; i += 8)
+    {
+        uint64_t r = splitmix64(&state);
+        memcpy(out + i, &r, 8);
+    }
+    if(i < rom->size)
+    {
+        uint64_t r = splitmix64(&state);
+        memcpy(out + i, &r, rom->size - i);
+    }
+}
+
+rom_gen_result_t rom_gen_write_corpus(const char *dir, uint64_t seed, size_t num_roms, uint64_t *total_bytes_out)
+{
+    rom_gen_result_t result = ROM_GEN_RESULT_SUCCESS;
+    uint64_t total_bytes = 0;
+    uint8_t *image = NULL;
+    size_t image_cap = 0;
+    char *path = malloc(strlen(dir) + 32);
+    if(!path) return ROM_GEN_RESULT_ALLOC_ERR;
+    size_t i;
+    for(i = 0; i < num_roms; i++)
+    {
+        rom_gen_rom_t rom;
+        rom_gen_describe(seed, i, &rom);
+        if(rom.size > image_cap)
+        {
+            uint8_t *grown = realloc(image, rom.size);
+            if(!grown)
+            {
+                result = ROM_GEN_RESULT_ALLOC_ERR;
+                break;
+            }
+            image = grown;
+            image_cap = rom.size;
+        }
+        rom_gen_fill(seed, i, &rom, image);
+
+        sprintf(path, "%s/rom%06zu.nes", dir, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            result = ROM_GEN_RESULT_WRITE_ERR;
+            break;
+        }
+        uint64_t done = 0;
+        while(done < rom.size)
+        {
+            ssize_t n = write(fd, image + done, rom.size - done);
+            if(n <= 0) break;
+            done += n;
+        }
+        if(close(fd) || done < rom.size)
+        {
+            result = ROM_GEN_RESULT_WRITE_ERR;
+            break;
+        }
+        total_bytes += rom.size;
+    }
+    if(total_bytes_out) *total_bytes_out = total_bytes;
+    free(image);
+    free(path);
+    return result;
+}
@@ -0,0 +1,61 @@
+#ifndef ROM_GEN_H
+#define ROM_GEN_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Deterministic synthetic .nes files for benchmarks. ROM i of a corpus
+// depends only on (seed, i), so two machines generate byte-identical corpora
+// and any single ROM can be regenerated on its own.
+//
+// Consecutive indices cycle through the header layouts the parser has to
+// handle (rom_gen_kind_t), and within those through every console type and
+// every timing type, so a corpus of ROM_GEN_NUM_KINDS * 16 ROMs or more
+// covers every combination. Mapper numbers, sizes and the NES 2.0 RAM fields
+// are drawn from the PRNG; PRG/CHR/misc payloads are PRNG bytes, so no two
+// banks deduplicate or hash alike.
+
+typedef enum rom_gen_kind
+{
+    ROM_GEN_KIND_INES = 0,
+    ROM_GEN_KIND_INES_TRAINER,
+    ROM_GEN_KIND_NES_2,
+    ROM_GEN_KIND_NES_2_EXPONENT_PRG,   // PRG-ROM size in exponent-multiplier form
+    ROM_GEN_KIND_NES_2_EXPONENT_CHR,   // CHR-ROM size in exponent-multiplier form
+    ROM_GEN_KIND_NES_2_MISC,           // miscellaneous ROM area after CHR-ROM
+    ROM_GEN_KIND_NES_2_TRAINER_MISC,
+    ROM_GEN_NUM_KINDS
+} rom_gen_kind_t;
+static const char *const ROM_GEN_KIND_STR[] = {"ines", "ines_trainer", "nes_2", "nes_2_exponent_prg", "nes_2_exponent_chr", "nes_2_misc", "nes_2_trainer_misc"};
+
+typedef struct rom_gen_rom
+{
+    rom_gen_kind_t kind;
+    uint8_t header[16];
+    bool trainer;
+    uint64_t prg_rom_size;   // bytes
+    uint64_t chr_rom_size;   // bytes
+    uint64_t misc_rom_size;  // bytes
+    uint64_t size;           // the whole file
+} rom_gen_rom_t;
+
+typedef enum rom_gen_result
+{
+    ROM_GEN_RESULT_SUCCESS = 0,
+    ROM_GEN_RESULT_ALLOC_ERR,
+    ROM_GEN_RESULT_WRITE_ERR
+} rom_gen_result_t;
+static const char *const ROM_GEN_RESULT_STR[] = {"success", "memory allocation failed", "error writing file"};
+
+// works out ROM index of the corpus for seed: its header and layout
+void rom_gen_describe(uint64_t seed, uint64_t index, rom_gen_rom_t *out);
+
+// writes the whole file described by rom, rom->size bytes, to out
+void rom_gen_fill(uint64_t seed, uint64_t index, const rom_gen_rom_t *rom, uint8_t *out);
+
+// writes ROMs [0, num_roms) as dir/rom000000.nes, ... The directory must
+// exist. *total_bytes_out, if given, gets the size of the corpus.
+rom_gen_result_t rom_gen_write_corpus(const char *dir, uint64_t seed, size_t num_roms, uint64_t *total_bytes_out);
+
+#endif
@@ -0,0 +1,193 @@
+#include "sha1.h"
+
+#include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_HAVE_SHA_NI
+#endif
+
+static uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static uint32_t load_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// processes num_blocks consecutive 64-byte blocks
+static void compress_portable(uint32_t state[5], const uint8_t *data, size_t num_blocks)
+{
+    while(num_blocks--)
+    {
+        uint32_t w[80];
+        int t;
+        for(t = 0; t < 16; t++) w[t] = load_be32(data + t * 4);
+        for(t = 16; t < 80; t++) w[t] = rol(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for(t = 0; t < 80; t++)
+        {
+            uint32_t f, k;
+            if(t < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if(t < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if(t < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else            { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+            uint32_t tmp = rol(a, 5) + f + e + k + w[t];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = tmp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        data += 64;
+    }
+}
+
+#ifdef SHA1_HAVE_SHA_NI
+// One group of 4 rounds using the SHA extensions. msg[] holds the last 16
+// message words; each group consumes msg[g % 4] and advances the schedule of
+// the others, which is why the message ops stop a few groups before the end.
+#define SHA1_NI_GROUP(g, func) \
+    do \
+    { \
+        if((g) < 4) msg[(g)] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * (g))), byte_swap); \
+        if((g) == 0) e0 = _mm_add_epi32(e0, msg[0]); \
+        else if((g) % 2 == 0) e0 = _mm_sha1nexte_epu32(e0, msg[(g) % 4]); \
+        else e1 = _mm_sha1nexte_epu32(e1, msg[(g) % 4]); \
+        if((g) >= 3 && (g) <= 18) msg[((g) + 1) % 4] = _mm_sha1msg2_epu32(msg[((g) + 1) % 4], msg[(g) % 4]); \
+        if((g) % 2 == 0) \
+        { \
+            e1 = abcd; \
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, (func)); \
+        } \
+        else \
+        { \
+            e0 = abcd; \
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, (func)); \
+        } \
+        if((g) >= 1 && (g) <= 16) msg[((g) + 3) % 4] = _mm_sha1msg1_epu32(msg[((g) + 3) % 4], msg[(g) % 4]); \
+        if((g) >= 2 && (g) <= 17) msg[((g) + 2) % 4] = _mm_xor_si128(msg[((g) + 2) % 4], msg[(g) % 4]); \
+    } while(0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void compress_sha_ni(uint32_t state[5], const uint8_t *data, size_t num_blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1;
+    __m128i msg[4];
+    while(num_blocks--)
+    {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+        SHA1_NI_GROUP(0, 0);  SHA1_NI_GROUP(1, 0);  SHA1_NI_GROUP(2, 0);  SHA1_NI_GROUP(3, 0);  SHA1_NI_GROUP(4, 0);
+        SHA1_NI_GROUP(5, 1);  SHA1_NI_GROUP(6, 1);  SHA1_NI_GROUP(7, 1);  SHA1_NI_GROUP(8, 1);  SHA1_NI_GROUP(9, 1);
+        SHA1_NI_GROUP(10, 2); SHA1_NI_GROUP(11, 2); SHA1_NI_GROUP(12, 2); SHA1_NI_GROUP(13, 2); SHA1_NI_GROUP(14, 2);
+        SHA1_NI_GROUP(15, 3); SHA1_NI_GROUP(16, 3); SHA1_NI_GROUP(17, 3); SHA1_NI_GROUP(18, 3); SHA1_NI_GROUP(19, 3);
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+        data += 64;
+    }
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+#undef SHA1_NI_GROUP
+#endif
+
+static void (*compress)(uint32_t state[5], const uint8_t *data, size_t num_blocks) = compress_portable;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void)
+{
+#ifdef SHA1_HAVE_SHA_NI
+    const cpu_features_t *features = cpu_features_get();
+    if(features->sha && features->ssse3 && features->sse41) compress = compress_sha_ni;
+#endif
+}
+
+void sha1_init(sha1_ctx_t *ctx)
+{
+    pthread_once(&init_once, init);
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xc3d2e1f0;
+    ctx->total_len = 0;
+    ctx->block_len = 0;
+}
+
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len)
+{
+    const uint8_t *in = data;
+    ctx->total_len += len;
+    if(ctx->block_len)
+    {
+        size_t take = 64 - ctx->block_len;
+        if(take > len) take = len;
+        memcpy(ctx->block + ctx->block_len, in, take);
+        ctx->block_len += take;
+        in += take;
+        len -= take;
+        if(ctx->block_len < 64) return;
+        compress(ctx->state, ctx->block, 1);
+        ctx->block_len = 0;
+    }
+    // whole blocks are hashed straight from the caller's buffer
+    compress(ctx->state, in, len / 64);
+    in += len - len % 64;
+    len %= 64;
+    memcpy(ctx->block, in, len);
+    ctx->block_len = len;
+}
+
+void sha1_final(sha1_ctx_t *ctx, uint8_t digest_out[20])
+{
+    uint64_t bit_len = ctx->total_len * 8;
+    uint8_t pad[72] = {0x80};
+    size_t pad_len = (ctx->block_len < 56 ? 56 : 120) - ctx->block_len;
+    int i;
+    for(i = 0; i < 8; i++) pad[pad_len + i] = (uint8_t)(bit_len >> (56 - 8 * i));
+    sha1_update(ctx, pad, pad_len + 8);
+    for(i = 0; i < 5; i++)
+    {
+        digest_out[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest_out[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest_out[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest_out[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void sha1(const void *data, size_t len, uint8_t digest_out[20])
+{
+    sha1_ctx_t ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, data, len);
+    sha1_final(&ctx, digest_out);
+}
+
+void sha1_to_hex(const uint8_t digest[20], char hex_out[41])
+{
+    static const char HEX[] = "0123456789abcdef";
+    int i;
+    for(i = 0; i < 20; i++)
+    {
+        hex_out[i * 2] = HEX[digest[i] >> 4];
+        hex_out[i * 2 + 1] = HEX[digest[i] & 0x0f];
+    }
+    hex_out[40] = '\0';
+}
@@ -0,0 +1,30 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// SHA-1 as specified in FIPS 180-4. Used to identify ROM banks by content,
+// not for anything security sensitive.
+
+static const size_t SHA1_DIGEST_SIZE = 20;
+
+typedef struct sha1_ctx
+{
+    uint32_t state[5];
+    uint64_t total_len;
+    uint8_t block[64];
+    size_t block_len;
+} sha1_ctx_t;
+
+void sha1_init(sha1_ctx_t *ctx);
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len);
+void sha1_final(sha1_ctx_t *ctx, uint8_t digest_out[20]);
+
+// one-shot helper
+void sha1(const void *data, size_t len, uint8_t digest_out[20]);
+
+// writes the 40 hex digits plus a null terminator
+void sha1_to_hex(const uint8_t digest[20], char hex_out[41]);
+
+#endif
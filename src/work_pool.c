@@ -0,0 +1,159 @@
+#include "work_pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+// the range of item indices [head, tail) still owned by one worker. The owner
+// takes from head, thieves take from tail.
+typedef struct work_pool_range
+{
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+} work_pool_range_t;
+
+typedef struct work_pool
+{
+    work_pool_fn_t fn;
+    work_pool_done_fn_t done;
+    void *ctx;
+    size_t num_threads;
+    work_pool_range_t *ranges;
+} work_pool_t;
+
+typedef struct work_pool_worker
+{
+    work_pool_t *pool;
+    size_t id;
+} work_pool_worker_t;
+
+static bool take_own(work_pool_range_t *range, size_t *item_out)
+{
+    bool found = false;
+    pthread_mutex_lock(&range->lock);
+    if(range->head < range->tail)
+    {
+        *item_out = range->head++;
+        found = true;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+static size_t range_remaining(work_pool_range_t *range)
+{
+    pthread_mutex_lock(&range->lock);
+    size_t remaining = range->tail - range->head;
+    pthread_mutex_unlock(&range->lock);
+    return remaining;
+}
+
+// moves the back half of the largest other range into our own (empty) range.
+// Returns false once every range is empty, which means the run is over since
+// no new items are ever added.
+static bool steal(work_pool_t *pool, size_t thief_id)
+{
+    for(;;)
+    {
+        work_pool_range_t *victim = NULL;
+        size_t largest = 0;
+        size_t i;
+        for(i = 1; i < pool->num_threads; i++)
+        {
+            work_pool_range_t *range = &pool->ranges[(thief_id + i) % pool->num_threads];
+            size_t remaining = range_remaining(range);
+            if(remaining > largest)
+            {
+                largest = remaining;
+                victim = range;
+            }
+        }
+        if(!victim) return false;
+
+        // the victim may have shrunk since it was measured
+        size_t start = 0;
+        size_t end = 0;
+        pthread_mutex_lock(&victim->lock);
+        size_t remaining = victim->tail - victim->head;
+        if(remaining)
+        {
+            size_t take = (remaining + 1) / 2;
+            end = victim->tail;
+            start = end - take;
+            victim->tail = start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if(start == end) continue;
+
+        work_pool_range_t *own = &pool->ranges[thief_id];
+        pthread_mutex_lock(&own->lock);
+        own->head = start;
+        own->tail = end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    work_pool_worker_t *worker = arg;
+    work_pool_t *pool = worker->pool;
+    size_t item;
+    do
+    {
+        while(take_own(&pool->ranges[worker->id], &item)) pool->fn(pool->ctx, worker->id, item);
+    } while(steal(pool, worker->id));
+    if(pool->done) pool->done(pool->ctx, worker->id);
+    return NULL;
+}
+
+work_pool_result_t work_pool_run(size_t num_threads, size_t num_items, work_pool_fn_t fn, work_pool_done_fn_t done, void *ctx)
+{
+    work_pool_result_t result = WORK_POOL_RESULT_SUCCESS;
+    if(!num_threads) num_threads = 1;
+    if(num_threads > num_items && num_items) num_threads = num_items;
+
+    work_pool_t pool = { .fn = fn, .done = done, .ctx = ctx, .num_threads = num_threads };
+    pool.ranges = calloc(num_threads, sizeof(work_pool_range_t));
+    work_pool_worker_t *workers = calloc(num_threads, sizeof(work_pool_worker_t));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    if(!pool.ranges || !workers || !threads)
+    {
+        result = WORK_POOL_RESULT_ALLOC_ERR;
+        goto end;
+    }
+
+    // hand out equal contiguous slices up front; stealing evens out the rest.
+    size_t i;
+    for(i = 0; i < num_threads; i++)
+    {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].head = num_items * i / num_threads;
+        pool.ranges[i].tail = num_items * (i + 1) / num_threads;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    size_t started;
+    for(started = 1; started < num_threads; started++)
+    {
+        if(pthread_create(&threads[started], NULL, worker_main, &workers[started]))
+        {
+            // the threads that did start (and this one) will steal the
+            // orphaned range, so the run still completes.
+            result = WORK_POOL_RESULT_THREAD_ERR;
+            break;
+        }
+    }
+    worker_main(&workers[0]);
+    for(i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    for(i = 0; i < num_threads; i++) pthread_mutex_destroy(&pool.ranges[i].lock);
+
+end:
+    free(threads);
+    free(workers);
+    free(pool.ranges);
+    return result;
+}
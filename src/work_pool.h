@@ -0,0 +1,37 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+
+// A small work-stealing thread pool for running the same function over a
+// fixed set of items (e.g. every ROM in a library).
+//
+// Each worker starts out owning a contiguous range of item indices. It takes
+// items from the front of its own range; once that is empty, it steals the
+// back half of the largest remaining range of another worker. A single slow
+// item (say, a huge NES 2.0 image) therefore only ever holds up the worker
+// that is processing it.
+
+typedef enum work_pool_result
+{
+    WORK_POOL_RESULT_SUCCESS = 0,
+    WORK_POOL_RESULT_ALLOC_ERR,
+    WORK_POOL_RESULT_THREAD_ERR
+} work_pool_result_t;
+static const char *const WORK_POOL_RESULT_STR[] = {"success", "memory allocation failed", "could not start worker thread"};
+
+// called once per item, possibly from several threads at once. worker_id is
+// in [0, num_threads) and can be used to index per-thread scratch state.
+typedef void (*work_pool_fn_t)(void *ctx, size_t worker_id, size_t item);
+
+// called once by every worker, on its own thread, after its last item: for
+// per-thread state that has to be finished by the thread that used it, such
+// as I/O it submitted, which would not outlive the thread
+typedef void (*work_pool_done_fn_t)(void *ctx, size_t worker_id);
+
+// runs fn over every item in [0, num_items) using num_threads workers and
+// returns once all items are done. num_threads == 0 is treated as 1. The
+// calling thread acts as worker 0. done may be NULL.
+work_pool_result_t work_pool_run(size_t num_threads, size_t num_items, work_pool_fn_t fn, work_pool_done_fn_t done, void *ctx);
+
+#endif
@@ -0,0 +1,309 @@
+#include "zip_reader.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "crc32.h"
+
+static const uint32_t EOCD_SIGNATURE = 0x06054b50;
+static const uint32_t ZIP64_EOCD_SIGNATURE = 0x06064b50;
+static const uint32_t ZIP64_EOCD_LOCATOR_SIGNATURE = 0x07064b50;
+static const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const size_t EOCD_SIZE = 22;
+static const size_t ZIP64_EOCD_SIZE = 56;
+static const size_t ZIP64_EOCD_LOCATOR_SIZE = 20;
+static const size_t CENTRAL_HEADER_SIZE = 46;
+static const size_t LOCAL_HEADER_SIZE = 30;
+static const uint16_t ZIP64_EXTRA_ID = 0x0001;
+static const uint16_t FLAG_ENCRYPTED = 0x0001;
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATED = 8;
+
+// all zip integers are little endian and unaligned
+static uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(const uint8_t *p)
+{
+    return (uint64_t)read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+// the end of central directory record sits at the very end of the archive,
+// followed only by a comment of up to 64K
+static const uint8_t *find_eocd(const uint8_t *map, size_t map_size)
+{
+    if(map_size < EOCD_SIZE) return NULL;
+    size_t lowest = map_size > EOCD_SIZE + 0xffff ? map_size - EOCD_SIZE - 0xffff : 0;
+    size_t pos = map_size - EOCD_SIZE;
+    for(;;)
+    {
+        if(read_u32(map + pos) == EOCD_SIGNATURE && pos + EOCD_SIZE + read_u16(map + pos + 20) <= map_size) return map + pos;
+        if(pos == lowest) return NULL;
+        pos--;
+    }
+}
+
+// replaces the 32-bit fields that are saturated at 0xffffffff with their
+// values from the zip64 extended information extra field
+static bool apply_zip64_extra(const uint8_t *extra, size_t extra_len, zip_entry_t *entry, bool usize_64, bool csize_64, bool offset_64)
+{
+    while(extra_len >= 4)
+    {
+        uint16_t id = read_u16(extra);
+        uint16_t len = read_u16(extra + 2);
+        if(4 + (size_t)len > extra_len) return false;
+        if(id == ZIP64_EXTRA_ID)
+        {
+            const uint8_t *field = extra + 4;
+            size_t needed = 8 * (usize_64 + csize_64 + offset_64);
+            if(len < needed) return false;
+            if(usize_64) entry->uncompressed_size = read_u64(field), field += 8;
+            if(csize_64) entry->compressed_size = read_u64(field), field += 8;
+            if(offset_64) entry->local_header_offset = read_u64(field);
+            return true;
+        }
+        extra += 4 + len;
+        extra_len -= 4 + len;
+    }
+    return !(usize_64 || csize_64 || offset_64);
+}
+
+static zip_reader_result_t parse_central_directory(zip_reader_t *zip)
+{
+    const uint8_t *eocd = find_eocd(zip->map, zip->map_size);
+    if(!eocd) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+    if(read_u16(eocd + 4) || read_u16(eocd + 6)) return ZIP_READER_RESULT_UNSUPPORTED; // multi-disk
+    uint64_t num_entries = read_u16(eocd + 10);
+    uint64_t cd_size = read_u32(eocd + 12);
+    uint64_t cd_offset = read_u32(eocd + 16);
+
+    size_t eocd_pos = eocd - zip->map;
+    if(eocd_pos >= ZIP64_EOCD_LOCATOR_SIZE && read_u32(eocd - ZIP64_EOCD_LOCATOR_SIZE) == ZIP64_EOCD_LOCATOR_SIGNATURE)
+    {
+        uint64_t zip64_eocd_pos = read_u64(eocd - ZIP64_EOCD_LOCATOR_SIZE + 8);
+        if(zip->map_size < ZIP64_EOCD_SIZE || zip64_eocd_pos > zip->map_size - ZIP64_EOCD_SIZE) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+        const uint8_t *zip64_eocd = zip->map + zip64_eocd_pos;
+        if(read_u32(zip64_eocd) != ZIP64_EOCD_SIGNATURE) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+        if(read_u32(zip64_eocd + 16) || read_u32(zip64_eocd + 20)) return ZIP_READER_RESULT_UNSUPPORTED;
+        num_entries = read_u64(zip64_eocd + 32);
+        cd_size = read_u64(zip64_eocd + 40);
+        cd_offset = read_u64(zip64_eocd + 48);
+    }
+    if(cd_offset > zip->map_size || cd_size > zip->map_size - cd_offset || num_entries > cd_size / CENTRAL_HEADER_SIZE)
+        return ZIP_READER_RESULT_INVALID_ARCHIVE;
+
+    zip->entries = calloc(num_entries ? num_entries : 1, sizeof(zip_entry_t));
+    if(!zip->entries) return ZIP_READER_RESULT_ALLOC_ERR;
+    const uint8_t *p = zip->map + cd_offset;
+    const uint8_t *end = p + cd_size;
+    uint64_t i;
+    for(i = 0; i < num_entries; i++)
+    {
+        if(end - p < (ptrdiff_t)CENTRAL_HEADER_SIZE || read_u32(p) != CENTRAL_HEADER_SIGNATURE) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+        size_t name_len = read_u16(p + 28);
+        size_t extra_len = read_u16(p + 30);
+        size_t comment_len = read_u16(p + 32);
+        if((size_t)(end - p) < CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+
+        zip_entry_t *entry = &zip->entries[i];
+        entry->flags = read_u16(p + 8);
+        entry->method = read_u16(p + 10);
+        entry->crc32 = read_u32(p + 16);
+        entry->compressed_size = read_u32(p + 20);
+        entry->uncompressed_size = read_u32(p + 24);
+        entry->local_header_offset = read_u32(p + 42);
+        entry->name = (const char *)p + CENTRAL_HEADER_SIZE;
+        entry->name_len = name_len;
+        if(!apply_zip64_extra(p + CENTRAL_HEADER_SIZE + name_len, extra_len, entry,
+            entry->uncompressed_size == UINT32_MAX, entry->compressed_size == UINT32_MAX, entry->local_header_offset == UINT32_MAX))
+            return ZIP_READER_RESULT_INVALID_ARCHIVE;
+        p += CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+    }
+    zip->num_entries = num_entries;
+    return ZIP_READER_RESULT_SUCCESS;
+}
+
+zip_reader_result_t zip_reader_open(const char *path, zip_reader_t *out)
+{
+    zip_reader_result_t result = ZIP_READER_RESULT_SUCCESS;
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return ZIP_READER_RESULT_OPEN_ERR;
+
+    struct stat st;
+    if(fstat(fd, &st))
+    {
+        result = ZIP_READER_RESULT_OPEN_ERR;
+        goto close_fd;
+    }
+    if((size_t)st.st_size < EOCD_SIZE)
+    {
+        result = ZIP_READER_RESULT_INVALID_ARCHIVE;
+        goto close_fd;
+    }
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        result = ZIP_READER_RESULT_OPEN_ERR;
+        goto close_fd;
+    }
+    // entries are inflated front to back
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    out->map = map;
+    out->map_size = st.st_size;
+    if((result = parse_central_directory(out))) zip_reader_close(out);
+
+close_fd:
+    // the mapping stays valid after the descriptor is closed.
+    close(fd);
+    return result;
+}
+
+const zip_entry_t *zip_reader_find_suffix(const zip_reader_t *zip, const char *suffix)
+{
+    size_t suffix_len = strlen(suffix);
+    size_t i;
+    for(i = 0; i < zip->num_entries; i++)
+    {
+        const zip_entry_t *entry = &zip->entries[i];
+        if(entry->name_len >= suffix_len && !strncasecmp(entry->name + entry->name_len - suffix_len, suffix, suffix_len))
+            return entry;
+    }
+    return NULL;
+}
+
+// the compressed data of an entry starts after its local header, whose extra
+// field may differ in length from the central directory's copy
+static const uint8_t *entry_data(const zip_reader_t *zip, const zip_entry_t *entry)
+{
+    if(entry->local_header_offset > zip->map_size || zip->map_size - entry->local_header_offset < LOCAL_HEADER_SIZE) return NULL;
+    const uint8_t *local = zip->map + entry->local_header_offset;
+    if(read_u32(local) != LOCAL_HEADER_SIGNATURE) return NULL;
+    uint64_t data_offset = entry->local_header_offset + LOCAL_HEADER_SIZE + read_u16(local + 26) + read_u16(local + 28);
+    if(data_offset > zip->map_size || zip->map_size - data_offset < entry->compressed_size) return NULL;
+    return zip->map + data_offset;
+}
+
+static zip_reader_result_t extract_stored(const uint8_t *data, const zip_entry_t *entry, uint8_t *out, size_t chunk_size, zip_reader_progress_fn progress, void *ctx, uint32_t *crc_out)
+{
+    if(entry->compressed_size != entry->uncompressed_size) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+    uint32_t crc = 0;
+    uint64_t produced = 0;
+    while(produced < entry->uncompressed_size)
+    {
+        size_t len = entry->uncompressed_size - produced < chunk_size ? entry->uncompressed_size - produced : chunk_size;
+        memcpy(out + produced, data + produced, len);
+        crc = crc32_update(crc, out + produced, len);
+        produced += len;
+        if(progress(ctx, out, produced)) return ZIP_READER_RESULT_STOPPED;
+    }
+    *crc_out = crc;
+    return ZIP_READER_RESULT_SUCCESS;
+}
+
+static zip_reader_result_t extract_deflated(const uint8_t *data, const zip_entry_t *entry, uint8_t *out, size_t chunk_size, zip_reader_progress_fn progress, void *ctx, uint32_t *crc_out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // negative window bits: raw deflate, zip has no zlib header
+    if(inflateInit2(&zs, -MAX_WBITS) != Z_OK) return ZIP_READER_RESULT_ALLOC_ERR;
+
+    zip_reader_result_t result = ZIP_READER_RESULT_SUCCESS;
+    uint32_t crc = 0;
+    uint64_t consumed = 0;
+    uint64_t produced = 0;
+    int ret = Z_OK;
+    while(ret != Z_STREAM_END)
+    {
+        if(!zs.avail_in && consumed < entry->compressed_size)
+        {
+            uint64_t left = entry->compressed_size - consumed;
+            zs.next_in = (Bytef *)(data + consumed);
+            zs.avail_in = left < UINT_MAX ? (uInt)left : UINT_MAX;
+            consumed += zs.avail_in;
+        }
+        uint64_t room = entry->uncompressed_size - produced;
+        // one byte of room past the end lets inflate report data that runs
+        // longer than the directory says
+        uint8_t overflow;
+        zs.next_out = room ? out + produced : &overflow;
+        zs.avail_out = room ? (room < chunk_size ? (uInt)room : (uInt)chunk_size) : 1;
+        uInt avail_out = zs.avail_out;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        size_t got = avail_out - zs.avail_out;
+        if(ret != Z_OK && ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && got))
+        {
+            result = ZIP_READER_RESULT_CORRUPT_DATA;
+            goto end;
+        }
+        if(!room)
+        {
+            if(got)
+            {
+                result = ZIP_READER_RESULT_CORRUPT_DATA;
+                goto end;
+            }
+            continue;
+        }
+        if(!got) continue;
+        crc = crc32_update(crc, out + produced, got);
+        produced += got;
+        if(progress(ctx, out, produced))
+        {
+            result = ZIP_READER_RESULT_STOPPED;
+            goto end;
+        }
+    }
+    if(produced != entry->uncompressed_size) result = ZIP_READER_RESULT_CORRUPT_DATA;
+    *crc_out = crc;
+
+end:
+    inflateEnd(&zs);
+    return result;
+}
+
+zip_reader_result_t zip_reader_extract(
+    const zip_reader_t *zip,
+    const zip_entry_t *entry,
+    uint8_t *out,
+    size_t chunk_size,
+    zip_reader_progress_fn progress,
+    void *ctx)
+{
+    if(entry->flags & FLAG_ENCRYPTED) return ZIP_READER_RESULT_UNSUPPORTED;
+    if(entry->method != METHOD_STORED && entry->method != METHOD_DEFLATED) return ZIP_READER_RESULT_UNSUPPORTED;
+    const uint8_t *data = entry_data(zip, entry);
+    if(!data) return ZIP_READER_RESULT_INVALID_ARCHIVE;
+    if(chunk_size > UINT_MAX) chunk_size = UINT_MAX;
+
+    uint32_t crc;
+    zip_reader_result_t result = entry->method == METHOD_STORED
+        ? extract_stored(data, entry, out, chunk_size, progress, ctx, &crc)
+        : extract_deflated(data, entry, out, chunk_size, progress, ctx, &crc);
+    if(result) return result;
+    return crc == entry->crc32 ? ZIP_READER_RESULT_SUCCESS : ZIP_READER_RESULT_CORRUPT_DATA;
+}
+
+void zip_reader_close(zip_reader_t *zip)
+{
+    free(zip->entries);
+    if(zip->map) munmap((void *)zip->map, zip->map_size);
+    memset(zip, 0, sizeof(*zip));
+}
@@ -0,0 +1,76 @@
+#ifndef ZIP_READER_H
+#define ZIP_READER_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Reads entries straight out of a .zip archive, so ROM sets stored one ROM
+// per archive can be parsed without unpacking them to disk first. The archive
+// is mapped and its central directory parsed once on open; an entry's data is
+// then inflated (or copied, for stored entries) into a caller buffer a chunk
+// at a time, with a callback after every chunk so the caller can act on the
+// bytes that have arrived while the rest are still being inflated.
+//
+// Supports stored and deflated entries and zip64 archives. Encrypted entries
+// and multi-disk archives are rejected.
+// https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+
+typedef struct zip_entry
+{
+    const char *name;        // points into the mapped archive, not null terminated
+    size_t name_len;
+    uint16_t flags;
+    uint16_t method;
+    uint32_t crc32;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+} zip_entry_t;
+
+typedef struct zip_reader
+{
+    const uint8_t *map;
+    size_t map_size;
+    zip_entry_t *entries;    // in central directory order
+    size_t num_entries;
+} zip_reader_t;
+
+typedef enum zip_reader_result
+{
+    ZIP_READER_RESULT_SUCCESS = 0,
+    ZIP_READER_RESULT_ALLOC_ERR,
+    ZIP_READER_RESULT_OPEN_ERR,
+    ZIP_READER_RESULT_INVALID_ARCHIVE,
+    ZIP_READER_RESULT_UNSUPPORTED,
+    ZIP_READER_RESULT_CORRUPT_DATA,
+    ZIP_READER_RESULT_STOPPED
+} zip_reader_result_t;
+static const char *const ZIP_READER_RESULT_STR[] = {"success", "memory allocation failed", "could not open archive", "not a valid zip archive", "unsupported zip feature", "corrupt compressed data", "stopped by caller"};
+
+zip_reader_result_t zip_reader_open(const char *path, zip_reader_t *out);
+
+// the first entry that is a file whose name ends in suffix (compared case
+// insensitively), or NULL
+const zip_entry_t *zip_reader_find_suffix(const zip_reader_t *zip, const char *suffix);
+
+// called as data arrives: out[0, produced) now holds the first produced
+// bytes of the entry. Returning non-zero stops the extraction.
+typedef int (*zip_reader_progress_fn)(void *ctx, const uint8_t *out, uint64_t produced);
+
+// writes the entry's uncompressed data to out, which must have room for
+// entry->uncompressed_size bytes, calling progress after every chunk_size
+// bytes and once at the end. The data is checked against the entry's CRC32
+// once complete. Returns ZIP_READER_RESULT_STOPPED if progress stopped it.
+zip_reader_result_t zip_reader_extract(
+    const zip_reader_t *zip,
+    const zip_entry_t *entry,
+    uint8_t *out,
+    size_t chunk_size,
+    zip_reader_progress_fn progress,
+    void *ctx);
+
+// releases all resources that this object allocated
+void zip_reader_close(zip_reader_t *zip);
+
+#endif